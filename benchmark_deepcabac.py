@@ -0,0 +1,58 @@
+# Benchmark do deepCABAC: quantize (URQ e TCQ), encode, decode e dequant sobre
+# tensores sintéticos com shapes e distribuições de redes reais.
+# A medição é feita pelo programa C++ deepcabac_bench (DEEPCABAC_BUILD_APPS no
+# CMake), que liga a deepcabac_core direto: este script só o encontra e repassa
+# as opções. Os resultados (pesos/s por etapa e a escala de 1 a N threads) saem no
+# terminal e, com --json, num arquivo para comparar entre versões.
+#
+# Uso:
+#   python benchmark_deepcabac.py --json resultados.json
+#   python benchmark_deepcabac.py --scale 0.25 --repeat 5 --max-threads 16
+#   python benchmark_deepcabac.py --bench build/deepcabac_bench
+import argparse
+import os
+import shutil
+import subprocess
+import sys
+
+# Onde procurar o executável quando --bench e $DEEPCABAC_BENCH não são dados
+BUILD_DIRS = ["build", "_build", os.path.join("build", "Release"), os.path.join("build", "bin")]
+
+
+def find_bench(explicit):
+    if explicit:
+        return explicit
+    if os.environ.get("DEEPCABAC_BENCH"):
+        return os.environ["DEEPCABAC_BENCH"]
+    root = os.path.dirname(os.path.abspath(__file__))
+    exe = "deepcabac_bench.exe" if os.name == "nt" else "deepcabac_bench"
+    for build_dir in BUILD_DIRS:
+        path = os.path.join(root, build_dir, exe)
+        if os.path.isfile(path):
+            return path
+    return shutil.which("deepcabac_bench")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Benchmark de quantize/encode/decode/dequant do deepCABAC (roda o deepcabac_bench)")
+    parser.add_argument("--scale", type=float, default=1.0, help="Fator aplicado à primeira dimensão dos tensores")
+    parser.add_argument("--repeat", type=int, default=3, help="Repetições por medida (vale a melhor)")
+    parser.add_argument("--max-threads", type=int, default=os.cpu_count() or 1, help="Maior número de threads da curva de escala")
+    parser.add_argument("--seed", type=int, default=0)
+    parser.add_argument("--json", default=None, help="Arquivo de saída com os resultados")
+    parser.add_argument("--bench", default=None, help="Caminho do deepcabac_bench (padrão: $DEEPCABAC_BENCH, build/ ou PATH)")
+    args = parser.parse_args()
+
+    bench = find_bench(args.bench)
+    if not bench:
+        sys.exit("deepcabac_bench não encontrado: gere com o CMake (DEEPCABAC_BUILD_APPS) e passe --bench")
+
+    command = [bench, "--scale", str(args.scale), "--repeat", str(args.repeat),
+               "--max-threads", str(args.max_threads), "--seed", str(args.seed)]
+    if args.json:
+        command += ["--json", args.json]
+    sys.exit(subprocess.call(command))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,194 @@
+#include "TensorContainer.h"
+
+#include <cstring>
+#include <stdexcept>
+
+static const char kContainerMagic[4] = { 'N', 'N', 'C', 'B' };
+static const uint64_t kHeaderBytes   = 16;
+
+// ---------------------------------------------------------------------------
+// Serialização do índice
+
+static void putBytes( std::vector<uint8_t>& out, const void* data, size_t bytes )
+{
+  const uint8_t* p = (const uint8_t*) data;
+  out.insert( out.end(), p, p + bytes );
+}
+
+template <typename T>
+static void putValue( std::vector<uint8_t>& out, T value )
+{
+  // Little-endian, independente do host
+  for( size_t i = 0; i < sizeof( T ); i++ ) { out.push_back( (uint8_t) ( (uint64_t) value >> ( 8 * i ) ) ); }
+}
+
+static void putString( std::vector<uint8_t>& out, const std::string& s )
+{
+  putValue<uint32_t>( out, (uint32_t) s.size() );
+  putBytes( out, s.data(), s.size() );
+}
+
+class IndexCursor
+{
+public:
+  IndexCursor( const uint8_t* begin, const uint8_t* end ) : m_Pos( begin ), m_End( end ) {}
+
+  template <typename T>
+  T get()
+  {
+    need( sizeof( T ) );
+    uint64_t value = 0;
+    for( size_t i = 0; i < sizeof( T ); i++ ) { value |= (uint64_t) m_Pos[i] << ( 8 * i ); }
+    m_Pos += sizeof( T );
+    return (T) value;
+  }
+
+  std::string getString()
+  {
+    uint32_t len = get<uint32_t>();
+    need( len );
+    std::string s( (const char*) m_Pos, len );
+    m_Pos += len;
+    return s;
+  }
+
+private:
+  void need( uint64_t bytes ) { if( (uint64_t) ( m_End - m_Pos ) < bytes ) { throw std::runtime_error( "Índice do contêiner truncado" ); } }
+
+  const uint8_t* m_Pos;
+  const uint8_t* m_End;
+};
+
+// ---------------------------------------------------------------------------
+// ContainerWriter
+
+ContainerWriter::ContainerWriter( const std::string& path ) : m_Path( path ), m_File( nullptr ), m_Position( 0 )
+{
+  m_File = fopen( path.c_str(), "wb" );
+  if( m_File == nullptr ) { throw std::runtime_error( "Não foi possível criar " + path ); }
+  // Cabeçalho provisório: a posição do índice é regravada em finish()
+  std::vector<uint8_t> header;
+  putBytes( header, kContainerMagic, 4 );
+  putValue<uint32_t>( header, kContainerVersion );
+  putValue<uint64_t>( header, 0 );
+  write( header.data(), header.size() );
+}
+
+ContainerWriter::~ContainerWriter()
+{
+  if( m_File != nullptr ) { fclose( m_File ); }
+}
+
+void ContainerWriter::write( const void* data, uint64_t bytes )
+{
+  if( bytes > 0 && fwrite( data, 1, bytes, m_File ) != bytes ) { throw std::runtime_error( "Erro ao gravar " + m_Path ); }
+  m_Position += bytes;
+}
+
+void ContainerWriter::append( ContainerTensor tensor, const uint8_t* data, uint64_t bytes )
+{
+  tensor.offset = m_Position;
+  tensor.bytes  = bytes;
+  write( data, bytes );
+  m_Tensors.push_back( tensor );
+}
+
+void ContainerWriter::appendReference( ContainerTensor tensor, size_t original )
+{
+  if( original >= m_Tensors.size() ) { throw std::runtime_error( "Referência a um tensor ainda não gravado: " + tensor.name ); }
+  tensor.offset = m_Tensors[original].offset;
+  tensor.bytes  = m_Tensors[original].bytes;
+  m_Tensors.push_back( tensor );
+}
+
+void ContainerWriter::finish()
+{
+  std::vector<uint8_t> index;
+  putValue<uint32_t>( index, (uint32_t) m_Files.size() );
+  for( size_t i = 0; i < m_Files.size(); i++ )
+  {
+    putString( index, m_Files[i].path );
+    putString( index, m_Files[i].format );
+    putString( index, m_Files[i].metadata );
+  }
+  putValue<uint32_t>( index, (uint32_t) m_Tensors.size() );
+  for( size_t i = 0; i < m_Tensors.size(); i++ )
+  {
+    const ContainerTensor& t = m_Tensors[i];
+    putValue<uint32_t>( index, t.fileIndex );
+    putString( index, t.name );
+    putString( index, t.dtype );
+    putValue<uint8_t>( index, (uint8_t) t.shape.size() );
+    for( size_t d = 0; d < t.shape.size(); d++ ) { putValue<int64_t>( index, t.shape[d] ); }
+    putValue<uint8_t>( index, t.fortranOrder );
+    putValue<uint8_t>( index, t.coding );
+    putValue<uint8_t>( index, t.dq_flag );
+    putValue<int32_t>( index, t.qp );
+    putValue<int32_t>( index, t.qpDensity );
+    putValue<int32_t>( index, t.scan_order );
+    putValue<uint32_t>( index, t.maxNumNoRem );
+    putValue<uint64_t>( index, t.offset );
+    putValue<uint64_t>( index, t.bytes );
+  }
+
+  uint64_t indexOffset = m_Position;
+  write( index.data(), index.size() );
+
+  std::vector<uint8_t> position;
+  putValue<uint64_t>( position, indexOffset );
+  bool ok = fseek( m_File, 8, SEEK_SET ) == 0 && fwrite( position.data(), 1, 8, m_File ) == 8;
+  ok = fclose( m_File ) == 0 && ok;
+  m_File = nullptr;
+  if( !ok ) { throw std::runtime_error( "Erro ao gravar " + m_Path ); }
+}
+
+// ---------------------------------------------------------------------------
+// ContainerReader
+
+ContainerReader::ContainerReader( const std::string& path ) : m_Mapping( std::make_shared<MappedFile>( path ) )
+{
+  const uint8_t* p = m_Mapping->data();
+  uint64_t size    = m_Mapping->size();
+  if( size < kHeaderBytes || memcmp( p, kContainerMagic, 4 ) != 0 ) { throw std::runtime_error( path + " não é um contêiner nncbatch" ); }
+
+  IndexCursor header( p + 4, p + kHeaderBytes );
+  uint32_t version    = header.get<uint32_t>();
+  uint64_t indexOffset = header.get<uint64_t>();
+  if( version != kContainerVersion ) { throw std::runtime_error( path + ": versão de contêiner não suportada" ); }
+  if( indexOffset < kHeaderBytes || indexOffset > size ) { throw std::runtime_error( path + ": contêiner incompleto (sem índice)" ); }
+
+  IndexCursor index( p + indexOffset, p + size );
+  uint32_t numFiles = index.get<uint32_t>();
+  for( uint32_t i = 0; i < numFiles; i++ )
+  {
+    ContainerFile file;
+    file.path     = index.getString();
+    file.format   = index.getString();
+    file.metadata = index.getString();
+    m_Files.push_back( file );
+  }
+  uint32_t numTensors = index.get<uint32_t>();
+  for( uint32_t i = 0; i < numTensors; i++ )
+  {
+    ContainerTensor t;
+    t.fileIndex = index.get<uint32_t>();
+    t.name      = index.getString();
+    t.dtype     = index.getString();
+    uint8_t ndim = index.get<uint8_t>();
+    for( uint8_t d = 0; d < ndim; d++ ) { t.shape.push_back( index.get<int64_t>() ); }
+    t.fortranOrder = index.get<uint8_t>();
+    t.coding       = index.get<uint8_t>();
+    t.dq_flag      = index.get<uint8_t>();
+    t.qp           = index.get<int32_t>();
+    t.qpDensity    = index.get<int32_t>();
+    t.scan_order   = index.get<int32_t>();
+    t.maxNumNoRem  = index.get<uint32_t>();
+    t.offset       = index.get<uint64_t>();
+    t.bytes        = index.get<uint64_t>();
+    if( t.fileIndex >= numFiles || t.offset < kHeaderBytes || t.offset > indexOffset || t.bytes > indexOffset - t.offset )
+    {
+      throw std::runtime_error( path + ": entrada de índice inválida para " + t.name );
+    }
+    m_Tensors.push_back( t );
+  }
+}
@@ -0,0 +1,103 @@
+#ifndef TENSOR_CONTAINER_H
+#define TENSOR_CONTAINER_H
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+#include "TensorIO.h"
+
+// Contêiner indexado do nncbatch (little-endian):
+//
+//   "NNCB" | uint32 versão | uint64 posição do índice
+//   streams dos tensores, um após o outro (CABAC independente por tensor)
+//   índice: arquivos de origem e, para cada tensor, arquivo, nome, dtype, shape,
+//           parâmetros de codificação e posição/tamanho do stream
+//
+// Cada tensor tem o próprio stream e começa com contextos novos, então qualquer
+// tensor pode ser decodificado sozinho e em paralelo com os outros. Um tensor
+// idêntico a outro (ex.: pesos amarrados) pode apontar para o stream dele: as duas
+// entradas do índice têm a mesma posição/tamanho e os bytes são gravados uma vez.
+
+static const uint32_t kContainerVersion = 1;
+
+enum TensorCoding
+{
+  CODING_CABAC = 0,   // Níveis quantizados e codificados com CABAC
+  CODING_RAW   = 1,   // Bytes originais (tipos que não são ponto flutuante)
+};
+
+struct ContainerFile
+{
+  std::string path;       // Relativo ao diretório de entrada
+  std::string format;     // "npy" ou "safetensors"
+  std::string metadata;   // safetensors: "__metadata__" original
+};
+
+struct ContainerTensor
+{
+  uint32_t              fileIndex;
+  std::string           name;
+  std::string           dtype;
+  std::vector<int64_t>  shape;
+  uint8_t               fortranOrder;
+  uint8_t               coding;
+  uint8_t               dq_flag;
+  int32_t               qp;
+  int32_t               qpDensity;
+  int32_t               scan_order;
+  uint32_t              maxNumNoRem;
+  uint64_t              offset;   // Posição do stream no contêiner
+  uint64_t              bytes;
+
+  ContainerTensor() : fileIndex( 0 ), fortranOrder( 0 ), coding( CODING_RAW ), dq_flag( 0 ), qp( 0 ), qpDensity( 0 ), scan_order( 0 ), maxNumNoRem( 0 ), offset( 0 ), bytes( 0 ) {}
+};
+
+class ContainerWriter
+{
+public:
+  explicit ContainerWriter( const std::string& path );
+  ~ContainerWriter();
+
+  // Grava o stream e preenche tensor.offset/bytes; o tensor entra no índice
+  void append( ContainerTensor tensor, const uint8_t* data, uint64_t bytes );
+  // Entrada que reusa o stream de um tensor já gravado (índice de tensorCount())
+  void appendReference( ContainerTensor tensor, size_t original );
+  size_t tensorCount() const { return m_Tensors.size(); }
+  void addFile( const ContainerFile& file ) { m_Files.push_back( file ); }
+  // Grava o índice e fecha o arquivo
+  void finish();
+
+  uint64_t bytesWritten() const { return m_Position; }
+
+private:
+  ContainerWriter( const ContainerWriter& );
+  ContainerWriter& operator=( const ContainerWriter& );
+
+  void write( const void* data, uint64_t bytes );
+
+  std::string                   m_Path;
+  FILE*                         m_File;
+  uint64_t                      m_Position;
+  std::vector<ContainerFile>    m_Files;
+  std::vector<ContainerTensor>  m_Tensors;
+};
+
+class ContainerReader
+{
+public:
+  explicit ContainerReader( const std::string& path );
+
+  const std::vector<ContainerFile>&   files()   const { return m_Files; }
+  const std::vector<ContainerTensor>& tensors() const { return m_Tensors; }
+  uint8_t* stream( const ContainerTensor& tensor ) const { return m_Mapping->data() + tensor.offset; }
+  uint64_t size() const { return m_Mapping->size(); }
+
+private:
+  std::shared_ptr<MappedFile>   m_Mapping;
+  std::vector<ContainerFile>    m_Files;
+  std::vector<ContainerTensor>  m_Tensors;
+};
+
+#endif // TENSOR_CONTAINER_H
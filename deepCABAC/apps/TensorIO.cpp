@@ -0,0 +1,539 @@
+#include "TensorIO.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <direct.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// ---------------------------------------------------------------------------
+// MappedFile
+
+MappedFile::MappedFile( const std::string& path ) : m_Data( nullptr ), m_Size( 0 )
+{
+#ifdef _WIN32
+  m_File    = INVALID_HANDLE_VALUE;
+  m_Mapping = nullptr;
+  HANDLE file = CreateFileA( path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr );
+  if( file == INVALID_HANDLE_VALUE ) { throw std::runtime_error( "Não foi possível abrir " + path ); }
+  m_File = file;
+  LARGE_INTEGER size;
+  GetFileSizeEx( file, &size );
+  m_Size = (uint64_t) size.QuadPart;
+  if( m_Size == 0 ) { return; }
+  m_Mapping = CreateFileMappingA( file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr );
+  if( m_Mapping != nullptr ) { m_Data = (uint8_t*) MapViewOfFile( (HANDLE) m_Mapping, FILE_MAP_COPY, 0, 0, 0 ); }
+  if( m_Data == nullptr )
+  {
+    if( m_Mapping != nullptr ) { CloseHandle( (HANDLE) m_Mapping ); }
+    CloseHandle( file );
+    throw std::runtime_error( "Não foi possível mapear " + path );
+  }
+#else
+  int fd = ::open( path.c_str(), O_RDONLY );
+  if( fd < 0 ) { throw std::runtime_error( "Não foi possível abrir " + path ); }
+  struct stat st;
+  if( fstat( fd, &st ) != 0 ) { ::close( fd ); throw std::runtime_error( "Não foi possível ler o tamanho de " + path ); }
+  m_Size = (uint64_t) st.st_size;
+  if( m_Size > 0 )
+  {
+    void* ptr = mmap( nullptr, m_Size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0 );
+    if( ptr == MAP_FAILED ) { ::close( fd ); throw std::runtime_error( "Não foi possível mapear " + path ); }
+    madvise( ptr, m_Size, MADV_SEQUENTIAL );
+    m_Data = (uint8_t*) ptr;
+  }
+  ::close( fd ); // O mapeamento continua válido sem o descritor
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+#ifdef _WIN32
+  if( m_Data != nullptr ) { UnmapViewOfFile( m_Data ); }
+  if( m_Mapping != nullptr ) { CloseHandle( (HANDLE) m_Mapping ); }
+  if( m_File != INVALID_HANDLE_VALUE ) { CloseHandle( (HANDLE) m_File ); }
+#else
+  if( m_Data != nullptr ) { munmap( m_Data, m_Size ); }
+#endif
+}
+
+// ---------------------------------------------------------------------------
+// Diretórios
+
+static bool endsWith( const std::string& s, const std::string& suffix )
+{
+  return s.size() >= suffix.size() && s.compare( s.size() - suffix.size(), suffix.size(), suffix ) == 0;
+}
+
+static void listRecursive( const std::string& root, const std::string& rel, std::vector<std::string>& out )
+{
+  std::string dir = rel.empty() ? root : root + "/" + rel;
+#ifdef _WIN32
+  WIN32_FIND_DATAA entry;
+  HANDLE find = FindFirstFileA( ( dir + "/*" ).c_str(), &entry );
+  if( find == INVALID_HANDLE_VALUE ) { throw std::runtime_error( "Não foi possível listar " + dir ); }
+  do
+  {
+    std::string name = entry.cFileName;
+    if( name == "." || name == ".." ) { continue; }
+    std::string child = rel.empty() ? name : rel + "/" + name;
+    if( entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY ) { listRecursive( root, child, out ); }
+    else if( endsWith( name, ".npy" ) || endsWith( name, ".safetensors" ) ) { out.push_back( child ); }
+  } while( FindNextFileA( find, &entry ) );
+  FindClose( find );
+#else
+  DIR* d = opendir( dir.c_str() );
+  if( d == nullptr ) { throw std::runtime_error( "Não foi possível listar " + dir ); }
+  while( struct dirent* entry = readdir( d ) )
+  {
+    std::string name = entry->d_name;
+    if( name == "." || name == ".." ) { continue; }
+    std::string child = rel.empty() ? name : rel + "/" + name;
+    struct stat st;
+    if( stat( ( root + "/" + child ).c_str(), &st ) != 0 ) { continue; }
+    if( S_ISDIR( st.st_mode ) ) { listRecursive( root, child, out ); }
+    else if( endsWith( name, ".npy" ) || endsWith( name, ".safetensors" ) ) { out.push_back( child ); }
+  }
+  closedir( d );
+#endif
+}
+
+std::vector<std::string> listTensorFiles( const std::string& root )
+{
+  std::vector<std::string> files;
+  listRecursive( root, "", files );
+  std::sort( files.begin(), files.end() );
+  return files;
+}
+
+void makeDirs( const std::string& path )
+{
+  for( size_t pos = 0; pos != std::string::npos; )
+  {
+    pos = path.find_first_of( "/\\", pos + 1 );
+    std::string prefix = path.substr( 0, pos );
+    if( prefix.empty() ) { continue; }
+#ifdef _WIN32
+    _mkdir( prefix.c_str() );
+#else
+    mkdir( prefix.c_str(), 0755 );
+#endif
+  }
+}
+
+// ---------------------------------------------------------------------------
+// Tipos
+
+TensorElementType tensorElementType( const std::string& format, const std::string& dtype )
+{
+  if( format == "npy" )
+  {
+    // Só little-endian; '=' vale como nativo (little-endian nas máquinas suportadas)
+    if( dtype == "<f4" || dtype == "=f4" ) { return TENSOR_F32; }
+    if( dtype == "<f2" || dtype == "=f2" ) { return TENSOR_F16; }
+    return TENSOR_RAW;
+  }
+  if( dtype == "F32" )  { return TENSOR_F32; }
+  if( dtype == "F16" )  { return TENSOR_F16; }
+  if( dtype == "BF16" ) { return TENSOR_BF16; }
+  return TENSOR_RAW;
+}
+
+uint64_t tensorElementCount( const std::vector<int64_t>& shape )
+{
+  uint64_t count = 1;
+  for( size_t i = 0; i < shape.size(); i++ ) { count *= (uint64_t) shape[i]; }
+  return count;
+}
+
+static uint64_t elementBytes( const std::string& format, const std::string& dtype )
+{
+  if( format == "npy" )
+  {
+    // descr como "<f4", "|u1", "<i8": o número final é o tamanho em bytes
+    size_t digits = dtype.find_first_of( "0123456789" );
+    return digits == std::string::npos ? 0 : (uint64_t) atoi( dtype.c_str() + digits );
+  }
+  if( dtype == "F64" || dtype == "I64" || dtype == "U64" ) { return 8; }
+  if( dtype == "F32" || dtype == "I32" || dtype == "U32" ) { return 4; }
+  if( dtype == "F16" || dtype == "BF16" || dtype == "I16" || dtype == "U16" ) { return 2; }
+  if( dtype == "I8" || dtype == "U8" || dtype == "BOOL" || dtype == "F8_E4M3" || dtype == "F8_E5M2" ) { return 1; }
+  return 0;
+}
+
+// ---------------------------------------------------------------------------
+// .npy
+
+static std::string npyHeaderValue( const std::string& header, const std::string& key )
+{
+  size_t pos = header.find( "'" + key + "'" );
+  if( pos == std::string::npos ) { throw std::runtime_error( "Cabeçalho npy sem '" + key + "'" ); }
+  pos = header.find( ':', pos );
+  size_t start = header.find_first_not_of( " ", pos + 1 );
+  size_t end;
+  if( header[start] == '\'' )      { end = header.find( '\'', start + 1 ) + 1; }
+  else if( header[start] == '(' )  { end = header.find( ')', start ) + 1; }
+  else                              { end = header.find_first_of( ",}", start ); }
+  return header.substr( start, end - start );
+}
+
+static TensorFile readNpy( const std::string& root, const std::string& relPath )
+{
+  TensorFile file;
+  file.path    = relPath;
+  file.format  = "npy";
+  file.mapping = std::make_shared<MappedFile>( root + "/" + relPath );
+
+  uint8_t* p    = file.mapping->data();
+  uint64_t size = file.mapping->size();
+  if( size < 10 || memcmp( p, "\x93NUMPY", 6 ) != 0 ) { throw std::runtime_error( relPath + " não é um arquivo npy" ); }
+  uint64_t headerLen, dataOffset;
+  if( p[6] == 1 ) { headerLen = p[8] | ( p[9] << 8 ); dataOffset = 10 + headerLen; }
+  else
+  {
+    if( size < 12 ) { throw std::runtime_error( relPath + ": cabeçalho npy truncado" ); }
+    headerLen  = (uint64_t) p[8] | ( (uint64_t) p[9] << 8 ) | ( (uint64_t) p[10] << 16 ) | ( (uint64_t) p[11] << 24 );
+    dataOffset = 12 + headerLen;
+  }
+  if( dataOffset > size ) { throw std::runtime_error( relPath + ": cabeçalho npy truncado" ); }
+  std::string header( (const char*) p + dataOffset - headerLen, headerLen );
+
+  TensorView tensor;
+  std::string descr = npyHeaderValue( header, "descr" );
+  if( descr.size() < 2 || descr[0] != '\'' ) { throw std::runtime_error( relPath + ": dtype npy estruturado não suportado" ); }
+  tensor.dtype        = descr.substr( 1, descr.size() - 2 );
+  tensor.fortranOrder = npyHeaderValue( header, "fortran_order" ) == "True";
+  std::string shape   = npyHeaderValue( header, "shape" );
+  for( size_t pos = 1; pos < shape.size(); )
+  {
+    size_t digit = shape.find_first_of( "0123456789", pos );
+    if( digit == std::string::npos ) { break; }
+    tensor.shape.push_back( (int64_t) strtoll( shape.c_str() + digit, nullptr, 10 ) );
+    pos = shape.find_first_not_of( "0123456789", digit );
+  }
+  uint64_t itemBytes = elementBytes( file.format, tensor.dtype );
+  if( itemBytes == 0 ) { throw std::runtime_error( relPath + ": dtype npy " + tensor.dtype + " não suportado" ); }
+  tensor.data        = p + dataOffset;
+  tensor.bytes       = tensorElementCount( tensor.shape ) * itemBytes;
+  tensor.elementType = tensorElementType( file.format, tensor.dtype );
+  if( tensor.bytes > size - dataOffset ) { throw std::runtime_error( relPath + ": dados npy truncados" ); }
+  file.tensors.push_back( tensor );
+  return file;
+}
+
+void writeNpy( const std::string& path, const std::string& descr, bool fortranOrder, const std::vector<int64_t>& shape, const uint8_t* data, uint64_t bytes )
+{
+  std::ostringstream dict;
+  dict << "{'descr': '" << descr << "', 'fortran_order': " << ( fortranOrder ? "True" : "False" ) << ", 'shape': (";
+  for( size_t i = 0; i < shape.size(); i++ ) { dict << ( i ? ", " : "" ) << shape[i]; }
+  dict << ( shape.size() == 1 ? ",), }" : "), }" );
+  std::string header = dict.str();
+  // Versão 1.0: cabeçalho completo alinhado a 64 bytes e terminado em '\n'
+  size_t total = 10 + header.size() + 1;
+  header.append( ( 64 - total % 64 ) % 64, ' ' );
+  header += '\n';
+
+  FILE* f = fopen( path.c_str(), "wb" );
+  if( f == nullptr ) { throw std::runtime_error( "Não foi possível criar " + path ); }
+  uint8_t preamble[10] = { 0x93, 'N', 'U', 'M', 'P', 'Y', 1, 0, (uint8_t) ( header.size() & 0xff ), (uint8_t) ( header.size() >> 8 ) };
+  bool ok = fwrite( preamble, 1, 10, f ) == 10 && fwrite( header.data(), 1, header.size(), f ) == header.size()
+         && ( bytes == 0 || fwrite( data, 1, bytes, f ) == bytes );
+  ok = fclose( f ) == 0 && ok;
+  if( !ok ) { throw std::runtime_error( "Erro ao gravar " + path ); }
+}
+
+// ---------------------------------------------------------------------------
+// .safetensors: 8 bytes com o tamanho do cabeçalho JSON, o JSON e os dados
+
+class JsonCursor
+{
+public:
+  JsonCursor( const char* begin, const char* end, const std::string& context ) : m_Pos( begin ), m_End( end ), m_Context( context ) {}
+
+  void skipWs() { while( m_Pos < m_End && ( *m_Pos == ' ' || *m_Pos == '\t' || *m_Pos == '\n' || *m_Pos == '\r' ) ) { m_Pos++; } }
+  char peek() { skipWs(); return m_Pos < m_End ? *m_Pos : '\0'; }
+  void expect( char c ) { if( peek() != c ) { fail( std::string( "esperado '" ) + c + "'" ); } m_Pos++; }
+  bool consume( char c ) { if( peek() != c ) { return false; } m_Pos++; return true; }
+  const char* pos() const { return m_Pos; }
+
+  std::string parseString()
+  {
+    expect( '"' );
+    std::string out;
+    while( m_Pos < m_End && *m_Pos != '"' )
+    {
+      char c = *m_Pos++;
+      if( c != '\\' ) { out += c; continue; }
+      if( m_Pos >= m_End ) { break; }
+      char e = *m_Pos++;
+      switch( e )
+      {
+      case 'n': out += '\n'; break;
+      case 't': out += '\t'; break;
+      case 'r': out += '\r'; break;
+      case 'b': out += '\b'; break;
+      case 'f': out += '\f'; break;
+      case 'u':
+        {
+          if( m_End - m_Pos < 4 ) { fail( "escape \\u truncado" ); }
+          unsigned code = (unsigned) strtoul( std::string( m_Pos, 4 ).c_str(), nullptr, 16 );
+          m_Pos += 4;
+          if( code < 0x80 )       { out += (char) code; }
+          else if( code < 0x800 ) { out += (char) ( 0xc0 | ( code >> 6 ) ); out += (char) ( 0x80 | ( code & 0x3f ) ); }
+          else                    { out += (char) ( 0xe0 | ( code >> 12 ) ); out += (char) ( 0x80 | ( ( code >> 6 ) & 0x3f ) ); out += (char) ( 0x80 | ( code & 0x3f ) ); }
+          break;
+        }
+      default: out += e; break;
+      }
+    }
+    expect( '"' );
+    return out;
+  }
+
+  int64_t parseInt()
+  {
+    skipWs();
+    char* end = nullptr;
+    long long value = strtoll( m_Pos, &end, 10 );
+    if( end == m_Pos ) { fail( "esperado um inteiro" ); }
+    m_Pos = end;
+    return (int64_t) value;
+  }
+
+  // Pula qualquer valor JSON; retorna o texto original
+  std::string skipValue()
+  {
+    skipWs();
+    const char* start = m_Pos;
+    char c = peek();
+    if( c == '"' ) { parseString(); }
+    else if( c == '{' || c == '[' )
+    {
+      char close = c == '{' ? '}' : ']';
+      m_Pos++;
+      if( !consume( close ) )
+      {
+        do
+        {
+          if( c == '{' ) { parseString(); expect( ':' ); }
+          skipValue();
+        } while( consume( ',' ) );
+        expect( close );
+      }
+    }
+    else { while( m_Pos < m_End && *m_Pos != ',' && *m_Pos != '}' && *m_Pos != ']' ) { m_Pos++; } }
+    return std::string( start, m_Pos );
+  }
+
+  void fail( const std::string& what ) { throw std::runtime_error( m_Context + ": cabeçalho safetensors inválido (" + what + ")" ); }
+
+private:
+  const char*  m_Pos;
+  const char*  m_End;
+  std::string  m_Context;
+};
+
+static std::string jsonEscape( const std::string& s )
+{
+  std::string out;
+  for( size_t i = 0; i < s.size(); i++ )
+  {
+    unsigned char c = (unsigned char) s[i];
+    if( c == '"' || c == '\\' ) { out += '\\'; out += (char) c; }
+    else if( c < 0x20 ) { char buf[8]; snprintf( buf, sizeof( buf ), "\\u%04x", c ); out += buf; }
+    else { out += (char) c; }
+  }
+  return out;
+}
+
+static TensorFile readSafetensors( const std::string& root, const std::string& relPath )
+{
+  TensorFile file;
+  file.path    = relPath;
+  file.format  = "safetensors";
+  file.mapping = std::make_shared<MappedFile>( root + "/" + relPath );
+
+  uint8_t* p    = file.mapping->data();
+  uint64_t size = file.mapping->size();
+  uint64_t headerLen = 0;
+  if( size >= 8 ) { for( int i = 7; i >= 0; i-- ) { headerLen = ( headerLen << 8 ) | p[i]; } }
+  if( size < 8 || headerLen > size - 8 ) { throw std::runtime_error( relPath + ": cabeçalho safetensors truncado" ); }
+  uint8_t* dataStart = p + 8 + headerLen;
+  uint64_t dataSize  = size - 8 - headerLen;
+
+  JsonCursor json( (const char*) p + 8, (const char*) dataStart, relPath );
+  json.expect( '{' );
+  if( !json.consume( '}' ) )
+  {
+    do
+    {
+      std::string name = json.parseString();
+      json.expect( ':' );
+      if( name == "__metadata__" ) { file.metadata = json.skipValue(); continue; }
+
+      TensorView tensor;
+      tensor.name         = name;
+      tensor.fortranOrder = false;
+      uint64_t begin = 0, end = 0;
+      json.expect( '{' );
+      do
+      {
+        std::string key = json.parseString();
+        json.expect( ':' );
+        if( key == "dtype" ) { tensor.dtype = json.parseString(); }
+        else if( key == "shape" )
+        {
+          json.expect( '[' );
+          if( !json.consume( ']' ) ) { do { tensor.shape.push_back( json.parseInt() ); } while( json.consume( ',' ) ); json.expect( ']' ); }
+        }
+        else if( key == "data_offsets" )
+        {
+          json.expect( '[' ); begin = (uint64_t) json.parseInt(); json.expect( ',' ); end = (uint64_t) json.parseInt(); json.expect( ']' );
+        }
+        else { json.skipValue(); }
+      } while( json.consume( ',' ) );
+      json.expect( '}' );
+
+      if( end < begin || end > dataSize ) { json.fail( "data_offsets fora do arquivo em " + name ); }
+      tensor.data        = dataStart + begin;
+      tensor.bytes       = end - begin;
+      tensor.elementType = tensorElementType( file.format, tensor.dtype );
+      uint64_t itemBytes = elementBytes( file.format, tensor.dtype );
+      if( itemBytes != 0 && tensorElementCount( tensor.shape ) * itemBytes != tensor.bytes ) { json.fail( "tamanho incoerente com shape em " + name ); }
+      if( itemBytes == 0 ) { tensor.elementType = TENSOR_RAW; }
+      file.tensors.push_back( tensor );
+    } while( json.consume( ',' ) );
+    json.expect( '}' );
+  }
+
+  struct ByOffset { bool operator()( const TensorView& a, const TensorView& b ) const { return a.data < b.data; } };
+  std::stable_sort( file.tensors.begin(), file.tensors.end(), ByOffset() );
+  return file;
+}
+
+void writeSafetensors( const std::string& path, const std::string& metadata, const std::vector<SafetensorsEntry>& tensors )
+{
+  std::ostringstream json;
+  json << "{";
+  bool first = true;
+  if( !metadata.empty() ) { json << "\"__metadata__\":" << metadata; first = false; }
+  uint64_t offset = 0;
+  for( size_t i = 0; i < tensors.size(); i++ )
+  {
+    const SafetensorsEntry& t = tensors[i];
+    json << ( first ? "" : "," ) << "\"" << jsonEscape( t.name ) << "\":{\"dtype\":\"" << t.dtype << "\",\"shape\":[";
+    for( size_t d = 0; d < t.shape.size(); d++ ) { json << ( d ? "," : "" ) << t.shape[d]; }
+    json << "],\"data_offsets\":[" << offset << "," << offset + t.bytes << "]}";
+    offset += t.bytes;
+    first = false;
+  }
+  json << "}";
+  std::string header = json.str();
+  header.append( ( 8 - header.size() % 8 ) % 8, ' ' ); // Dados alinhados a 8 bytes
+
+  FILE* f = fopen( path.c_str(), "wb" );
+  if( f == nullptr ) { throw std::runtime_error( "Não foi possível criar " + path ); }
+  uint8_t lenBytes[8];
+  for( int i = 0; i < 8; i++ ) { lenBytes[i] = (uint8_t) ( (uint64_t) header.size() >> ( 8 * i ) ); }
+  bool ok = fwrite( lenBytes, 1, 8, f ) == 8 && fwrite( header.data(), 1, header.size(), f ) == header.size();
+  for( size_t i = 0; ok && i < tensors.size(); i++ )
+  {
+    ok = tensors[i].bytes == 0 || fwrite( tensors[i].data, 1, tensors[i].bytes, f ) == tensors[i].bytes;
+  }
+  ok = fclose( f ) == 0 && ok;
+  if( !ok ) { throw std::runtime_error( "Erro ao gravar " + path ); }
+}
+
+TensorFile openTensorFile( const std::string& root, const std::string& relPath )
+{
+  return endsWith( relPath, ".npy" ) ? readNpy( root, relPath ) : readSafetensors( root, relPath );
+}
+
+// ---------------------------------------------------------------------------
+// Meia precisão
+
+static inline uint32_t floatBits( float f )     { uint32_t u; memcpy( &u, &f, 4 ); return u; }
+static inline float    bitsFloat( uint32_t u )  { float f; memcpy( &f, &u, 4 ); return f; }
+
+void halfToFloat( const uint16_t* src, float* dst, uint64_t n )
+{
+  for( uint64_t i = 0; i < n; i++ )
+  {
+    uint32_t h    = src[i];
+    uint32_t sign = ( h & 0x8000 ) << 16;
+    uint32_t exp  = ( h >> 10 ) & 0x1f;
+    uint32_t mant = h & 0x3ff;
+    uint32_t bits;
+    if( exp == 0x1f )   { bits = sign | 0x7f800000 | ( mant << 13 ); }
+    else if( exp != 0 ) { bits = sign | ( ( exp + 112 ) << 23 ) | ( mant << 13 ); }
+    else if( mant == 0 ) { bits = sign; }
+    else
+    {
+      // Subnormal: normaliza a mantissa
+      exp = 113;
+      while( !( mant & 0x400 ) ) { mant <<= 1; exp--; }
+      bits = sign | ( exp << 23 ) | ( ( mant & 0x3ff ) << 13 );
+    }
+    dst[i] = bitsFloat( bits );
+  }
+}
+
+void floatToHalf( const float* src, uint16_t* dst, uint64_t n )
+{
+  for( uint64_t i = 0; i < n; i++ )
+  {
+    uint32_t x    = floatBits( src[i] );
+    uint32_t sign = ( x >> 16 ) & 0x8000;
+    x &= 0x7fffffff;
+    uint32_t half;
+    if( x > 0x7f800000 )       { half = 0x7e00 | ( ( x >> 13 ) & 0x3ff ); }  // NaN
+    else if( x >= 0x477ff000 ) { half = 0x7c00; }                            // Arredonda para infinito
+    else if( x < 0x38800000 )
+    {
+      // Subnormal (ou zero) em meia precisão
+      if( x < 0x33000000 ) { half = 0; }
+      else
+      {
+        uint32_t shift = 126 - ( x >> 23 );
+        uint32_t mant  = ( x & 0x7fffff ) | 0x800000;
+        half = mant >> shift;
+        uint32_t rem = mant & ( ( 1u << shift ) - 1 ), halfway = 1u << ( shift - 1 );
+        if( rem > halfway || ( rem == halfway && ( half & 1 ) ) ) { half++; }
+      }
+    }
+    else
+    {
+      half = ( ( ( x >> 23 ) - 112 ) << 10 ) | ( ( x & 0x7fffff ) >> 13 );
+      uint32_t rem = x & 0x1fff;
+      if( rem > 0x1000 || ( rem == 0x1000 && ( half & 1 ) ) ) { half++; }
+    }
+    dst[i] = (uint16_t) ( sign | half );
+  }
+}
+
+void bf16ToFloat( const uint16_t* src, float* dst, uint64_t n )
+{
+  for( uint64_t i = 0; i < n; i++ ) { dst[i] = bitsFloat( (uint32_t) src[i] << 16 ); }
+}
+
+void floatToBf16( const float* src, uint16_t* dst, uint64_t n )
+{
+  for( uint64_t i = 0; i < n; i++ )
+  {
+    uint32_t x = floatBits( src[i] );
+    if( ( x & 0x7fffffff ) > 0x7f800000 ) { dst[i] = (uint16_t) ( ( x >> 16 ) | 0x40 ); continue; }
+    dst[i] = (uint16_t) ( ( x + 0x7fff + ( ( x >> 16 ) & 1 ) ) >> 16 );
+  }
+}
@@ -0,0 +1,95 @@
+#ifndef TENSOR_IO_H
+#define TENSOR_IO_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Leitura (mmap) e escrita de tensores em .npy e .safetensors, sem Python.
+// Erros de formato ou de E/S lançam std::runtime_error.
+
+// Arquivo mapeado em memória. O mapeamento é privado (copy-on-write): quem lê pode
+// passar os ponteiros direto ao quantize() sem alterar o arquivo em disco.
+class MappedFile
+{
+public:
+  explicit MappedFile( const std::string& path );
+  ~MappedFile();
+
+  const uint8_t* data() const { return m_Data; }
+  uint8_t*       data()       { return m_Data; }
+  uint64_t       size() const { return m_Size; }
+
+private:
+  MappedFile( const MappedFile& );
+  MappedFile& operator=( const MappedFile& );
+
+  uint8_t*  m_Data;
+  uint64_t  m_Size;
+#ifdef _WIN32
+  void*     m_File;
+  void*     m_Mapping;
+#endif
+};
+
+// Tipo do elemento visto pelo codec: F32/F16/BF16 são quantizados, o resto é guardado como está
+enum TensorElementType
+{
+  TENSOR_F32  = 0,
+  TENSOR_F16  = 1,
+  TENSOR_BF16 = 2,
+  TENSOR_RAW  = 3,
+};
+
+struct TensorView
+{
+  std::string           name;          // safetensors: nome do tensor; npy: vazio
+  std::string           dtype;         // Como no arquivo: descr do npy ("<f4") ou dtype do safetensors ("F32")
+  std::vector<int64_t>  shape;
+  bool                  fortranOrder;  // Só npy
+  uint8_t*              data;          // Dentro do mapeamento do arquivo
+  uint64_t              bytes;
+  TensorElementType     elementType;
+};
+
+struct TensorFile
+{
+  std::string                 path;       // Relativo ao diretório de entrada
+  std::string                 format;     // "npy" ou "safetensors"
+  std::string                 metadata;   // safetensors: objeto JSON "__metadata__" (texto original) ou vazio
+  std::vector<TensorView>     tensors;    // safetensors: em ordem de data_offsets
+  std::shared_ptr<MappedFile> mapping;
+};
+
+// Caminhos relativos (com '/') dos .npy e .safetensors sob root, em ordem alfabética
+std::vector<std::string> listTensorFiles( const std::string& root );
+
+TensorFile openTensorFile( const std::string& root, const std::string& relPath );
+
+TensorElementType tensorElementType( const std::string& format, const std::string& dtype );
+uint64_t          tensorElementCount( const std::vector<int64_t>& shape );
+
+// Cria o diretório e os pais que faltarem
+void makeDirs( const std::string& path );
+
+void writeNpy( const std::string& path, const std::string& descr, bool fortranOrder, const std::vector<int64_t>& shape, const uint8_t* data, uint64_t bytes );
+
+struct SafetensorsEntry
+{
+  std::string           name;
+  std::string           dtype;
+  std::vector<int64_t>  shape;
+  const uint8_t*        data;
+  uint64_t              bytes;
+};
+
+void writeSafetensors( const std::string& path, const std::string& metadata, const std::vector<SafetensorsEntry>& tensors );
+
+// Conversões de meia precisão (arredondamento para o par mais próximo)
+void halfToFloat( const uint16_t* src, float* dst, uint64_t n );
+void floatToHalf( const float* src, uint16_t* dst, uint64_t n );
+void bf16ToFloat( const uint16_t* src, float* dst, uint64_t n );
+void floatToBf16( const float* src, uint16_t* dst, uint64_t n );
+
+#endif // TENSOR_IO_H
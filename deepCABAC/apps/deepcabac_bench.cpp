@@ -0,0 +1,372 @@
+// deepcabac_bench: benchmark da biblioteca deepcabac_core, sem Python.
+//
+//   deepcabac_bench [--scale X] [--repeat N] [--max-threads N] [--seed N] [--json saida.json]
+//
+// Tensores sintéticos com shapes e distribuições de redes reais passam por quantize
+// (URQ e TCQ), encodeWeights, decodeWeights e deQuantize; cada etapa é medida em
+// pesos/s (melhor de --repeat rodadas). A quantização paralela (quantize_blocks_parallel)
+// e o deQuantize em faixas também são medidos de 1 a --max-threads threads, com o
+// speedup sobre uma thread. --json grava os resultados para comparar entre versões
+// (benchmark_deepcabac.py só chama este programa).
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#ifndef _WIN32
+#include <sys/utsname.h>
+#endif
+
+#include <Lib/CommonLib/TypeDef.h>
+#include <Lib/EncLib/CABACEncoder.h>
+#include <Lib/DecLib/CABACDecoder.h>
+
+#include "QuantEngine.h"
+#include "LayerCoder.h"
+#include "LayerSegments.h"
+
+// Mesmos parâmetros de codificação do benchmark e da regressão em Python
+static const int32_t   kQpDensity             = 2;
+static const float32_t kLambdaScale           = 0.0f;
+static const uint32_t  kCabacUnaryLengthMinus1 = 10;
+static const uint8_t   kParamOptFlag          = 0;
+static const int32_t   kScanOrder             = 0;   // Varredura em linhas: vale para qualquer shape
+
+enum Distribution { DIST_GAUSSIAN, DIST_LAPLACIAN, DIST_STUDENT_T };
+
+struct CorpusEntry
+{
+  const char*          name;
+  std::vector<int64_t> shape;
+  Distribution         distribution;
+};
+
+struct BenchTensor
+{
+  std::string            name;
+  std::vector<int64_t>   shape;
+  uint64_t               numWeights;
+  uint64_t               layerWidth;
+  int32_t                qp;
+  std::vector<float32_t> weights;
+};
+
+struct BenchOptions
+{
+  double   scale;
+  int      repeat;
+  int      maxThreads;
+  uint32_t seed;
+  std::string jsonPath;
+
+  BenchOptions() : scale( 1.0 ), repeat( 3 ), maxThreads( (int) std::max( 1u, std::thread::hardware_concurrency() ) ), seed( 0 ) {}
+};
+
+// Shapes típicos (conv 3x3, pontual, linear grande, embedding, bias) e distribuição
+// de cada um. --scale encolhe a primeira dimensão para rodadas rápidas.
+static std::vector<CorpusEntry> corpusEntries()
+{
+  std::vector<CorpusEntry> corpus;
+  CorpusEntry entries[] = {
+    { "conv3x3",   { 256, 256, 3, 3 }, DIST_GAUSSIAN },
+    { "conv1x1",   { 512, 256, 1, 1 }, DIST_LAPLACIAN },
+    { "linear",    { 4096, 4096 },     DIST_GAUSSIAN },
+    { "attn_proj", { 1024, 1024 },     DIST_STUDENT_T },
+    { "embedding", { 32000, 512 },     DIST_GAUSSIAN },
+    { "bias",      { 4096 },           DIST_LAPLACIAN },
+  };
+  corpus.assign( entries, entries + sizeof( entries ) / sizeof( entries[0] ) );
+  return corpus;
+}
+
+// Inicialização He com a distribuição pedida (mesma variância nas três)
+static void makeTensor( BenchTensor& t, Distribution distribution, std::mt19937_64& rng )
+{
+  uint64_t fanIn = t.shape.size() > 1 ? t.layerWidth : t.numWeights;
+  double   std   = std::sqrt( 2.0 / (double) std::max<uint64_t>( fanIn, 1 ) );
+  std::normal_distribution<double>      gauss( 0.0, std );
+  std::exponential_distribution<double> expo( std::sqrt( 2.0 ) / std );
+  std::student_t_distribution<double>   student( 3.0 );   // Cauda pesada
+  t.weights.resize( t.numWeights );
+  for( uint64_t i = 0; i < t.numWeights; i++ )
+  {
+    double value;
+    if( distribution == DIST_LAPLACIAN )      { value = ( rng() & 1 ) ? expo( rng ) : -expo( rng ); }
+    else if( distribution == DIST_STUDENT_T ) { value = student( rng ) * std / std::sqrt( 3.0 ); }
+    else                                      { value = gauss( rng ); }
+    t.weights[i] = (float32_t) value;
+  }
+}
+
+// QP tal que o passo fique perto de std/8 (mesma ordem de grandeza do uso real)
+static int32_t qpFor( const std::vector<float32_t>& weights )
+{
+  double sum = 0.0, sumSq = 0.0;
+  for( size_t i = 0; i < weights.size(); i++ ) { sum += weights[i]; sumSq += (double) weights[i] * weights[i]; }
+  double mean = sum / weights.size();
+  double std  = std::sqrt( std::max( sumSq / weights.size() - mean * mean, 0.0 ) );
+  double step = std::max( std / 8.0, 1e-8 );
+  return (int32_t) std::lround( std::log2( step ) * ( 1 << kQpDensity ) );
+}
+
+static std::vector<BenchTensor> makeCorpus( double scale, uint32_t seed )
+{
+  std::mt19937_64 rng( seed );
+  std::vector<BenchTensor> corpus;
+  for( const CorpusEntry& entry : corpusEntries() )
+  {
+    BenchTensor t;
+    t.name     = entry.name;
+    t.shape    = entry.shape;
+    t.shape[0] = std::max<int64_t>( 1, (int64_t) ( t.shape[0] * scale ) );
+    getLayerDims( t.shape, t.numWeights, t.layerWidth );
+    makeTensor( t, entry.distribution, rng );
+    t.qp = qpFor( t.weights );
+    corpus.push_back( t );
+  }
+  return corpus;
+}
+
+// ---------------------------------------------------------------------------
+// Medição
+
+struct BenchResult
+{
+  std::string stage;
+  int         dq_flag;
+  int         threads;
+  uint64_t    weights;
+  double      seconds;
+  double      speedup;     // Sobre uma thread; < 0 = não se aplica
+  uint64_t    bytes;       // Só encodeWeights
+};
+
+template <typename Fn>
+static double bestTime( Fn fn, int repeat )
+{
+  double best = 1e300;
+  for( int r = 0; r < repeat; r++ )
+  {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    fn();
+    best = std::min( best, std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count() );
+  }
+  return best;
+}
+
+static void record( std::vector<BenchResult>& results, const std::string& stage, int dq_flag, int threads, uint64_t weights, double seconds,
+                    double speedup = -1.0, uint64_t bytes = 0 )
+{
+  BenchResult r = { stage, dq_flag, threads, weights, seconds, speedup, bytes };
+  results.push_back( r );
+  printf( "%-22s dq=%d threads=%-3d %14.0f pesos/s\n", stage.c_str(), dq_flag, threads, seconds > 0.0 ? weights / seconds : 0.0 );
+}
+
+static std::vector<QuantBlock> parallelBlocks( std::vector<BenchTensor>& corpus, std::vector<std::vector<int32_t>>& qindex, uint8_t dq_flag )
+{
+  std::vector<QuantBlock> blocks( corpus.size() );
+  for( size_t i = 0; i < corpus.size(); i++ )
+  {
+    QuantBlock& block = blocks[i];
+    block.param_name  = corpus[i].name;
+    block.shape       = corpus[i].shape;
+    block.pWeights    = corpus[i].weights.data();
+    block.pQIndex     = qindex[i].data();
+    block.numWeights  = corpus[i].numWeights;
+    block.layerWidth  = corpus[i].layerWidth;
+    block.qStepSize   = qpToStepSize( kQpDensity, corpus[i].qp );
+    block.lambdaScale = kLambdaScale;
+    block.dq_flag     = dq_flag;
+    block.maxNumNoRem = kCabacUnaryLengthMinus1;
+    block.scan_order  = kScanOrder;
+    block.original_qp = corpus[i].qp;
+    block.qpDensity   = kQpDensity;
+  }
+  return blocks;
+}
+
+static void benchFlag( std::vector<BenchTensor>& corpus, uint8_t dq_flag, const std::vector<int>& threadCounts, int repeat, std::vector<BenchResult>& results )
+{
+  uint64_t total = 0;
+  for( const BenchTensor& t : corpus ) { total += t.numWeights; }
+  std::vector<std::vector<int32_t>> qindex( corpus.size() ), decoded( corpus.size() );
+  std::vector<std::vector<float32_t>> reconstructed( corpus.size() );
+  for( size_t i = 0; i < corpus.size(); i++ )
+  {
+    qindex[i].resize( corpus[i].numWeights );
+    decoded[i].resize( corpus[i].numWeights );
+    reconstructed[i].resize( corpus[i].numWeights );
+  }
+
+  record( results, "quantize", dq_flag, 1, total, bestTime( [&]() {
+    for( size_t i = 0; i < corpus.size(); i++ )
+    {
+      quantizeLayer( corpus[i].weights.data(), qindex[i].data(), corpus[i].numWeights, corpus[i].layerWidth, kQpDensity, corpus[i].qp, kLambdaScale,
+                     dq_flag, kCabacUnaryLengthMinus1, kScanOrder );
+    }
+  }, repeat ) );
+
+  std::vector<uint8_t> stream;
+  double seconds = bestTime( [&]() {
+    stream.clear();
+    CABACEncoder encoder;
+    encoder.startCabacEncoding( &stream );
+    encoder.initCtxMdls( kCabacUnaryLengthMinus1 + 1, kParamOptFlag );
+    for( size_t i = 0; i < corpus.size(); i++ )
+    {
+      encodeLayerLevels( encoder, qindex[i].data(), corpus[i].numWeights, corpus[i].layerWidth, dq_flag, kScanOrder );
+    }
+    encoder.terminateCabacEncoding();
+  }, repeat );
+  record( results, "encodeWeights", dq_flag, 1, total, seconds, -1.0, stream.size() );
+
+  record( results, "decodeWeights", dq_flag, 1, total, bestTime( [&]() {
+    CABACDecoder decoder;
+    decoder.startCabacDecoding( stream.data() );
+    decoder.initCtxMdls( kCabacUnaryLengthMinus1 + 1 );
+    for( size_t i = 0; i < corpus.size(); i++ )
+    {
+      decodeLayerLevels( decoder, decoded[i].data(), corpus[i].numWeights, corpus[i].layerWidth, dq_flag, kScanOrder );
+    }
+    decoder.terminateCabacDecoding();
+  }, repeat ) );
+  for( size_t i = 0; i < corpus.size(); i++ )
+  {
+    if( decoded[i] != qindex[i] )
+    {
+      throw std::runtime_error( "decode de " + corpus[i].name + " (dq_flag=" + std::to_string( (int) dq_flag ) + ") não reproduz os níveis codificados" );
+    }
+  }
+
+  // Escala de 1 a N threads: quantização paralela e deQuantize em faixas
+  std::vector<std::vector<int32_t>> parallelQIndex( corpus.size() );
+  for( size_t i = 0; i < corpus.size(); i++ ) { parallelQIndex[i].resize( corpus[i].numWeights ); }
+  std::vector<QuantBlock> blocks = parallelBlocks( corpus, parallelQIndex, dq_flag );
+  double base = 0.0;
+  for( int threads : threadCounts )
+  {
+    QuantEngineOptions options;
+    options.num_threads = threads;
+    options.verbose     = false;
+    QuantEngineResult result;
+    seconds = bestTime( [&]() { quantize_blocks_parallel( blocks, options, result ); }, repeat );
+    base    = base > 0.0 ? base : seconds;
+    record( results, "quantize_parallel", dq_flag, threads, total, seconds, base / seconds );
+  }
+
+  base = 0.0;
+  for( int threads : threadCounts )
+  {
+    seconds = bestTime( [&]() {
+      for( size_t i = 0; i < corpus.size(); i++ )
+      {
+        dequantizeLayer( reconstructed[i].data(), decoded[i].data(), corpus[i].numWeights, corpus[i].layerWidth, kQpDensity, corpus[i].qp, kScanOrder, threads );
+      }
+    }, repeat );
+    base = base > 0.0 ? base : seconds;
+    record( results, "deQuantize", dq_flag, threads, total, seconds, base / seconds );
+  }
+}
+
+// ---------------------------------------------------------------------------
+// Saída JSON (mesmo formato do benchmark_deepcabac.py antigo)
+
+static std::string platformName()
+{
+#ifndef _WIN32
+  struct utsname name;
+  if( uname( &name ) == 0 ) { return std::string( name.sysname ) + "-" + name.release + "-" + name.machine; }
+#endif
+  return "unknown";
+}
+
+static bool writeJson( const std::string& path, const BenchOptions& options, const std::vector<BenchTensor>& corpus, const std::vector<BenchResult>& results )
+{
+  FILE* f = fopen( path.c_str(), "w" );
+  if( !f ) { return false; }
+  fprintf( f, "{\n  \"machine\": {\"platform\": \"%s\", \"cpu_count\": %u},\n", platformName().c_str(), std::thread::hardware_concurrency() );
+  fprintf( f, "  \"config\": {\"scale\": %g, \"repeat\": %d, \"seed\": %u, \"qp_density\": %d, \"corpus\": [", options.scale, options.repeat, options.seed, kQpDensity );
+  for( size_t i = 0; i < corpus.size(); i++ )
+  {
+    fprintf( f, "%s\n    {\"name\": \"%s\", \"shape\": [", i ? "," : "", corpus[i].name.c_str() );
+    for( size_t d = 0; d < corpus[i].shape.size(); d++ ) { fprintf( f, "%s%lld", d ? ", " : "", (long long) corpus[i].shape[d] ); }
+    fprintf( f, "], \"qp\": %d}", corpus[i].qp );
+  }
+  fprintf( f, "]},\n  \"results\": [" );
+  for( size_t i = 0; i < results.size(); i++ )
+  {
+    const BenchResult& r = results[i];
+    fprintf( f, "%s\n    {\"stage\": \"%s\", \"dq_flag\": %d, \"threads\": %d, \"weights\": %llu, \"seconds\": %.9g, \"weights_per_s\": %.9g",
+             i ? "," : "", r.stage.c_str(), r.dq_flag, r.threads, (unsigned long long) r.weights, r.seconds, r.seconds > 0.0 ? r.weights / r.seconds : 0.0 );
+    if( r.speedup >= 0.0 ) { fprintf( f, ", \"speedup\": %.6g", r.speedup ); }
+    if( r.bytes > 0 )      { fprintf( f, ", \"bytes\": %llu, \"bits_per_weight\": %.6g", (unsigned long long) r.bytes, 8.0 * r.bytes / r.weights ); }
+    fprintf( f, "}" );
+  }
+  fprintf( f, "\n  ]\n}\n" );
+  return fclose( f ) == 0;
+}
+
+// ---------------------------------------------------------------------------
+
+static void usage()
+{
+  std::cerr << "Uso:\n"
+               "  deepcabac_bench [--scale X] [--repeat N] [--max-threads N] [--seed N] [--json saida.json]\n";
+}
+
+int main( int argc, char** argv )
+{
+  BenchOptions options;
+  for( int i = 1; i < argc; i++ )
+  {
+    std::string key = argv[i];
+    if( i + 1 >= argc ) { usage(); return 1; }
+    const char* value = argv[++i];
+    if( key == "--scale" )              { options.scale = atof( value ); }
+    else if( key == "--repeat" )        { options.repeat = std::max( 1, atoi( value ) ); }
+    else if( key == "--max-threads" )   { options.maxThreads = std::max( 1, atoi( value ) ); }
+    else if( key == "--seed" )          { options.seed = (uint32_t) strtoul( value, nullptr, 10 ); }
+    else if( key == "--json" )          { options.jsonPath = value; }
+    else { std::cerr << "Opção desconhecida: " << key << "\n"; usage(); return 1; }
+  }
+
+  try
+  {
+    std::vector<BenchTensor> corpus = makeCorpus( options.scale, options.seed );
+    uint64_t total = 0;
+    for( const BenchTensor& t : corpus ) { total += t.numWeights; }
+    printf( "Corpus: %zu tensores, %llu pesos\n", corpus.size(), (unsigned long long) total );
+
+    // 1, 2, 4, ... abaixo de --max-threads, e o próprio --max-threads
+    std::vector<int> threadCounts( 1, 1 );
+    for( int threads = 2; threads < options.maxThreads; threads *= 2 ) { threadCounts.push_back( threads ); }
+    if( options.maxThreads > 1 ) { threadCounts.push_back( options.maxThreads ); }
+
+    std::vector<BenchResult> results;
+    for( uint8_t dq_flag = 0; dq_flag <= 1; dq_flag++ )   // URQ, TCQ
+    {
+      benchFlag( corpus, dq_flag, threadCounts, options.repeat, results );
+    }
+
+    if( !options.jsonPath.empty() )
+    {
+      if( !writeJson( options.jsonPath, options, corpus, results ) )
+      {
+        throw std::runtime_error( "não foi possível gravar '" + options.jsonPath + "'" );
+      }
+      printf( "Resultados gravados em '%s'\n", options.jsonPath.c_str() );
+    }
+  }
+  catch( const std::exception& e )
+  {
+    std::cerr << "Erro: " << e.what() << "\n";
+    return 1;
+  }
+  return 0;
+}
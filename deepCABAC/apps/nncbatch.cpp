@@ -0,0 +1,529 @@
+// nncbatch: compressão em lote de diretórios de tensores (.npy / .safetensors)
+// direto sobre a biblioteca deepcabac_core, sem Python.
+//
+//   nncbatch compress   <dir_entrada> <saida.nncb> [opções]
+//   nncbatch decompress <entrada.nncb> <dir_saida> [--threads N] [--batch-weights N]
+//   nncbatch list       <entrada.nncb>
+//
+// Os arquivos são mapeados em memória; tensores F32/F16/BF16 são quantizados com
+// quantize_blocks_parallel e codificados em paralelo (um stream CABAC por tensor),
+// os demais tipos vão para o contêiner como estão. O trabalho é feito em lotes de
+// até --batch-weights pesos para limitar a memória dos níveis int32; --max-memory-mb
+// limita também os temporários da quantização em andamento. Tensores idênticos num
+// mesmo lote (ex.: embeddings amarrados) são quantizados e codificados uma vez só e o
+// índice do contêiner aponta o duplicado para o stream do original (--dedup 0 desliga).
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <Lib/CommonLib/TypeDef.h>
+#include <Lib/EncLib/CABACEncoder.h>
+#include <Lib/DecLib/CABACDecoder.h>
+
+#include "QuantEngine.h"
+#include "LayerCoder.h"
+#include "LayerSegments.h"
+#include "ParallelFor.h"
+#include "TensorIO.h"
+#include "TensorContainer.h"
+
+struct BatchOptions
+{
+  int32_t   qp;
+  int32_t   qpDensity;
+  uint8_t   dq_flag;
+  float32_t lambdaScale;
+  int32_t   scan_order;
+  uint32_t  maxNumNoRem;     // cabac_unary_length_minus1
+  int       num_threads;
+  uint64_t  batchWeights;
+  uint64_t  maxMemoryBytes;  // Orçamento da memória de trabalho do quantize (0 = sem limite)
+  bool      dedup;           // Duplicados do lote viram referência ao stream do original
+
+  BatchOptions() : qp( -38 ), qpDensity( 2 ), dq_flag( 1 ), lambdaScale( 0.0f ), scan_order( 0 ), maxNumNoRem( 10 ), num_threads( 0 ), batchWeights( 1ull << 28 ), maxMemoryBytes( 0 ),
+                   dedup( true ) {}
+};
+
+// ---------------------------------------------------------------------------
+// Medição por etapa
+
+class StageStats
+{
+public:
+  struct Stage
+  {
+    double   seconds;
+    uint64_t weights;
+    uint64_t bytes;
+  };
+
+  void add( const std::string& name, double seconds, uint64_t weights, uint64_t bytes )
+  {
+    if( m_Stages.find( name ) == m_Stages.end() ) { m_Order.push_back( name ); Stage s = { 0.0, 0, 0 }; m_Stages[name] = s; }
+    Stage& s = m_Stages[name];
+    s.seconds += seconds;
+    s.weights += weights;
+    s.bytes   += bytes;
+  }
+
+  void print() const
+  {
+    printf( "%-12s %10s %14s %12s\n", "etapa", "s", "Mpesos/s", "MB/s" );
+    for( size_t i = 0; i < m_Order.size(); i++ )
+    {
+      const Stage& s = m_Stages.find( m_Order[i] )->second;
+      double secs = s.seconds > 0.0 ? s.seconds : 1e-9;
+      printf( "%-12s %10.3f %14.1f %12.1f\n", m_Order[i].c_str(), s.seconds, s.weights / secs / 1e6, s.bytes / secs / 1e6 );
+    }
+  }
+
+private:
+  std::vector<std::string>      m_Order;
+  std::map<std::string, Stage>  m_Stages;
+};
+
+class StageClock
+{
+public:
+  StageClock() : m_Start( std::chrono::steady_clock::now() ) {}
+  double lap()
+  {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>( now - m_Start ).count();
+    m_Start = now;
+    return seconds;
+  }
+private:
+  std::chrono::steady_clock::time_point m_Start;
+};
+
+static uint64_t effectiveLayerWidth( const std::vector<int64_t>& shape, bool fortranOrder )
+{
+  uint64_t numWeights, layerWidth;
+  getLayerDims( shape, numWeights, layerWidth );
+  return fortranOrder ? 1 : layerWidth; // Em ordem Fortran as linhas não são contíguas: codifica como vetor
+}
+
+// ---------------------------------------------------------------------------
+// compress
+
+struct CompressJob
+{
+  uint32_t                      fileIndex;
+  const TensorView*             view;
+  uint64_t                      numWeights;
+  bool                          coded;
+  float32_t*                    pWeights;      // F32 no mapeamento ou convertido em 'converted'
+  std::unique_ptr<float32_t[]>  converted;
+  std::unique_ptr<int32_t[]>    levels;
+  std::vector<uint8_t>          stream;
+  int32_t                       finalQp;
+  int32_t                       scanOrder;
+  int                           duplicateOf;   // Job do lote com o mesmo conteúdo, ou -1
+  size_t                        entry;         // Posição do tensor no índice do contêiner
+};
+
+static void compressBatch( std::vector<CompressJob>& jobs, const BatchOptions& options, ContainerWriter& writer, StageStats& stats )
+{
+  std::vector<int> coded;
+  uint64_t codedWeights = 0, codedBytes = 0;
+  for( size_t i = 0; i < jobs.size(); i++ )
+  {
+    if( jobs[i].coded ) { coded.push_back( (int) i ); codedWeights += jobs[i].numWeights; codedBytes += jobs[i].view->bytes; }
+  }
+  StageClock clock;
+
+  // Conversão para float32 (F16/BF16, ou F32 desalinhado no arquivo)
+  parallel_for_pthreads( (int) coded.size(), options.num_threads, [&]( int k, int )
+  {
+    CompressJob& job = jobs[coded[k]];
+    const TensorView& view = *job.view;
+    if( view.elementType == TENSOR_F32 && ( (uintptr_t) view.data % sizeof( float32_t ) ) == 0 )
+    {
+      job.pWeights = (float32_t*) view.data;
+      return;
+    }
+    job.converted.reset( new float32_t[job.numWeights] );
+    job.pWeights = job.converted.get();
+    if( view.elementType == TENSOR_F32 )       { memcpy( job.pWeights, view.data, view.bytes ); }
+    else
+    {
+      std::vector<uint16_t> halves( job.numWeights );
+      memcpy( halves.data(), view.data, view.bytes );
+      if( view.elementType == TENSOR_F16 ) { halfToFloat( halves.data(), job.pWeights, job.numWeights ); }
+      else                                 { bf16ToFloat( halves.data(), job.pWeights, job.numWeights ); }
+    }
+  } );
+  stats.add( "convert", clock.lap(), codedWeights, codedBytes );
+
+  // Quantização paralela
+  std::vector<QuantBlock> blocks( coded.size() );
+  for( size_t k = 0; k < coded.size(); k++ )
+  {
+    CompressJob& job = jobs[coded[k]];
+    job.levels.reset( new int32_t[job.numWeights] );
+    QuantBlock& block = blocks[k];
+    block.param_name  = job.view->name;
+    block.shape       = job.view->shape;
+    block.pWeights    = job.pWeights;
+    block.pQIndex     = job.levels.get();
+    block.numWeights  = job.numWeights;
+    block.layerWidth  = effectiveLayerWidth( job.view->shape, job.view->fortranOrder );
+    block.qStepSize   = qpToStepSize( options.qpDensity, options.qp );
+    block.lambdaScale = options.lambdaScale;
+    block.dq_flag     = options.dq_flag;
+    block.maxNumNoRem = options.maxNumNoRem;
+    block.scan_order  = ( block.layerWidth == 1 || block.numWeights == block.layerWidth ) ? 0 : options.scan_order;
+    block.original_qp = options.qp;
+    block.qpDensity   = options.qpDensity;
+  }
+  QuantEngineOptions engineOptions;
+  engineOptions.num_threads = options.num_threads;
+  engineOptions.max_memory_bytes = options.maxMemoryBytes;
+  engineOptions.dedup = options.dedup;
+  QuantEngineResult result;
+  quantize_blocks_parallel( blocks, engineOptions, result );
+  for( size_t k = 0; k < coded.size(); k++ )
+  {
+    CompressJob& job = jobs[coded[k]];
+    job.finalQp     = result.final_qps[k];
+    job.scanOrder   = blocks[k].scan_order;
+    job.duplicateOf = result.duplicate_of[k] >= 0 ? coded[result.duplicate_of[k]] : -1;
+    job.converted.reset();
+    if( job.duplicateOf >= 0 ) { job.levels.reset(); } // O motor não escreve os níveis de duplicados
+  }
+  stats.add( "quantize", clock.lap(), codedWeights, codedBytes );
+
+  // Codificação: um stream CABAC independente por tensor (duplicados usam o do original)
+  parallel_for_pthreads( (int) coded.size(), options.num_threads, [&]( int k, int )
+  {
+    CompressJob& job = jobs[coded[k]];
+    if( job.duplicateOf >= 0 ) { return; }
+    const QuantBlock& block = blocks[k];
+    CABACEncoder encoder;
+    encoder.startCabacEncoding( &job.stream );
+    encoder.initCtxMdls( options.maxNumNoRem + 1, 0 );
+    encodeLayerLevels( encoder, job.levels.get(), block.numWeights, block.layerWidth, block.dq_flag, block.scan_order );
+    encoder.terminateCabacEncoding();
+    job.levels.reset();
+  } );
+  stats.add( "encode", clock.lap(), codedWeights, codedBytes );
+
+  // Gravação na ordem original (a ordem dos tensores de cada arquivo é preservada)
+  uint64_t written = 0;
+  for( size_t i = 0; i < jobs.size(); i++ )
+  {
+    CompressJob& job = jobs[i];
+    ContainerTensor tensor;
+    tensor.fileIndex    = job.fileIndex;
+    tensor.name         = job.view->name;
+    tensor.dtype        = job.view->dtype;
+    tensor.shape        = job.view->shape;
+    tensor.fortranOrder = job.view->fortranOrder ? 1 : 0;
+    if( job.coded )
+    {
+      tensor.coding      = CODING_CABAC;
+      tensor.dq_flag     = options.dq_flag;
+      tensor.qp          = job.finalQp;
+      tensor.qpDensity   = options.qpDensity;
+      tensor.scan_order  = job.scanOrder;
+      tensor.maxNumNoRem = options.maxNumNoRem;
+      job.entry = writer.tensorCount();
+      if( job.duplicateOf >= 0 )
+      {
+        writer.appendReference( tensor, jobs[job.duplicateOf].entry );
+        continue;
+      }
+      writer.append( tensor, job.stream.data(), job.stream.size() );
+      written += job.stream.size();
+      std::vector<uint8_t>().swap( job.stream );
+    }
+    else
+    {
+      tensor.coding = CODING_RAW;
+      writer.append( tensor, job.view->data, job.view->bytes );
+      written += job.view->bytes;
+    }
+  }
+  stats.add( "write", clock.lap(), codedWeights, written );
+}
+
+static int compressDirectory( const std::string& inputDir, const std::string& outputPath, const BatchOptions& options )
+{
+  StageStats stats;
+  StageClock clock;
+
+  std::vector<std::string> paths = listTensorFiles( inputDir );
+  if( paths.empty() ) { throw std::runtime_error( "Nenhum .npy ou .safetensors em " + inputDir ); }
+  std::vector<TensorFile> files;
+  uint64_t inputBytes = 0, totalWeights = 0;
+  for( size_t i = 0; i < paths.size(); i++ )
+  {
+    files.push_back( openTensorFile( inputDir, paths[i] ) );
+    inputBytes += files.back().mapping->size();
+  }
+  stats.add( "load", clock.lap(), 0, inputBytes );
+
+  ContainerWriter writer( outputPath );
+  std::vector<CompressJob> batch;
+  uint64_t batchWeights = 0;
+  for( size_t f = 0; f < files.size(); f++ )
+  {
+    ContainerFile entry;
+    entry.path     = files[f].path;
+    entry.format   = files[f].format;
+    entry.metadata = files[f].metadata;
+    writer.addFile( entry );
+
+    for( size_t t = 0; t < files[f].tensors.size(); t++ )
+    {
+      const TensorView& view = files[f].tensors[t];
+      batch.push_back( CompressJob() );
+      CompressJob& job = batch.back();
+      job.fileIndex   = (uint32_t) f;
+      job.view        = &view;
+      job.numWeights  = tensorElementCount( view.shape );
+      job.coded       = view.elementType != TENSOR_RAW && job.numWeights > 0;
+      job.pWeights    = nullptr;
+      job.finalQp     = options.qp;
+      job.scanOrder   = 0;
+      job.duplicateOf = -1;
+      job.entry       = 0;
+      if( job.coded ) { batchWeights += job.numWeights; totalWeights += job.numWeights; }
+      if( batchWeights >= options.batchWeights )
+      {
+        compressBatch( batch, options, writer, stats );
+        batch.clear();
+        batchWeights = 0;
+      }
+    }
+  }
+  if( !batch.empty() ) { compressBatch( batch, options, writer, stats ); }
+  clock.lap();
+  writer.finish();
+  uint64_t outputBytes = writer.bytesWritten();
+  stats.add( "write", clock.lap(), 0, 0 );
+
+  stats.print();
+  printf( "%zu arquivos, %llu pesos quantizados: %llu -> %llu bytes (%.2fx, %.3f bits/peso)\n", files.size(), (unsigned long long) totalWeights,
+          (unsigned long long) inputBytes, (unsigned long long) outputBytes, outputBytes ? (double) inputBytes / outputBytes : 0.0,
+          totalWeights ? 8.0 * outputBytes / totalWeights : 0.0 );
+  return 0;
+}
+
+// ---------------------------------------------------------------------------
+// decompress
+
+struct DecompressJob
+{
+  const ContainerTensor*          tensor;
+  uint64_t                        numWeights;
+  std::unique_ptr<int32_t[]>      levels;
+  std::unique_ptr<float32_t[]>    weights;
+  std::vector<uint16_t>           output;      // F16/BF16 reconvertidos
+  const uint8_t*                  data;        // Bytes finais do tensor
+  uint64_t                        bytes;
+};
+
+static void writeFile( const ContainerFile& file, const std::vector<DecompressJob*>& jobs, const std::string& outputDir )
+{
+  std::string path = outputDir + "/" + file.path;
+  size_t slash = path.find_last_of( '/' );
+  makeDirs( path.substr( 0, slash ) );
+  if( file.format == "npy" )
+  {
+    if( jobs.size() != 1 ) { throw std::runtime_error( file.path + ": arquivo npy com número de tensores inválido no contêiner" ); }
+    const ContainerTensor& t = *jobs[0]->tensor;
+    writeNpy( path, t.dtype, t.fortranOrder != 0, t.shape, jobs[0]->data, jobs[0]->bytes );
+    return;
+  }
+  std::vector<SafetensorsEntry> entries( jobs.size() );
+  for( size_t i = 0; i < jobs.size(); i++ )
+  {
+    entries[i].name  = jobs[i]->tensor->name;
+    entries[i].dtype = jobs[i]->tensor->dtype;
+    entries[i].shape = jobs[i]->tensor->shape;
+    entries[i].data  = jobs[i]->data;
+    entries[i].bytes = jobs[i]->bytes;
+  }
+  writeSafetensors( path, file.metadata, entries );
+}
+
+static void decompressBatch( const ContainerReader& reader, const std::vector<uint32_t>& fileIndices, const std::vector<std::vector<size_t>>& byFile,
+                             const std::string& outputDir, const BatchOptions& options, StageStats& stats )
+{
+  std::vector<DecompressJob> jobs;
+  for( size_t f = 0; f < fileIndices.size(); f++ ) { jobs.resize( jobs.size() + byFile[fileIndices[f]].size() ); }
+  std::vector<int> coded;
+  uint64_t codedWeights = 0, codedBytes = 0;
+  size_t j = 0;
+  for( size_t f = 0; f < fileIndices.size(); f++ )
+  {
+    for( size_t k = 0; k < byFile[fileIndices[f]].size(); k++, j++ )
+    {
+      DecompressJob& job = jobs[j];
+      job.tensor     = &reader.tensors()[byFile[fileIndices[f]][k]];
+      job.numWeights = tensorElementCount( job.tensor->shape );
+      job.data       = reader.stream( *job.tensor );
+      job.bytes      = job.tensor->bytes;
+      if( job.tensor->coding == CODING_CABAC ) { coded.push_back( (int) j ); codedWeights += job.numWeights; codedBytes += job.tensor->bytes; }
+    }
+  }
+  StageClock clock;
+
+  parallel_for_pthreads( (int) coded.size(), options.num_threads, [&]( int k, int )
+  {
+    DecompressJob& job = jobs[coded[k]];
+    const ContainerTensor& t = *job.tensor;
+    job.levels.reset( new int32_t[job.numWeights] );
+    CABACDecoder decoder;
+    decoder.startCabacDecoding( reader.stream( t ) );
+    decoder.initCtxMdls( t.maxNumNoRem + 1 );
+    decodeLayerLevels( decoder, job.levels.get(), job.numWeights, effectiveLayerWidth( t.shape, t.fortranOrder != 0 ), t.dq_flag, t.scan_order );
+    decoder.terminateCabacDecoding();
+  } );
+  stats.add( "decode", clock.lap(), codedWeights, codedBytes );
+
+  parallel_for_pthreads( (int) coded.size(), options.num_threads, [&]( int k, int )
+  {
+    DecompressJob& job = jobs[coded[k]];
+    const ContainerTensor& t = *job.tensor;
+    job.weights.reset( new float32_t[job.numWeights] );
+    dequantizeLayer( job.weights.get(), job.levels.get(), job.numWeights, effectiveLayerWidth( t.shape, t.fortranOrder != 0 ), t.qpDensity, t.qp, t.scan_order );
+    job.levels.reset();
+  } );
+  stats.add( "dequantize", clock.lap(), codedWeights, codedWeights * sizeof( float32_t ) );
+
+  parallel_for_pthreads( (int) coded.size(), options.num_threads, [&]( int k, int )
+  {
+    DecompressJob& job = jobs[coded[k]];
+    TensorElementType type = tensorElementType( reader.files()[job.tensor->fileIndex].format, job.tensor->dtype );
+    if( type == TENSOR_F32 )
+    {
+      job.data  = (const uint8_t*) job.weights.get();
+      job.bytes = job.numWeights * sizeof( float32_t );
+      return;
+    }
+    job.output.resize( job.numWeights );
+    if( type == TENSOR_F16 ) { floatToHalf( job.weights.get(), job.output.data(), job.numWeights ); }
+    else                     { floatToBf16( job.weights.get(), job.output.data(), job.numWeights ); }
+    job.weights.reset();
+    job.data  = (const uint8_t*) job.output.data();
+    job.bytes = job.output.size() * sizeof( uint16_t );
+  } );
+  stats.add( "convert", clock.lap(), codedWeights, codedWeights * sizeof( float32_t ) );
+
+  uint64_t written = 0;
+  j = 0;
+  for( size_t f = 0; f < fileIndices.size(); f++ )
+  {
+    std::vector<DecompressJob*> fileJobs;
+    for( size_t k = 0; k < byFile[fileIndices[f]].size(); k++, j++ ) { fileJobs.push_back( &jobs[j] ); written += jobs[j].bytes; }
+    writeFile( reader.files()[fileIndices[f]], fileJobs, outputDir );
+  }
+  stats.add( "write", clock.lap(), codedWeights, written );
+}
+
+static int decompressContainer( const std::string& inputPath, const std::string& outputDir, const BatchOptions& options )
+{
+  StageStats stats;
+  StageClock clock;
+  ContainerReader reader( inputPath );
+  std::vector<std::vector<size_t>> byFile( reader.files().size() );
+  for( size_t i = 0; i < reader.tensors().size(); i++ ) { byFile[reader.tensors()[i].fileIndex].push_back( i ); }
+  stats.add( "load", clock.lap(), 0, reader.size() );
+
+  makeDirs( outputDir );
+  std::vector<uint32_t> batch;
+  uint64_t batchWeights = 0;
+  for( uint32_t f = 0; f < byFile.size(); f++ )
+  {
+    batch.push_back( f );
+    for( size_t k = 0; k < byFile[f].size(); k++ ) { batchWeights += tensorElementCount( reader.tensors()[byFile[f][k]].shape ); }
+    if( batchWeights >= options.batchWeights )
+    {
+      decompressBatch( reader, batch, byFile, outputDir, options, stats );
+      batch.clear();
+      batchWeights = 0;
+    }
+  }
+  if( !batch.empty() ) { decompressBatch( reader, batch, byFile, outputDir, options, stats ); }
+
+  stats.print();
+  printf( "%zu arquivos, %zu tensores restaurados em %s\n", reader.files().size(), reader.tensors().size(), outputDir.c_str() );
+  return 0;
+}
+
+static int listContainer( const std::string& inputPath )
+{
+  ContainerReader reader( inputPath );
+  for( size_t i = 0; i < reader.tensors().size(); i++ )
+  {
+    const ContainerTensor& t = reader.tensors()[i];
+    std::string shape;
+    for( size_t d = 0; d < t.shape.size(); d++ ) { shape += ( d ? "x" : "" ) + std::to_string( (long long) t.shape[d] ); }
+    printf( "%-40s %-24s %-6s %-14s %-5s qp=%-4d %12llu bytes\n", reader.files()[t.fileIndex].path.c_str(), t.name.c_str(), t.dtype.c_str(),
+            shape.c_str(), t.coding == CODING_CABAC ? ( t.dq_flag ? "TCQ" : "URQ" ) : "raw", t.qp, (unsigned long long) t.bytes );
+  }
+  return 0;
+}
+
+// ---------------------------------------------------------------------------
+
+static void usage()
+{
+  std::cerr << "Uso:\n"
+               "  nncbatch compress   <dir_entrada> <saida.nncb> [--qp N] [--qp-density N] [--dq 0|1] [--lambda X]\n"
+               "                      [--scan-order N] [--max-num-no-rem N] [--threads N] [--batch-weights N]\n"
+               "                      [--max-memory-mb N] [--dedup 0|1]\n"
+               "  nncbatch decompress <entrada.nncb> <dir_saida> [--threads N] [--batch-weights N]\n"
+               "  nncbatch list       <entrada.nncb>\n";
+}
+
+int main( int argc, char** argv )
+{
+  if( argc < 3 ) { usage(); return 1; }
+  std::string command = argv[1];
+  BatchOptions options;
+  int positional = command == "list" ? 1 : 2;
+  if( argc < 2 + positional ) { usage(); return 1; }
+
+  for( int i = 2 + positional; i < argc; i++ )
+  {
+    std::string key = argv[i];
+    if( i + 1 >= argc ) { usage(); return 1; }
+    const char* value = argv[++i];
+    if( key == "--qp" )                   { options.qp = atoi( value ); }
+    else if( key == "--qp-density" )      { options.qpDensity = atoi( value ); }
+    else if( key == "--dq" )              { options.dq_flag = (uint8_t) atoi( value ); }
+    else if( key == "--lambda" )          { options.lambdaScale = (float32_t) atof( value ); }
+    else if( key == "--scan-order" )      { options.scan_order = atoi( value ); }
+    else if( key == "--max-num-no-rem" )  { options.maxNumNoRem = (uint32_t) atoi( value ); }
+    else if( key == "--threads" )         { options.num_threads = atoi( value ); }
+    else if( key == "--batch-weights" )   { options.batchWeights = strtoull( value, nullptr, 10 ); }
+    else if( key == "--max-memory-mb" )   { options.maxMemoryBytes = strtoull( value, nullptr, 10 ) << 20; }
+    else if( key == "--dedup" )           { options.dedup = atoi( value ) != 0; }
+    else { std::cerr << "Opção desconhecida: " << key << "\n"; usage(); return 1; }
+  }
+
+  try
+  {
+    if( command == "compress" )   { return compressDirectory( argv[2], argv[3], options ); }
+    if( command == "decompress" ) { return decompressContainer( argv[2], argv[3], options ); }
+    if( command == "list" )       { return listContainer( argv[2] ); }
+  }
+  catch( const std::exception& e )
+  {
+    std::cerr << "Erro: " << e.what() << "\n";
+    return 1;
+  }
+  usage();
+  return 1;
+}
@@ -0,0 +1,244 @@
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <numeric>
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+#include <thread>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "AutoTune.h"
+#include "ParallelFor.h"
+
+static const char* kProfileHeader = "# Perfil de ajuste de quantize_blocks_parallel (nncodec). Gerado pela calibração; pode ser apagado.";
+
+const QuantTuningEntry* QuantTuningProfile::find(int dq_flag) const {
+    for (const QuantTuningEntry& entry : entries) {
+        if (entry.dq_flag == dq_flag) return &entry;
+    }
+    return nullptr;
+}
+
+bool QuantTuningProfile::load(const std::string& path) {
+    std::ifstream in(path.c_str());
+    if (!in) return false;
+    host.clear();
+    entries.clear();
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        std::istringstream fields(line);
+        std::string key;
+        fields >> key;
+        if (key == "host") {
+            std::getline(fields >> std::ws, host);
+        } else if (key == "entry") {
+            QuantTuningEntry entry;
+            if (fields >> entry.dq_flag >> entry.num_threads >> entry.coalesce_target_weights >> entry.weights_per_s) {
+                entries.push_back(entry);
+            }
+        }
+    }
+    if (host != current_tuning_host()) {
+        std::cout << "[Pthreads Tune] Perfil '" << path << "' é de outra máquina (" << host << "), ignorado." << std::endl;
+        entries.clear();
+        return false;
+    }
+    return !entries.empty();
+}
+
+// Cria os diretórios pais de path que faltarem
+static void make_parent_dirs(const std::string& path) {
+    for (size_t pos = path.find_first_of("/\\", 1); pos != std::string::npos; pos = path.find_first_of("/\\", pos + 1)) {
+        std::string dir = path.substr(0, pos);
+#ifdef _WIN32
+        _mkdir(dir.c_str());
+#else
+        mkdir(dir.c_str(), 0755);
+#endif
+    }
+}
+
+void QuantTuningProfile::save(const std::string& path) const {
+    make_parent_dirs(path);
+    std::string tmp_path = path + ".tmp";
+    {
+        std::ofstream out(tmp_path.c_str());
+        out << kProfileHeader << "\n";
+        out << "host " << host << "\n";
+        out << "# entry <dq_flag> <num_threads> <coalesce_target_weights> <pesos/s>\n";
+        for (const QuantTuningEntry& entry : entries) {
+            out << "entry " << entry.dq_flag << " " << entry.num_threads << " " << entry.coalesce_target_weights << " " << entry.weights_per_s << "\n";
+        }
+        if (!out) throw std::runtime_error("Não foi possível gravar o perfil de ajuste em " + path);
+    }
+#ifdef _WIN32
+    std::remove(path.c_str()); // rename() do Windows não substitui um arquivo existente
+#endif
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        std::remove(tmp_path.c_str());
+        throw std::runtime_error("Não foi possível gravar o perfil de ajuste em " + path);
+    }
+}
+
+std::string current_tuning_host() {
+    char name[256] = {0};
+#ifdef _WIN32
+    DWORD size = sizeof(name);
+    if (!GetComputerNameA(name, &size)) name[0] = '\0';
+#else
+    if (gethostname(name, sizeof(name) - 1) != 0) name[0] = '\0';
+#endif
+    std::ostringstream host;
+    host << (name[0] ? name : "desconhecido") << ":" << std::thread::hardware_concurrency();
+    return host.str();
+}
+
+std::string default_tuning_profile_path() {
+    const char* explicit_path = std::getenv("NNCODEC_TUNING_PROFILE");
+    if (explicit_path != nullptr && explicit_path[0] != '\0') return explicit_path;
+#ifdef _WIN32
+    const char* cache = std::getenv("LOCALAPPDATA");
+    if (cache == nullptr) return std::string();
+    return std::string(cache) + "\\nncodec\\quant_tuning.profile";
+#else
+    const char* cache = std::getenv("XDG_CACHE_HOME");
+    if (cache != nullptr && cache[0] != '\0') return std::string(cache) + "/nncodec/quant_tuning.profile";
+    const char* home = std::getenv("HOME");
+    if (home == nullptr) return std::string();
+    return std::string(home) + "/.cache/nncodec/quant_tuning.profile";
+#endif
+}
+
+// Amostra dos blocos de um dq_flag: blocos espalhados por toda a distribuição de
+// tamanhos (ordenada), cada um limitado a sample_weights/4 em linhas inteiras
+static std::vector<QuantBlock> sample_blocks(const std::vector<QuantBlock>& blocks, int dq_flag, uint64_t sample_weights) {
+    uint64_t block_cap = std::max<uint64_t>(sample_weights / 4, 1);
+    std::vector<QuantBlock> candidates;
+    uint64_t total = 0;
+    for (const QuantBlock& block : blocks) {
+        if (block.dq_flag != dq_flag || block.numWeights == 0) continue;
+        QuantBlock sample = block;
+        if (sample.numWeights > block_cap) {
+            uint64_t width = std::max<uint64_t>(sample.layerWidth, 1);
+            sample.numWeights = std::max<uint64_t>(block_cap / width, 1) * width;
+            sample.numWeights = std::min(sample.numWeights, block.numWeights);
+            if (sample.numWeights == sample.layerWidth) sample.scan_order = 0;
+        }
+        candidates.push_back(sample);
+        total += sample.numWeights;
+    }
+    std::stable_sort(candidates.begin(), candidates.end(), [](const QuantBlock& a, const QuantBlock& b) {
+        return a.numWeights < b.numWeights;
+    });
+
+    uint64_t stride = total > sample_weights ? (total + sample_weights - 1) / sample_weights : 1;
+    std::vector<QuantBlock> sample;
+    for (size_t i = 0; i < candidates.size(); i += stride) {
+        sample.push_back(candidates[i]);
+    }
+    return sample;
+}
+
+QuantTuningProfile calibrate_quantizer(const std::vector<QuantBlock>& blocks, const QuantTuningOptions& tuning) {
+    QuantTuningProfile profile;
+    profile.host = current_tuning_host();
+    int max_threads = resolve_num_threads(tuning.max_threads);
+
+    std::vector<int> thread_counts;
+    for (int t = 1; t < max_threads; t *= 2) thread_counts.push_back(t);
+    thread_counts.push_back(max_threads);
+    const uint64_t tile_sizes[] = {0, 1ull << 12, 1ull << 14, 1ull << 16, 1ull << 18, 1ull << 20};
+
+    for (int dq_flag = 0; dq_flag <= 1; ++dq_flag) {
+        std::vector<QuantBlock> sample = sample_blocks(blocks, dq_flag, tuning.sample_weights);
+        if (sample.empty()) continue;
+
+        // Saídas próprias: a calibração nunca escreve nos qindex de quem chamou
+        std::vector<std::vector<int32_t>> scratch(sample.size());
+        uint64_t sample_total = 0;
+        for (size_t i = 0; i < sample.size(); ++i) {
+            scratch[i].resize(sample[i].numWeights);
+            sample[i].pQIndex = scratch[i].data();
+            sample_total += sample[i].numWeights;
+        }
+
+        auto measure = [&](int num_threads, uint64_t tile) {
+            QuantEngineOptions run;
+            run.num_threads = num_threads;
+            run.coalesce_target_weights = tile;
+            run.verbose = false;
+            double best = 0.0;
+            for (int r = 0; r < std::max(tuning.repeat, 1); ++r) {
+                QuantEngineResult ignored;
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                quantize_blocks_parallel(sample, run, ignored);
+                double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                best = std::max(best, sample_total / std::max(seconds, 1e-9));
+            }
+            return best;
+        };
+
+        // Primeiro o número de threads com o tile padrão, depois o tile com essas threads
+        QuantTuningEntry entry;
+        entry.dq_flag = dq_flag;
+        entry.coalesce_target_weights = kDefaultCoalesceTargetWeights;
+        entry.num_threads = 1;
+        entry.weights_per_s = 0.0;
+        for (int num_threads : thread_counts) {
+            double rate = measure(num_threads, entry.coalesce_target_weights);
+            if (rate > entry.weights_per_s) { entry.weights_per_s = rate; entry.num_threads = num_threads; }
+        }
+        for (uint64_t tile : tile_sizes) {
+            if (tile == entry.coalesce_target_weights) continue;
+            double rate = measure(entry.num_threads, tile);
+            if (rate > entry.weights_per_s) { entry.weights_per_s = rate; entry.coalesce_target_weights = tile; }
+        }
+        profile.entries.push_back(entry);
+        std::cout << "[Pthreads Tune] dq_flag=" << dq_flag << ": " << sample.size() << " blocos de amostra (" << sample_total << " pesos), melhor com "
+                  << entry.num_threads << " threads e coalesce_target_weights=" << entry.coalesce_target_weights
+                  << " (" << static_cast<uint64_t>(entry.weights_per_s) << " pesos/s)." << std::endl;
+    }
+    return profile;
+}
+
+void apply_quant_tuning(const std::vector<QuantBlock>& blocks, QuantEngineOptions& options) {
+    std::string path = options.tuning_profile.empty() ? default_tuning_profile_path() : options.tuning_profile;
+    QuantTuningProfile profile;
+    if (options.calibrate) {
+        options.calibrate = false;
+        profile = calibrate_quantizer(blocks, QuantTuningOptions());
+        if (!path.empty()) {
+            profile.save(path);
+            std::cout << "[Pthreads Tune] Perfil gravado em '" << path << "'." << std::endl;
+        }
+    } else if (options.num_threads > 0 || path.empty() || !profile.load(path)) {
+        return;
+    }
+
+    // dq_flag predominante (em pesos) decide qual entrada usar
+    uint64_t weights_per_flag[2] = {0, 0};
+    for (const QuantBlock& block : blocks) weights_per_flag[block.dq_flag ? 1 : 0] += block.numWeights;
+    const QuantTuningEntry* entry = profile.find(weights_per_flag[1] > weights_per_flag[0] ? 1 : 0);
+    if (entry == nullptr) return;
+    if (options.num_threads <= 0) options.num_threads = entry->num_threads;
+    if (options.coalesce_target_weights == kCoalesceTargetAuto) options.coalesce_target_weights = entry->coalesce_target_weights;
+    if (options.verbose) {
+        std::cout << "[Pthreads Tune] Perfil aplicado: " << options.num_threads << " threads, coalesce_target_weights=" << options.coalesce_target_weights << "." << std::endl;
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef AUTO_TUNE_H
+#define AUTO_TUNE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "QuantEngine.h"
+
+// Ajuste automático de quantize_blocks_parallel. A calibração roda micro-benchmarks
+// numa amostra dos próprios blocos e grava o melhor num_threads e
+// coalesce_target_weights (o "tile" dos itens de trabalho) por dq_flag num perfil
+// em disco. Chamadas seguintes com num_threads == 0 carregam o perfil sozinhas.
+
+struct QuantTuningEntry {
+    int dq_flag;                      // 0 = URQ, 1 = TCQ
+    int num_threads;
+    uint64_t coalesce_target_weights;
+    double weights_per_s;             // Vazão medida com esses valores
+};
+
+struct QuantTuningProfile {
+    std::string host;                 // Máquina onde foi medido (current_tuning_host)
+    std::vector<QuantTuningEntry> entries;
+
+    const QuantTuningEntry* find(int dq_flag) const;
+    bool load(const std::string& path);       // false se não existir ou for de outra máquina
+    void save(const std::string& path) const; // Cria os diretórios que faltarem; lança runtime_error se falhar
+};
+
+struct QuantTuningOptions {
+    uint64_t sample_weights;  // Pesos da amostra por dq_flag
+    int max_threads;          // Maior número de threads testado (0 = threads de hardware)
+    int repeat;               // Repetições por medida (vale a melhor)
+
+    QuantTuningOptions() : sample_weights(1ull << 22), max_threads(0), repeat(2) {}
+};
+
+// hostname e número de threads de hardware: um perfil só vale na máquina em que foi medido
+std::string current_tuning_host();
+
+// $NNCODEC_TUNING_PROFILE, ou <cache do usuário>/nncodec/quant_tuning.profile
+std::string default_tuning_profile_path();
+
+// Mede a vazão de amostras dos blocos (saídas em buffers próprios; os blocos não são alterados)
+QuantTuningProfile calibrate_quantizer(const std::vector<QuantBlock>& blocks, const QuantTuningOptions& tuning);
+
+// Chamado por quantize_blocks_parallel: com options.calibrate, calibra e grava o perfil;
+// senão, com options.num_threads == 0, carrega o perfil se existir. O perfil escolhe
+// num_threads e coalesce_target_weights para o dq_flag predominante, só os que quem
+// chamou deixou automáticos (num_threads <= 0, kCoalesceTargetAuto).
+void apply_quant_tuning(const std::vector<QuantBlock>& blocks, QuantEngineOptions& options);
+
+#endif // AUTO_TUNE_H
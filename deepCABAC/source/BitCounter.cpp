@@ -0,0 +1,178 @@
+#include "BitCounter.h"
+
+#include <algorithm>
+#include <cmath>
+#include "ScanReorder.h"
+
+namespace
+{
+const uint32_t kProbBits       = 15;
+const uint32_t kProbOne        = 1u << kProbBits;
+const uint32_t kFracBitsShift  = 15;              // Custos em 1/2^15 bit
+const uint32_t kFracTableBits  = 9;               // Probabilidade quantizada em 512 faixas
+const uint32_t kNumEgCtx       = 32;              // Um contexto por bin do prefixo Exp-Golomb
+
+// Pares (rápida, lenta) de deslocamentos de adaptação; o primeiro é o padrão sem param_opt_flag
+const uint8_t kRateShifts[BitCounter::kNumRateCandidates][2] = { { 4, 7 }, { 5, 8 }, { 3, 6 }, { 6, 9 } };
+
+// Transições de estado do TCQ pela paridade do nível (mesma tabela de quantize()/encodeWeights)
+const uint32_t kTcqTrans[4][2] = { { 0, 2 }, { 2, 0 }, { 1, 3 }, { 3, 1 } };
+
+// Contextos: sig_flag (classe do estado TCQ x classe do vizinho), sinal (classe do vizinho),
+// gtx (flag x sinal x paridade do estado) e prefixo do resto
+const uint32_t kSigCtxOffset   = 0;
+const uint32_t kSignCtxOffset  = 9;
+const uint32_t kGtxCtxOffset   = 12;
+
+// -log2(p) em 1/2^15 bit, para p no centro de cada faixa
+struct FracBitsTable
+{
+  uint32_t bits[1u << kFracTableBits];
+
+  FracBitsTable()
+  {
+    const uint32_t step = kProbOne >> kFracTableBits;
+    for( uint32_t i = 0; i < ( 1u << kFracTableBits ); i++ )
+    {
+      double p = ( i * step + step / 2.0 ) / kProbOne;
+      bits[i]  = (uint32_t) std::lround( -std::log2( p ) * ( 1u << kFracBitsShift ) );
+    }
+  }
+};
+
+const FracBitsTable& fracBitsTable()
+{
+  static const FracBitsTable table;
+  return table;
+}
+
+inline uint32_t neighborClass( int32_t neighbor )
+{
+  return neighbor == 0 ? 0 : ( neighbor < 0 ? 1 : 2 );
+}
+}
+
+BitCounter::BitCounter( uint32_t cabac_unary_length_minus1, uint8_t param_opt_flag )
+  : m_NumGtxFlags( cabac_unary_length_minus1 + 1 )
+  , m_NumCandidates( param_opt_flag ? kNumRateCandidates : 1 )
+  , m_BypassBits( 0 )
+  , m_DqFlag( 0 )
+  , m_TcqState( 0 )
+  , m_Neighbor( 0 )
+{
+  m_FracBits = fracBitsTable().bits;
+  for( uint32_t k = 0; k < kNumRateCandidates; k++ )
+  {
+    m_ShiftA[k] = kRateShifts[k][0];
+    m_ShiftB[k] = kRateShifts[k][1];
+  }
+  m_NumCtx = kGtxCtxOffset + m_NumGtxFlags * 4 + kNumEgCtx;
+  ProbState equiprobable = { (int32_t) ( kProbOne / 2 ), (int32_t) ( kProbOne / 2 ) };
+  m_States.assign( (size_t) m_NumCtx * m_NumCandidates, equiprobable );
+  m_Cost.assign( (size_t) m_NumCtx * m_NumCandidates, 0 );
+}
+
+// Sem desvios dependentes do bin: o alvo da adaptação é 0 ou kProbOne e o deslocamento
+// aritmético de um valor negativo arredonda para baixo, como p -= p >> shift
+inline void BitCounter::codeBin( uint32_t ctxId, uint32_t bin )
+{
+  ProbState* state  = &m_States[(size_t) ctxId * m_NumCandidates];
+  uint64_t*  cost   = &m_Cost[(size_t) ctxId * m_NumCandidates];
+  int32_t    target = (int32_t) ( bin << kProbBits );
+  for( uint32_t k = 0; k < m_NumCandidates; k++ )
+  {
+    int32_t probOne = ( state[k].probA + state[k].probB ) >> 1;
+    int32_t prob    = bin ? probOne : (int32_t) kProbOne - probOne;
+    cost[k]        += m_FracBits[prob >> ( kProbBits - kFracTableBits )];
+    state[k].probA += ( target - state[k].probA ) >> m_ShiftA[k];
+    state[k].probB += ( target - state[k].probB ) >> m_ShiftB[k];
+  }
+}
+
+// Resto além das flags gtx: prefixo unário de grupos de tamanho 1, 2, 4, ... com
+// contexto por posição, e o deslocamento dentro do grupo em bypass
+inline void BitCounter::codeRemainder( uint32_t remAbsLevel )
+{
+  uint64_t base           = 0;
+  uint32_t log2GroupSize  = 0;
+  uint32_t ctxId          = kGtxCtxOffset + m_NumGtxFlags * 4;
+  const uint32_t lastCtx  = ctxId + kNumEgCtx - 1;
+  while( remAbsLevel >= base + ( 1ull << log2GroupSize ) )
+  {
+    codeBin( ctxId, 1 );
+    base += 1ull << log2GroupSize;
+    log2GroupSize++;
+    ctxId = std::min( ctxId + 1, lastCtx );
+  }
+  codeBin( ctxId, 0 );
+  m_BypassBits += log2GroupSize;
+}
+
+inline void BitCounter::codeWeight( int32_t weight )
+{
+  uint32_t stateClass = m_DqFlag ? 1 + ( m_TcqState >> 1 ) : 0;
+  uint32_t neighbor   = neighborClass( m_Neighbor );
+  uint32_t sig        = weight != 0 ? 1 : 0;
+  codeBin( kSigCtxOffset + stateClass * 3 + neighbor, sig );
+  uint32_t absLevel   = weight < 0 ? (uint32_t) -(int64_t) weight : (uint32_t) weight;
+  if( sig )
+  {
+    uint32_t sign = weight < 0 ? 1 : 0;
+    codeBin( kSignCtxOffset + neighbor, sign );
+
+    uint32_t gtxCtx      = kGtxCtxOffset + ( sign * 2 + ( m_TcqState & 1 ) ) * m_NumGtxFlags;
+    uint32_t remAbsLevel = absLevel - 1;
+    uint32_t numFlags    = 0;
+    uint32_t flag        = 1;
+    while( flag && numFlags < m_NumGtxFlags )
+    {
+      flag = remAbsLevel > 0 ? 1 : 0;
+      codeBin( gtxCtx + numFlags, flag );
+      numFlags++;
+      if( flag ) { remAbsLevel--; }
+    }
+    if( flag )
+    {
+      codeRemainder( remAbsLevel );
+    }
+  }
+  if( m_DqFlag )
+  {
+    m_TcqState = kTcqTrans[m_TcqState][absLevel & 1];
+  }
+  m_Neighbor = weight;
+}
+
+void BitCounter::addWeights( const int32_t* pWeights, uint32_t layerWidth, uint32_t numWeights, uint8_t dq_flag, int32_t scan_order )
+{
+  // Cada chamada é um encodeWeights: estado do TCQ e vizinho zerados, contextos mantidos
+  m_DqFlag   = dq_flag;
+  m_TcqState = 0;
+  m_Neighbor = 0;
+
+  // Varredura em blocos: o segmento é copiado na ordem da varredura e percorrido em sequência
+  const int32_t* pScan = pWeights;
+  if( scanBlockSize( scan_order ) > 0 && layerWidth > 1 && numWeights / layerWidth > 1 )
+  {
+    m_ScanLevels.resize( numWeights );
+    reorderToScan( pWeights, m_ScanLevels.data(), numWeights, layerWidth, scan_order );
+    pScan = m_ScanLevels.data();
+  }
+  for( uint32_t i = 0; i < numWeights; i++ ) { codeWeight( pScan[i] ); }
+}
+
+double BitCounter::bits() const
+{
+  uint64_t total = 0;
+  for( uint32_t ctxId = 0; ctxId < m_NumCtx; ctxId++ )
+  {
+    const uint64_t* cost = &m_Cost[(size_t) ctxId * m_NumCandidates];
+    total += *std::min_element( cost, cost + m_NumCandidates );
+  }
+  return (double) total / ( 1u << kFracBitsShift ) + (double) m_BypassBits;
+}
+
+uint64_t BitCounter::finish() const
+{
+  return (uint64_t) std::ceil( bits() );
+}
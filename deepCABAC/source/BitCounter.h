@@ -0,0 +1,60 @@
+#ifndef BIT_COUNTER_H
+#define BIT_COUNTER_H
+
+#include <Lib/CommonLib/TypeDef.h>
+#include <cstdint>
+#include <vector>
+
+// Estimativa de taxa sem codificação aritmética. Os níveis são percorridos na ordem
+// da varredura com a binarização do encodeWeights (sig_flag, sinal, flags gtx até
+// cabac_unary_length e o resto em Exp-Golomb com prefixo adaptativo e sufixo bypass),
+// e cada bin soma os bits fracionários -log2(p) dados pelo estado do seu contexto,
+// que depois é adaptado como no CABAC. Não há intervalo, renormalização nem bytes:
+// um bin custa uma consulta de tabela e a atualização do estado.
+//
+// Os contextos são do próprio contador (o estado do CABACEncoder é privado da
+// biblioteca) e começam equiprováveis, como após initCtxMdls: a estimativa segue o
+// tamanho de um stream com contextos novos, sem ser bit-exata.
+class BitCounter
+{
+public:
+  // Com param_opt_flag, cada contexto acompanha kNumRateCandidates pares de taxas de
+  // adaptação e entra na soma com o mais barato, como a otimização de parâmetros do codificador
+  BitCounter( uint32_t cabac_unary_length_minus1, uint8_t param_opt_flag );
+
+  void     addWeights( const int32_t* pWeights, uint32_t layerWidth, uint32_t numWeights, uint8_t dq_flag, int32_t scan_order );
+
+  double   bits  () const;                    // Estimativa acumulada, em bits
+  uint64_t finish() const;                    // bits() arredondado para cima
+
+  static const uint32_t kNumRateCandidates = 4;
+
+private:
+  struct ProbState
+  {
+    int32_t probA;    // P(bin = 1) em 15 bits, adaptação rápida
+    int32_t probB;    // Idem, adaptação lenta
+  };
+
+  void     codeBin   ( uint32_t ctxId, uint32_t bin );
+  void     codeWeight( int32_t weight );
+  void     codeRemainder( uint32_t remAbsLevel );
+
+  uint32_t               m_NumGtxFlags;
+  uint32_t               m_NumCandidates;
+  uint32_t               m_NumCtx;
+  uint8_t                m_ShiftA[kNumRateCandidates];
+  uint8_t                m_ShiftB[kNumRateCandidates];
+  const uint32_t*        m_FracBits;          // -log2(p) por faixa de probabilidade
+  std::vector<ProbState> m_States;            // m_NumCtx * m_NumCandidates
+  std::vector<uint64_t>  m_Cost;              // Bits fracionários por (contexto, candidato)
+  uint64_t               m_BypassBits;
+  std::vector<int32_t>   m_ScanLevels;        // Segmento em ordem de varredura (scan_order > 0)
+
+  // Estado do segmento em andamento
+  uint8_t                m_DqFlag;
+  uint32_t               m_TcqState;
+  int32_t                m_Neighbor;          // Nível anterior na varredura
+};
+
+#endif // BIT_COUNTER_H
@@ -0,0 +1,205 @@
+#include "BlockCache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <thread>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+namespace
+{
+const uint64_t kPrime1 = 11400714785074694791ULL;
+const uint64_t kPrime2 = 14029467366897019727ULL;
+const uint64_t kPrime3 =  1609587929392839161ULL;
+const uint64_t kPrime4 =  9650029242287828579ULL;
+const uint64_t kPrime5 =  2870177450012600261ULL;
+
+const char     kCacheMagic[4] = { 'N', 'N', 'C', 'Q' };
+const uint32_t kCacheVersion  = 2; // 2: QP na chave, sem QP no arquivo
+
+struct CacheHeader
+{
+  char     magic[4];
+  uint32_t version;
+  uint64_t key;
+  uint64_t numWeights;
+  uint64_t reserved;
+};
+
+inline uint64_t rotl64( uint64_t x, int r ) { return ( x << r ) | ( x >> ( 64 - r ) ); }
+inline uint64_t read64( const uint8_t* p ) { uint64_t v; memcpy( &v, p, sizeof( v ) ); return v; }
+inline uint32_t read32( const uint8_t* p ) { uint32_t v; memcpy( &v, p, sizeof( v ) ); return v; }
+
+inline uint64_t hashRound( uint64_t acc, uint64_t input )
+{
+  acc += input * kPrime2;
+  acc  = rotl64( acc, 31 );
+  return acc * kPrime1;
+}
+
+inline uint64_t mergeRound( uint64_t acc, uint64_t val )
+{
+  acc ^= hashRound( 0, val );
+  return acc * kPrime1 + kPrime4;
+}
+}
+
+uint64_t hashBytes64( const void* data, size_t bytes, uint64_t seed )
+{
+  const uint8_t* p   = static_cast<const uint8_t*>( data );
+  const uint8_t* end = p + bytes;
+  uint64_t h;
+
+  if( bytes >= 32 )
+  {
+    uint64_t lanes[4] = { seed + kPrime1 + kPrime2, seed + kPrime2, seed, seed - kPrime1 };
+    const uint8_t* limit = end - 32;
+    do
+    {
+      for( int k = 0; k < 4; k++ )
+      {
+        lanes[k] = hashRound( lanes[k], read64( p + 8 * k ) );
+      }
+      p += 32;
+    } while( p <= limit );
+
+    h = rotl64( lanes[0], 1 ) + rotl64( lanes[1], 7 ) + rotl64( lanes[2], 12 ) + rotl64( lanes[3], 18 );
+    for( int k = 0; k < 4; k++ )
+    {
+      h = mergeRound( h, lanes[k] );
+    }
+  }
+  else
+  {
+    h = seed + kPrime5;
+  }
+
+  h += (uint64_t) bytes;
+  for( ; p + 8 <= end; p += 8 )
+  {
+    h ^= hashRound( 0, read64( p ) );
+    h  = rotl64( h, 27 ) * kPrime1 + kPrime4;
+  }
+  if( p + 4 <= end )
+  {
+    h ^= (uint64_t) read32( p ) * kPrime1;
+    h  = rotl64( h, 23 ) * kPrime2 + kPrime3;
+    p += 4;
+  }
+  for( ; p < end; p++ )
+  {
+    h ^= (uint64_t) ( *p ) * kPrime5;
+    h  = rotl64( h, 11 ) * kPrime1;
+  }
+
+  h ^= h >> 33;
+  h *= kPrime2;
+  h ^= h >> 29;
+  h *= kPrime3;
+  h ^= h >> 32;
+  return h;
+}
+
+BlockCache::BlockCache( const std::string& directory )
+  : m_Directory( directory )
+{
+}
+
+uint64_t BlockCache::blockKey( const float* pWeights, const float* pReference, uint64_t numWeights, uint64_t layerWidth, float qStepSize,
+                               float lambdaScale, uint8_t dq_flag, uint32_t maxNumNoRem, int32_t scan_order, int32_t qp, int32_t qpDensity )
+{
+  // Parâmetros serializados campo a campo (sem padding) e usados como semente do hash dos pesos
+  uint8_t params[64];
+  size_t  pos = 0;
+  memcpy( params + pos, &kCacheVersion, sizeof( kCacheVersion ) ); pos += sizeof( kCacheVersion );
+  memcpy( params + pos, &numWeights,    sizeof( numWeights ) );    pos += sizeof( numWeights );
+  memcpy( params + pos, &layerWidth,    sizeof( layerWidth ) );    pos += sizeof( layerWidth );
+  memcpy( params + pos, &qStepSize,     sizeof( qStepSize ) );     pos += sizeof( qStepSize );
+  memcpy( params + pos, &lambdaScale,   sizeof( lambdaScale ) );   pos += sizeof( lambdaScale );
+  memcpy( params + pos, &dq_flag,       sizeof( dq_flag ) );       pos += sizeof( dq_flag );
+  memcpy( params + pos, &maxNumNoRem,   sizeof( maxNumNoRem ) );   pos += sizeof( maxNumNoRem );
+  memcpy( params + pos, &scan_order,    sizeof( scan_order ) );    pos += sizeof( scan_order );
+  memcpy( params + pos, &qp,            sizeof( qp ) );            pos += sizeof( qp );
+  memcpy( params + pos, &qpDensity,     sizeof( qpDensity ) );     pos += sizeof( qpDensity );
+
+  uint64_t seed = hashBytes64( params, pos );
+  if( pReference != nullptr )
+  {
+    seed = hashBytes64( pReference, numWeights * sizeof( float ), seed );
+  }
+  return hashBytes64( pWeights, numWeights * sizeof( float ), seed );
+}
+
+std::string BlockCache::pathFor( uint64_t key ) const
+{
+  char name[32];
+  snprintf( name, sizeof( name ), "%016llx.qidx", (unsigned long long) key );
+  return m_Directory + "/" + name;
+}
+
+bool BlockCache::load( uint64_t key, uint64_t numWeights, int32_t* pQIndex ) const
+{
+  std::ifstream file( pathFor( key ), std::ios::binary );
+  if( !file )
+  {
+    return false;
+  }
+  CacheHeader header;
+  if( !file.read( reinterpret_cast<char*>( &header ), sizeof( header ) ) ||
+      memcmp( header.magic, kCacheMagic, sizeof( kCacheMagic ) ) != 0 ||
+      header.version != kCacheVersion || header.key != key || header.numWeights != numWeights )
+  {
+    return false;
+  }
+  if( !file.read( reinterpret_cast<char*>( pQIndex ), (std::streamsize) ( numWeights * sizeof( int32_t ) ) ) )
+  {
+    return false;
+  }
+  return true;
+}
+
+bool BlockCache::store( uint64_t key, uint64_t numWeights, const int32_t* pQIndex ) const
+{
+  // Escreve num arquivo temporário e renomeia: leitores concorrentes (ou uma
+  // execução interrompida) nunca veem um arquivo pela metade
+  std::string path = pathFor( key );
+  std::string tmpPath = path + ".tmp" + std::to_string( (long long) getpid() ) + "_" +
+                        std::to_string( std::hash<std::thread::id>()( std::this_thread::get_id() ) );
+  {
+    std::ofstream file( tmpPath, std::ios::binary | std::ios::trunc );
+    if( !file )
+    {
+      return false;
+    }
+    CacheHeader header;
+    memcpy( header.magic, kCacheMagic, sizeof( kCacheMagic ) );
+    header.version    = kCacheVersion;
+    header.key        = key;
+    header.numWeights = numWeights;
+    header.reserved   = 0;
+    file.write( reinterpret_cast<const char*>( &header ), sizeof( header ) );
+    file.write( reinterpret_cast<const char*>( pQIndex ), (std::streamsize) ( numWeights * sizeof( int32_t ) ) );
+    if( !file )
+    {
+      file.close();
+      std::remove( tmpPath.c_str() );
+      return false;
+    }
+  }
+#ifdef _WIN32
+  std::remove( path.c_str() ); // rename() do Windows não substitui um arquivo existente
+#endif
+  if( std::rename( tmpPath.c_str(), path.c_str() ) != 0 )
+  {
+    std::remove( tmpPath.c_str() );
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,35 @@
+#ifndef BLOCK_CACHE_H
+#define BLOCK_CACHE_H
+
+#include <cstdint>
+#include <string>
+
+// Hash de 64 bits no esquema do xxHash64: quatro acumuladores independentes sobre
+// faixas de 32 bytes (o compilador vetoriza as quatro lanes), avalanche no final
+uint64_t hashBytes64( const void* data, size_t bytes, uint64_t seed = 0 );
+
+// Cache em disco de blocos quantizados, para recomprimir checkpoints em que a
+// maioria das camadas é idêntica ao modelo base. A chave combina o hash dos
+// pesos com tudo que muda o resultado de quantize() (passo, lambda, dq_flag,
+// maxNumNoRem, scan_order, as dimensões e, no modo delta, a referência) e com o
+// QP/qpDensity que vão para o bitstream. Cada bloco é um arquivo <dir>/<chave>.qidx
+// só com os níveis em int32: o QP final não é guardado, quem lê usa o do bloco.
+class BlockCache
+{
+public:
+  explicit BlockCache( const std::string& directory );
+
+  static uint64_t blockKey( const float* pWeights, const float* pReference, uint64_t numWeights, uint64_t layerWidth, float qStepSize,
+                            float lambdaScale, uint8_t dq_flag, uint32_t maxNumNoRem, int32_t scan_order, int32_t qp, int32_t qpDensity );
+
+  // Não usam o GIL: podem ser chamados pelos workers
+  bool load ( uint64_t key, uint64_t numWeights, int32_t* pQIndex ) const;
+  bool store( uint64_t key, uint64_t numWeights, const int32_t* pQIndex ) const;
+
+private:
+  std::string pathFor( uint64_t key ) const;
+
+  std::string m_Directory;
+};
+
+#endif // BLOCK_CACHE_H
@@ -0,0 +1,112 @@
+#include "BufferPool.h"
+
+#include <new>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+static const size_t kPageSize = 4096;
+static const size_t kHugePageSize = 2u << 20;
+
+size_t BufferPool::roundSize( size_t bytes, bool hugePages )
+{
+  size_t align = ( hugePages && bytes >= kHugePageSize ) ? kHugePageSize : kPageSize;
+  if( bytes == 0 ) { bytes = 1; }
+  return ( bytes + align - 1 ) / align * align;
+}
+
+void* BufferPool::mapBytes( size_t bytes, bool hugePages )
+{
+#ifdef _WIN32
+  (void) hugePages;
+  void* ptr = VirtualAlloc( nullptr, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE );
+  if( ptr == nullptr ) { throw std::bad_alloc(); }
+  return ptr;
+#else
+  void* ptr = mmap( nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+  if( ptr == MAP_FAILED ) { throw std::bad_alloc(); }
+#ifdef MADV_HUGEPAGE
+  if( hugePages && bytes >= kHugePageSize )
+  {
+    madvise( ptr, bytes, MADV_HUGEPAGE );  // Apenas um pedido; o kernel pode recusar
+  }
+#else
+  (void) hugePages;
+#endif
+  return ptr;
+#endif
+}
+
+void BufferPool::unmapBytes( void* ptr, size_t bytes )
+{
+#ifdef _WIN32
+  (void) bytes;
+  VirtualFree( ptr, 0, MEM_RELEASE );
+#else
+  munmap( ptr, bytes );
+#endif
+}
+
+BufferPool::~BufferPool()
+{
+  for( auto& entry : m_FreeLists )
+  {
+    for( void* ptr : entry.second ) { unmapBytes( ptr, entry.first ); }
+  }
+}
+
+BufferPool::Buffer BufferPool::allocate( size_t bytes )
+{
+  Buffer buffer;
+  buffer.bytes = roundSize( bytes, m_HugePages );
+  {
+    std::lock_guard<std::mutex> lock( m_Mutex );
+    auto it = m_FreeLists.find( buffer.bytes );
+    if( it != m_FreeLists.end() && !it->second.empty() )
+    {
+      buffer.ptr = it->second.back();
+      it->second.pop_back();
+      m_Pooled -= buffer.bytes;
+      return buffer;
+    }
+  }
+  buffer.ptr = mapBytes( buffer.bytes, m_HugePages );
+  std::lock_guard<std::mutex> lock( m_Mutex );
+  m_Reserved += buffer.bytes;
+  return buffer;
+}
+
+void BufferPool::release( const Buffer& buffer )
+{
+  std::lock_guard<std::mutex> lock( m_Mutex );
+  m_FreeLists[buffer.bytes].push_back( buffer.ptr );
+  m_Pooled += buffer.bytes;
+}
+
+void BufferPool::trim()
+{
+  std::lock_guard<std::mutex> lock( m_Mutex );
+  for( auto& entry : m_FreeLists )
+  {
+    for( void* ptr : entry.second ) { unmapBytes( ptr, entry.first ); }
+    m_Reserved -= entry.first * entry.second.size();
+  }
+  m_FreeLists.clear();
+  m_Pooled = 0;
+}
+
+size_t BufferPool::reservedBytes() const
+{
+  std::lock_guard<std::mutex> lock( m_Mutex );
+  return m_Reserved;
+}
+
+size_t BufferPool::pooledBytes() const
+{
+  std::lock_guard<std::mutex> lock( m_Mutex );
+  return m_Pooled;
+}
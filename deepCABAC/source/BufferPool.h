@@ -0,0 +1,45 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <vector>
+
+// Pool de buffers mapeados direto do SO (mmap / VirtualAlloc), reaproveitados por
+// tamanho arredondado. Buffers de 2 MB ou mais pedem huge pages ao kernel.
+// Não depende de Python: OutputArena embrulha estes buffers em arrays NumPy.
+class BufferPool
+{
+public:
+  struct Buffer
+  {
+    void*  ptr;
+    size_t bytes;
+  };
+
+  explicit BufferPool( bool hugePages = true ) : m_HugePages( hugePages ), m_Reserved( 0 ), m_Pooled( 0 ) {}
+  ~BufferPool();
+
+  Buffer allocate     ( size_t bytes );           // Thread-safe
+  void   release      ( const Buffer& buffer );   // Devolve à lista livre do tamanho
+  void   trim         ();                         // Devolve ao SO os buffers livres
+  size_t reservedBytes() const;                   // Total mapeado (em uso + livre)
+  size_t pooledBytes  () const;                   // Total livre, pronto para reuso
+
+private:
+  BufferPool( const BufferPool& );
+  BufferPool& operator=( const BufferPool& );
+
+  static size_t roundSize ( size_t bytes, bool hugePages );
+  static void*  mapBytes  ( size_t bytes, bool hugePages );
+  static void   unmapBytes( void* ptr, size_t bytes );
+
+  bool                                   m_HugePages;
+  mutable std::mutex                     m_Mutex;
+  std::map<size_t, std::vector<void*>>   m_FreeLists;   // Tamanho arredondado -> buffers livres
+  size_t                                 m_Reserved;
+  size_t                                 m_Pooled;
+};
+
+#endif // BUFFER_POOL_H
@@ -0,0 +1,235 @@
+#include "LayerCoder.h"
+
+#include <algorithm>
+#include <vector>
+#include <math.h>
+#include <Lib/CommonLib/Quant.h>
+#include "LayerSegments.h"
+#include "ParallelFor.h"
+#include "ScratchArena.h"
+
+// Menor faixa reconstruída por uma thread em dequantizeLayer
+static const uint64_t kMinDequantRangeWeights = 1ull << 18;
+
+float32_t qpToStepSize( int32_t qpDensity, int32_t qp )
+{
+  int32_t k = 1 << qpDensity;
+  int32_t mul = k + (qp & (k-1));
+  int32_t shift = qp >> qpDensity;
+  return mul * pow(2.0, shift - qpDensity);
+}
+
+int32_t quantizeLayer( float32_t* pWeights, int32_t* pQIndex, uint64_t numWeights, uint64_t layerWidth, int32_t qpDensity, int32_t qp,
+                       float32_t lambdaScale, uint8_t dq_flag, uint32_t maxNumNoRem, int32_t scan_order )
+{
+  std::vector<LayerSegment> segments = splitLayerIntoSegments( numWeights, layerWidth );
+
+  int32_t k = 1 << qpDensity;
+  float32_t qStepSize = qpToStepSize( qpDensity, qp );
+
+  int32_t success = 1;
+  for( const LayerSegment& seg : segments )
+  {
+    success &= quantize(pWeights + seg.offset, pQIndex + seg.offset, qStepSize, seg.layerWidth, seg.numWeights, DIST_MSE, lambdaScale, dq_flag, maxNumNoRem, segmentScanOrder( scan_order, seg ));
+  }
+
+  if( !success )
+  {
+    float32_t maxAbs = 0.0;
+
+    for(uint64_t i = 0; i < numWeights; i++)
+    {
+      if( fabs( pWeights[i] ) > maxAbs )
+      {
+        maxAbs = fabs(pWeights[i]);
+      }
+    }
+
+    double minStepsize = (double)(maxAbs) / ((double)((1u << 31) - 3));
+
+    float32_t baseQP = floor(log2(minStepsize)) * k;
+    float32_t newQp = baseQP + ((minStepsize * k) / pow(2.0, (baseQP / k)) - k);
+    qp = (int32_t)(ceil(newQp));
+    qStepSize = qpToStepSize( qpDensity, qp );
+
+    success = 1;
+    for( const LayerSegment& seg : segments )
+    {
+      success &= quantize(pWeights + seg.offset, pQIndex + seg.offset, qStepSize, seg.layerWidth, seg.numWeights, DIST_MSE, lambdaScale, dq_flag, maxNumNoRem, segmentScanOrder( scan_order, seg ));
+    }
+    CHECK( !success, "Prevention of integer-overflow failed!");
+  }
+  return qp;
+}
+
+uint32_t encodeLayerLevels( CABACEncoder& encoder, int32_t* pQIndex, uint64_t numWeights, uint64_t layerWidth, uint8_t dq_flag, int32_t scan_order,
+                            uint64_t maxSegmentWeights )
+{
+  uint32_t result = 0;
+  for( const LayerSegment& seg : splitLayerIntoSegments( numWeights, layerWidth, maxSegmentWeights ) )
+  {
+    result += encoder.encodeWeights(pQIndex + seg.offset, seg.layerWidth, seg.numWeights, dq_flag, segmentScanOrder( scan_order, seg ));
+  }
+  return result;
+}
+
+void decodeLayerLevels( CABACDecoder& decoder, int32_t* pQIndex, uint64_t numWeights, uint64_t layerWidth, uint8_t dq_flag, int32_t scan_order,
+                        uint64_t maxSegmentWeights )
+{
+  for( const LayerSegment& seg : splitLayerIntoSegments( numWeights, layerWidth, maxSegmentWeights ) )
+  {
+    decoder.decodeWeights(pQIndex + seg.offset, seg.layerWidth, seg.numWeights, dq_flag, segmentScanOrder( scan_order, seg ));
+  }
+}
+
+// Divide o segmento em até numRanges faixas de linhas inteiras, com um múltiplo de
+// kSegmentRowAlign linhas cada (só a última pode ter menos)
+static void splitSegmentIntoRowRanges( const LayerSegment& seg, uint32_t numRanges, std::vector<LayerSegment>& ranges )
+{
+  uint64_t rows          = seg.numWeights / seg.layerWidth;
+  uint64_t rowsPerRange  = ( rows + numRanges - 1 ) / numRanges;
+  uint64_t minRows       = ( kMinDequantRangeWeights + seg.layerWidth - 1 ) / seg.layerWidth;
+  if( rowsPerRange < minRows ) { rowsPerRange = minRows; }
+  rowsPerRange = ( rowsPerRange + kSegmentRowAlign - 1 ) / kSegmentRowAlign * kSegmentRowAlign;
+  uint64_t step = rowsPerRange * seg.layerWidth;
+
+  for( uint64_t offset = 0; offset < seg.numWeights; offset += step )
+  {
+    uint64_t count = seg.numWeights - offset < step ? seg.numWeights - offset : step;
+    LayerSegment range = { seg.offset + offset, (uint32_t) count, seg.layerWidth, seg.rowsSplit };
+    ranges.push_back( range );
+  }
+}
+
+void decodeLayerSparse( CABACDecoder& decoder, uint64_t numWeights, uint64_t layerWidth, uint8_t dq_flag, int32_t scan_order,
+                        bool coo, bool dequantize, int32_t qpDensity, int32_t qp, SparseLayer& out )
+{
+  CHECK( layerWidth == 0 || numWeights % layerWidth != 0, "Layer is not a whole number of rows!" );
+  out.numRows = numWeights / layerWidth;
+  out.numCols = layerWidth;
+  out.rowPtr.clear();
+  out.rowIndex.clear();
+  out.colIndex.clear();
+  out.levels.clear();
+  out.values.clear();
+  if( !coo ) { out.rowPtr.assign( out.numRows + 1, 0 ); }
+
+  float32_t qStepSize = qpToStepSize( qpDensity, qp );
+  ScratchArenaLease scratch; // Aparada ao sair: os rascunhos densos não ficam retidos
+  for( const LayerSegment& seg : splitLayerIntoSegments( numWeights, layerWidth ) )
+  {
+    int32_t* levels = scratch->get<int32_t>( SCRATCH_QINDEX, seg.numWeights );
+    decoder.decodeWeights( levels, seg.layerWidth, seg.numWeights, dq_flag, segmentScanOrder( scan_order, seg ) );
+
+    // Primeira passada: não nulos do segmento, para crescer a saída uma vez só
+    size_t nnz = 0;
+    for( uint32_t i = 0; i < seg.numWeights; i++ ) { nnz += levels[i] != 0; }
+    size_t next = out.colIndex.size();
+    out.colIndex.resize( next + nnz );
+    if( coo )        { out.rowIndex.resize( next + nnz ); }
+    if( dequantize ) { out.values.resize( next + nnz ); }
+    else             { out.levels.resize( next + nnz ); }
+
+    // Segunda passada por faixas de linhas (como em dequantizeLayer): com dequantize,
+    // o rascunho float tem o tamanho de uma faixa e não do segmento.
+    // Segmentos são linhas inteiras, ou fatias de um tensor 1D (uma coluna por linha)
+    std::vector<LayerSegment> ranges;
+    splitSegmentIntoRowRanges( seg, (uint32_t) ( ( seg.numWeights + kMinDequantRangeWeights - 1 ) / kMinDequantRangeWeights ), ranges );
+    for( const LayerSegment& range : ranges )
+    {
+      int32_t*       rangeLevels = levels + ( range.offset - seg.offset );
+      float32_t*     recon       = nullptr;
+      if( dequantize )
+      {
+        recon = scratch->get<float32_t>( SCRATCH_RECON, range.numWeights );
+        deQuantize( recon, rangeLevels, qStepSize, range.numWeights, range.layerWidth, segmentScanOrder( scan_order, range ) );
+      }
+      for( uint32_t i = 0; i < range.numWeights; i++ )
+      {
+        if( rangeLevels[i] == 0 ) { continue; }
+        uint64_t pos = range.offset + i;
+        out.colIndex[next] = (int64_t) ( pos % layerWidth );
+        if( coo ) { out.rowIndex[next] = (int64_t) ( pos / layerWidth ); }
+        else      { out.rowPtr[pos / layerWidth + 1]++; }
+        if( dequantize ) { out.values[next] = recon[i]; }
+        else             { out.levels[next] = rangeLevels[i]; }
+        next++;
+      }
+    }
+  }
+  for( uint64_t row = 0; !coo && row < out.numRows; row++ )
+  {
+    out.rowPtr[row + 1] += out.rowPtr[row];
+  }
+}
+
+// Níveis int32 vão direto para deQuantize; int8/int16 são alargados só na faixa, num
+// rascunho da thread
+static void dequantizeRange( float32_t* pWeights, int32_t* pQIndex, const LayerSegment& range, float32_t qStepSize, int32_t scan_order, ScratchArena* )
+{
+  deQuantize( pWeights + range.offset, pQIndex + range.offset, qStepSize, range.numWeights, range.layerWidth, segmentScanOrder( scan_order, range ) );
+}
+
+template <typename T>
+static void dequantizeRange( float32_t* pWeights, const T* pQIndex, const LayerSegment& range, float32_t qStepSize, int32_t scan_order, ScratchArena* scratch )
+{
+  int32_t* levels = scratch->get<int32_t>( SCRATCH_LEVELS, range.numWeights );
+  std::copy( pQIndex + range.offset, pQIndex + range.offset + range.numWeights, levels );
+  deQuantize( pWeights + range.offset, levels, qStepSize, range.numWeights, range.layerWidth, segmentScanOrder( scan_order, range ) );
+}
+
+template <typename T>
+static void dequantizeLevels( float32_t* pWeights, T* pQIndex, uint64_t numWeights, uint64_t layerWidth, int32_t qpDensity, int32_t qp, int32_t scan_order,
+                              int num_threads )
+{
+  float32_t qStepSize = qpToStepSize( qpDensity, qp );
+  num_threads = resolve_num_threads( num_threads );
+  // Níveis estreitos: faixas limitadas também com uma thread, para o rascunho int32
+  // não chegar ao tamanho do segmento
+  const bool narrow = sizeof( T ) < sizeof( int32_t );
+
+  std::vector<LayerSegment> ranges;
+  for( const LayerSegment& seg : splitLayerIntoSegments( numWeights, layerWidth ) )
+  {
+    if( ( num_threads > 1 || narrow ) && seg.numWeights >= 2 * kMinDequantRangeWeights && seg.layerWidth > 0 )
+    {
+      uint64_t numRanges = num_threads;
+      if( narrow ) { numRanges = std::max<uint64_t>( numRanges, seg.numWeights / kMinDequantRangeWeights ); }
+      splitSegmentIntoRowRanges( seg, (uint32_t) numRanges, ranges );
+    }
+    else
+    {
+      ranges.push_back( seg );
+    }
+  }
+
+  std::vector<ScratchArenaLease> scratch( narrow ? num_threads : 0 ); // Uma arena por thread do parallel_for
+  auto dequantRange = [&]( int idx, int thread_id )
+  {
+    dequantizeRange( pWeights, pQIndex, ranges[idx], qStepSize, scan_order, narrow ? &scratch[thread_id].arena() : nullptr );
+  };
+  if( num_threads == 1 || ranges.size() == 1 )
+  {
+    for( int idx = 0; idx < (int) ranges.size(); idx++ ) { dequantRange( idx, 0 ); }
+    return;
+  }
+  parallel_for_pthreads( (int) ranges.size(), num_threads, dequantRange );
+}
+
+void dequantizeLayer( float32_t* pWeights, int32_t* pQIndex, uint64_t numWeights, uint64_t layerWidth, int32_t qpDensity, int32_t qp, int32_t scan_order,
+                      int num_threads )
+{
+  dequantizeLevels( pWeights, pQIndex, numWeights, layerWidth, qpDensity, qp, scan_order, num_threads );
+}
+
+void dequantizeLayer( float32_t* pWeights, const int16_t* pQIndex, uint64_t numWeights, uint64_t layerWidth, int32_t qpDensity, int32_t qp, int32_t scan_order,
+                      int num_threads )
+{
+  dequantizeLevels( pWeights, pQIndex, numWeights, layerWidth, qpDensity, qp, scan_order, num_threads );
+}
+
+void dequantizeLayer( float32_t* pWeights, const int8_t* pQIndex, uint64_t numWeights, uint64_t layerWidth, int32_t qpDensity, int32_t qp, int32_t scan_order,
+                      int num_threads )
+{
+  dequantizeLevels( pWeights, pQIndex, numWeights, layerWidth, qpDensity, qp, scan_order, num_threads );
+}
@@ -0,0 +1,66 @@
+#ifndef LAYER_CODER_H
+#define LAYER_CODER_H
+
+#include <cstdint>
+#include <vector>
+#include <Lib/CommonLib/TypeDef.h>
+#include <Lib/EncLib/CABACEncoder.h>
+#include <Lib/DecLib/CABACDecoder.h>
+#include "LayerSegments.h"
+
+// Operações por camada sobre buffers nativos (sem Python), usadas pelas classes
+// Encoder/Decoder do módulo deepCABAC e por programas C++ que ligam a biblioteca
+// deepcabac_core direto. Camadas maiores que kMaxSegmentWeights são tratadas em
+// segmentos (LayerSegments.h).
+
+// Passo de quantização do QP (mesma fórmula de baseline.approx)
+float32_t qpToStepSize( int32_t qpDensity, int32_t qp );
+
+// Quantiza a camada com o QP dado. Se os níveis estourarem int32, repete com o
+// menor QP que evita o estouro. Retorna o QP usado.
+int32_t   quantizeLayer( float32_t* pWeights, int32_t* pQIndex, uint64_t numWeights, uint64_t layerWidth, int32_t qpDensity, int32_t qp,
+                         float32_t lambdaScale, uint8_t dq_flag, uint32_t maxNumNoRem, int32_t scan_order );
+
+// Codifica os níveis da camada no encoder (contextos já inicializados). Retorna a soma de encodeWeights.
+// maxSegmentWeights só muda nos testes (segmentos pequenos sem camadas de 2^24 pesos).
+uint32_t  encodeLayerLevels( CABACEncoder& encoder, int32_t* pQIndex, uint64_t numWeights, uint64_t layerWidth, uint8_t dq_flag, int32_t scan_order,
+                             uint64_t maxSegmentWeights = kMaxSegmentWeights );
+
+// Decodifica os níveis da camada, na mesma segmentação usada por encodeLayerLevels
+void      decodeLayerLevels( CABACDecoder& decoder, int32_t* pQIndex, uint64_t numWeights, uint64_t layerWidth, uint8_t dq_flag, int32_t scan_order,
+                             uint64_t maxSegmentWeights = kMaxSegmentWeights );
+
+// Camada decodificada em forma esparsa: só as posições com nível diferente de zero,
+// em ordem raster, numa matriz de numWeights / layerWidth linhas por layerWidth colunas
+struct SparseLayer
+{
+  uint64_t                numRows;
+  uint64_t                numCols;
+  std::vector<int64_t>    rowPtr;     // CSR: numRows + 1 posições; vazio no COO
+  std::vector<int64_t>    rowIndex;   // COO: linha de cada valor; vazio no CSR
+  std::vector<int64_t>    colIndex;
+  std::vector<int32_t>    levels;     // Níveis (sem dequantize)
+  std::vector<float32_t>  values;     // Pesos reconstruídos (com dequantize)
+};
+
+// Decodifica a camada direto para CSR (ou COO). O CABAC decodifica um segmento inteiro
+// por chamada, então cada segmento ainda passa por um rascunho int32 denso da arena
+// (liberado ao fim da chamada) antes de ser compactado: a saída cresce com os não
+// nulos, mas o pico de memória e o tempo de decodificação crescem com o segmento.
+// Com dequantize, os valores saem reconstruídos com qpDensity/qp, faixa a faixa.
+void      decodeLayerSparse( CABACDecoder& decoder, uint64_t numWeights, uint64_t layerWidth, uint8_t dq_flag, int32_t scan_order,
+                             bool coo, bool dequantize, int32_t qpDensity, int32_t qp, SparseLayer& out );
+
+// Reconstrói os pesos a partir dos níveis e do QP. Com num_threads != 1 (0 = threads de
+// hardware), camadas grandes são divididas em faixas de linhas múltiplas de
+// kSegmentRowAlign, reconstruídas em paralelo; cada faixa contém blocos inteiros da varredura.
+// Níveis int8/int16 são alargados faixa a faixa (faixas limitadas mesmo com uma thread),
+// sem cópia int32 da camada inteira.
+void      dequantizeLayer( float32_t* pWeights, int32_t* pQIndex, uint64_t numWeights, uint64_t layerWidth, int32_t qpDensity, int32_t qp, int32_t scan_order,
+                           int num_threads = 1 );
+void      dequantizeLayer( float32_t* pWeights, const int16_t* pQIndex, uint64_t numWeights, uint64_t layerWidth, int32_t qpDensity, int32_t qp, int32_t scan_order,
+                           int num_threads = 1 );
+void      dequantizeLayer( float32_t* pWeights, const int8_t* pQIndex, uint64_t numWeights, uint64_t layerWidth, int32_t qpDensity, int32_t qp, int32_t scan_order,
+                           int num_threads = 1 );
+
+#endif // LAYER_CODER_H
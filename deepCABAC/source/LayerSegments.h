@@ -0,0 +1,86 @@
+#ifndef LAYER_SEGMENTS_H
+#define LAYER_SEGMENTS_H
+
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+// quantize(), deQuantize() e o CABAC recebem contagens uint32_t e um array int32 por
+// chamada. Camadas maiores que kMaxSegmentWeights são divididas em segmentos
+// independentes, cada um quantizado e codificado separadamente; o limite também
+// é o que os caminhos com qindex estreito (int8/int16) alargam de uma vez para
+// int32 (64 MB de rascunho), e define a segmentação do stream. Os cortes caem em múltiplos de
+// kSegmentRowAlign linhas para não quebrar os blocos das varreduras em blocos;
+// se nem kSegmentRowAlign linhas cabem, em quantas linhas couberem (a varredura
+// recomeça em cada segmento, igual no encoder e no decoder). Só camadas com linhas
+// maiores que o segmento viram fatias 1D, e essas só aceitam scan_order 0.
+static const uint64_t kMaxSegmentWeights = 1ull << 24;
+static const uint64_t kSegmentRowAlign   = 64;
+
+struct LayerSegment
+{
+  uint64_t offset;       // Primeiro peso do segmento (em elementos)
+  uint32_t numWeights;
+  uint32_t layerWidth;
+  bool     rowsSplit;    // Fatia 1D de uma camada de várias linhas maiores que o segmento
+};
+
+// Dimensões de um tensor em 64 bits: numWeights = produto do shape,
+// layerWidth = produto das dimensões após a primeira
+template <typename ShapeT>
+inline void getLayerDims( const ShapeT& shape, uint64_t& numWeights, uint64_t& layerWidth )
+{
+  numWeights = 1;
+  layerWidth = 1;
+  for( size_t idx = 0; idx < (size_t) shape.size(); idx++ )
+  {
+    numWeights *= (uint64_t) shape[idx];
+    if( idx == 0 ) { continue; }
+    layerWidth *= (uint64_t) shape[idx];
+  }
+}
+
+inline std::vector<LayerSegment> splitLayerIntoSegments( uint64_t numWeights, uint64_t layerWidth, uint64_t maxSegmentWeights = kMaxSegmentWeights )
+{
+  std::vector<LayerSegment> segments;
+  if( numWeights <= maxSegmentWeights )
+  {
+    LayerSegment segment = { 0, (uint32_t) numWeights, (uint32_t) layerWidth, false };
+    segments.push_back( segment );
+    return segments;
+  }
+
+  // Linhas inteiras por segmento (alinhadas a kSegmentRowAlign quando cabem tantas);
+  // linhas maiores que o segmento: fatias 1D
+  uint64_t rowsPerSegment = layerWidth > 0 ? maxSegmentWeights / layerWidth : 0;
+  if( rowsPerSegment >= kSegmentRowAlign ) { rowsPerSegment = rowsPerSegment / kSegmentRowAlign * kSegmentRowAlign; }
+  uint64_t step           = rowsPerSegment > 0 ? rowsPerSegment * layerWidth : maxSegmentWeights;
+  uint32_t segmentWidth   = rowsPerSegment > 0 ? (uint32_t) layerWidth : 1;
+  bool     rowsSplit      = rowsPerSegment == 0 && layerWidth > 0 && numWeights / layerWidth > 1;
+
+  for( uint64_t offset = 0; offset < numWeights; offset += step )
+  {
+    uint64_t count = numWeights - offset < step ? numWeights - offset : step;
+    LayerSegment segment = { offset, (uint32_t) count, segmentWidth, rowsSplit };
+    segments.push_back( segment );
+  }
+  return segments;
+}
+
+// Mesma regra usada para camadas inteiras: sem varredura em blocos para vetores/linha única.
+// Fatias de linhas maiores que o segmento não têm blocos: scan_order > 0 é recusado.
+inline int32_t segmentScanOrder( int32_t scan_order, const LayerSegment& segment )
+{
+  if( segment.rowsSplit && scan_order != 0 )
+  {
+    throw std::invalid_argument( "scan_order > 0 needs whole rows per segment, but the layer has rows longer than "
+                                 "kMaxSegmentWeights weights; code it with scan_order 0" );
+  }
+  if( segment.layerWidth == 1 || segment.numWeights == segment.layerWidth )
+  {
+    return 0;
+  }
+  return scan_order;
+}
+
+#endif // LAYER_SEGMENTS_H
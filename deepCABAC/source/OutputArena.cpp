@@ -0,0 +1,36 @@
+#include "OutputArena.h"
+
+#include <stdexcept>
+
+OutputArena::OutputArena( bool huge_pages )
+  : m_Pool( std::make_shared<BufferPool>( huge_pages ) )
+{
+}
+
+py::array OutputArena::empty( const std::vector<py::ssize_t>& shape, py::object dtypeLike )
+{
+  // O caster de py::dtype só aceita instâncias de dtype; np.float32 é um tipo
+  py::dtype dtype = py::dtype::from_args( dtypeLike );
+  size_t numElements = 1;
+  for( py::ssize_t dim : shape )
+  {
+    if( dim < 0 ) { throw std::invalid_argument( "OutputArena: negative dimension" ); }
+    numElements *= (size_t) dim;
+  }
+  return adopt( allocate( numElements * (size_t) dtype.itemsize() ), shape, dtype );
+}
+
+py::array OutputArena::adopt( const Buffer& buffer, const std::vector<py::ssize_t>& shape, py::dtype dtype )
+{
+  BufferOwner* owner = new BufferOwner;
+  owner->pool   = m_Pool;
+  owner->buffer = buffer;
+
+  py::capsule base( owner, []( void* o )
+  {
+    BufferOwner* owner = static_cast<BufferOwner*>( o );
+    owner->pool->release( owner->buffer );
+    delete owner;
+  } );
+  return py::array( dtype, shape, buffer.ptr, base );
+}
@@ -0,0 +1,45 @@
+#ifndef OUTPUT_ARENA_H
+#define OUTPUT_ARENA_H
+
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+#include <vector>
+#include <memory>
+#include "BufferPool.h"
+
+namespace py = pybind11;
+
+// Pool de buffers de saída reutilizável (qindex da quantização, pesos de rec()).
+// Os arrays NumPy devolvidos apontam para memória do pool; quando um array é
+// liberado pelo Python, o buffer volta para a lista livre do seu tamanho e é
+// reaproveitado na próxima alocação igual, já com as páginas mapeadas.
+class OutputArena
+{
+public:
+  // Buffer bruto do pool, ainda sem array NumPy associado
+  typedef BufferPool::Buffer Buffer;
+
+  explicit OutputArena( bool huge_pages = true );
+  ~OutputArena() {}
+
+  // dtype: qualquer coisa que np.dtype() aceite (np.float32, 'int8', np.dtype(...))
+  py::array empty       ( const std::vector<py::ssize_t>& shape, py::object dtype );
+  Buffer    allocate    ( size_t bytes ) { return m_Pool->allocate( bytes ); } // Não usa o GIL: pode ser chamado pelos workers
+  py::array adopt       ( const Buffer& buffer, const std::vector<py::ssize_t>& shape, py::dtype dtype );
+  void      trim        ()       { m_Pool->trim(); }                // Devolve ao SO os buffers livres
+  size_t    reservedBytes () const { return m_Pool->reservedBytes(); } // Total mapeado (em uso + livre)
+  size_t    pooledBytes   () const { return m_Pool->pooledBytes(); }   // Total livre, pronto para reuso
+  BufferPool* pool      () const { return m_Pool.get(); }           // Para o motor C++ (sem Python)
+
+private:
+  // Base (capsule) de cada array: mantém o pool vivo enquanto o array existir
+  struct BufferOwner
+  {
+    std::shared_ptr<BufferPool> pool;
+    Buffer                      buffer;
+  };
+
+  std::shared_ptr<BufferPool> m_Pool;
+};
+
+#endif // OUTPUT_ARENA_H
@@ -0,0 +1,90 @@
+#ifndef PARALLEL_FOR_H
+#define PARALLEL_FOR_H
+
+#ifndef HAVE_STRUCT_TIMESPEC
+#define HAVE_STRUCT_TIMESPEC 1
+#endif
+#include <pthread.h> // Pthreads
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Resolve o número de threads: valor pedido, ou o número de threads de hardware
+inline int resolve_num_threads(int requested) {
+    if (requested > 0) return requested;
+    int hw = static_cast<int>(std::thread::hardware_concurrency());
+    return hw > 0 ? hw : 12;
+}
+
+// Estado compartilhado de parallel_for_pthreads
+struct ParallelForShared {
+    int num_items;
+    const std::function<void(int, int)>* fn;
+    std::atomic<int> next_item;
+    std::mutex error_mutex;
+    std::string first_error;
+};
+
+struct ParallelForThread {
+    int thread_id;
+    ParallelForShared* shared;
+};
+
+inline void* parallel_for_pthread_worker(void* arg) {
+    ParallelForThread* data = static_cast<ParallelForThread*>(arg);
+    ParallelForShared* shared = data->shared;
+    while (true) {
+        int item = shared->next_item++;
+        if (item >= shared->num_items) break;
+        try {
+            (*shared->fn)(item, data->thread_id);
+        } catch (const std::exception& e) {
+            std::lock_guard<std::mutex> lock(shared->error_mutex);
+            if (shared->first_error.empty()) shared->first_error = e.what();
+        }
+    }
+    return nullptr;
+}
+
+// Executa fn(item, thread_id) para todo item em [0, num_items) usando num_threads
+// pthreads e um contador atômico compartilhado (mesmo esquema de
+// quantize_all_blocks_parallel). A primeira exceção de fn é relançada no final.
+// Não toca no GIL: quem chama deve liberá-lo se fn não usar Python.
+inline void parallel_for_pthreads(int num_items, int num_threads, const std::function<void(int, int)>& fn) {
+    if (num_items <= 0) return;
+    num_threads = std::max(1, std::min(resolve_num_threads(num_threads), num_items));
+
+    ParallelForShared shared;
+    shared.num_items = num_items;
+    shared.fn = &fn;
+    shared.next_item = 0;
+
+    std::vector<pthread_t> threads(num_threads);
+    std::vector<ParallelForThread> thread_data(num_threads);
+    std::vector<bool> launched(num_threads, false);
+    for (int i = 0; i < num_threads; ++i) {
+        thread_data[i].thread_id = i;
+        thread_data[i].shared = &shared;
+        launched[i] = pthread_create(&threads[i], nullptr, parallel_for_pthread_worker, &thread_data[i]) == 0;
+    }
+    bool any_launched = false;
+    for (int i = 0; i < num_threads; ++i) {
+        if (launched[i]) {
+            pthread_join(threads[i], nullptr);
+            any_launched = true;
+        }
+    }
+    if (!any_launched) {
+        parallel_for_pthread_worker(&thread_data[0]); // Sem threads: executa na thread atual
+    }
+    if (!shared.first_error.empty()) {
+        throw std::runtime_error(shared.first_error);
+    }
+}
+
+#endif // PARALLEL_FOR_H
@@ -2,207 +2,187 @@
 #include <pybind11/numpy.h>
 #include <pybind11/stl.h>
 #include <vector>
+#include <algorithm>
 #include <string>
 #include <stdexcept>
-#include <iostream>
-#include <fstream>
-#include <locale>
-#include <iomanip>
-#include <algorithm>
-#include <cmath>
-
-#define HAVE_STRUCT_TIMESPEC 1
-#include <thread>
-#include <pthread.h> // Pthreads
-#include <atomic> 
+#include <cstdlib>
 
 #include <Lib/CommonLib/TypeDef.h>
-#include <Lib/CommonLib/Quant.h>
-#include <Lib/CommonLib/Scan.h> // Se for usar logging CSV
-
-namespace py = pybind11;
-
-// Estrutura BlockQuantInfo (sem mudanças)
-struct BlockQuantInfo {
-    std::string param_name;
-    py::array_t<float32_t, py::array::c_style | py::array::forcecast> weights_array;
-    py::array_t<int32_t, py::array::c_style | py::array::forcecast> qindex_array;
-    uint32_t numWeights;
-    uint32_t layerWidth;
-    float32_t qStepSize;
-    float32_t lambdaScale;
-    uint8_t dq_flag;
-    uint32_t maxNumNoRem;
-    int32_t scan_order;
-    int32_t original_qp;
-    int32_t qpDensity;
-};
-
-// --- ESTRUTURA DE DADOS PARA THREADS (MODIFICADA PARA ATOMIC) ---
-struct ThreadWorkerDataAtomic {
-    int thread_id;
-    const std::vector<BlockQuantInfo>* all_block_infos; // Ponteiro para TODOS os blocos
-    std::vector<int32_t>* all_final_qps;            // Ponteiro para TODOS os resultados
-    std::atomic<int>* next_block_idx_ptr;           // Ponteiro para o contador ATÔMICO compartilhado
-    int total_num_blocks;                           // Número total de blocos (para condição de parada)
-};
-
-// Função Worker (sem mudanças significativas na lógica principal)
-void* quantize_blocks_pthread_worker_atomic(void* arg) {
-    ThreadWorkerDataAtomic* data = static_cast<ThreadWorkerDataAtomic*>(arg);
-
-    // Loop principal da thread: pega e processa blocos até acabar
-    while (true) {
-        // Pega o próximo índice de forma atômica e incrementa o contador
-        int block_idx = (*(data->next_block_idx_ptr))++;
-
-        // Verifica se o índice pego é válido
-        if (block_idx >= data->total_num_blocks) {
-            break; // Não há mais blocos para esta thread, sai do loop
-        }
 
-        // Processa o bloco com o índice obtido
-        const BlockQuantInfo& info = (*(data->all_block_infos))[block_idx];
-
-        // --- Obtém ponteiros  ---
-        float32_t* pWeights = nullptr;
-        int32_t* pQIndex = nullptr;
-        try {
-            py::buffer_info bi_weights = info.weights_array.request(true);
-            py::buffer_info bi_qindex = info.qindex_array.request(true);
-            pWeights = static_cast<float32_t*>(bi_weights.ptr);
-            pQIndex = static_cast<int32_t*>(bi_qindex.ptr);
-        } catch (const std::exception& e) {
-             std::cerr << "[Thread " << data->thread_id << "] ERRO buffers NumPy para " << info.param_name << " (idx=" << block_idx << "): " << e.what() << std::endl;
-             continue; // Pula este bloco, tenta pegar o próximo
+#include "ParallelQuant.h"
+#include "QuantEngine.h"
+
+// Lê um bloco do dicionário Python (precisa do GIL). Com allocate_qindex, usa o
+// "qindex" fornecido ou aloca a saída int32 (exceto blocos estreitados pelo worker).
+BlockQuantInfo extract_block_quant_info(py::dict block_dict, const ParallelQuantOptions& options, bool allocate_qindex) {
+    BlockQuantInfo info;
+
+    info.param_name = block_dict["param_name"].cast<std::string>();
+    info.weights_array = block_dict["weights"].cast<py::array_t<float32_t, py::array::c_style | py::array::forcecast>>();
+    py::buffer_info bi_weights = info.weights_array.request();
+    info.numWeights = 1; info.layerWidth = 1;
+    for (py::ssize_t i = 0; i < bi_weights.ndim; ++i) { info.numWeights *= bi_weights.shape[i]; if (i > 0) info.layerWidth *= bi_weights.shape[i];}
+    if (bi_weights.ndim <= 1) info.layerWidth = 1;
+    info.shape.assign(bi_weights.shape.begin(), bi_weights.shape.end());
+    info.pWeights = static_cast<float32_t*>(bi_weights.ptr);
+    info.pReference = nullptr;
+    if (block_dict.contains("reference") && !block_dict["reference"].is_none()) {
+        info.reference_array = block_dict["reference"].cast<py::array_t<float32_t, py::array::c_style | py::array::forcecast>>();
+        py::buffer_info bi_reference = info.reference_array.request();
+        if (static_cast<uint64_t>(bi_reference.size) != info.numWeights) {
+            throw std::runtime_error("reference de " + info.param_name + " não tem o mesmo número de elementos que os pesos");
         }
-        // --- Fim da obtenção de ponteiros ---
-
-        int32_t current_qp = info.original_qp;
-        float32_t current_qStepSize = info.qStepSize;
-
-        // Chamada quantize
-        int32_t success = quantize(
-            pWeights,               // Ponteiro para os pesos originais
-            pQIndex,                // Ponteiro para o array onde os níveis serão escritos
-            current_qStepSize,      // O qStep calculado (pode ter sido ajustado)
-            info.layerWidth,        // O stride
-            info.numWeights,        // O número total de pesos
-            DIST_MSE,               // O tipo de distorção (assumindo MSE como antes)
-            info.lambdaScale,       // O fator lambda
-            info.dq_flag,           // O flag TCQ/URQ
-            info.maxNumNoRem,       // Parâmetro do CABAC
-            info.scan_order         // A ordem de varredura
-        );
-
-        // Lógica de ajuste de QP
-        if (!success) {
-             if (!success) {
-                  // Protege escrita concorrente no cerr
-                 #pragma omp critical // Usa pragma omp critical mesmo sem omp parallel for
-                 {
-                     std::cerr << "[Thread " << data->thread_id << "] ERRO FATAL: Overflow para " << info.param_name << " mesmo após ajuste!" << std::endl;
-                 }
-             }
+        info.pReference = static_cast<const float32_t*>(bi_reference.ptr);
+    }
+    info.pQIndex = nullptr;
+    // Sem "qindex" pré-alocado, a saída é alocada aqui sem ser zerada: as páginas
+    // só são tocadas pela thread que quantiza o bloco (first-touch no nó dela).
+    // Com narrow_qindex, quem aloca é o próprio worker, já no tipo estreito.
+    bool has_qindex = block_dict.contains("qindex") && !block_dict["qindex"].is_none();
+    bool narrow_block = !has_qindex && options.narrow_qindex;
+    if (!allocate_qindex) {
+        // Saída fornecida por quem chama (ex.: pipeline com buffers próprios)
+    } else if (has_qindex) {
+        info.qindex_array = block_dict["qindex"].cast<py::array_t<int32_t, py::array::c_style | py::array::forcecast>>();
+        info.caller_qindex = true;
+    } else if (narrow_block) {
+        // Alocado pelo worker
+    } else if (options.arena != nullptr) {
+        info.qindex_array = options.arena->empty(bi_weights.shape, py::dtype::of<int32_t>());
+    } else {
+        info.qindex_array = py::array_t<int32_t, py::array::c_style | py::array::forcecast>(bi_weights.shape);
+    }
+    if (allocate_qindex && !narrow_block) {
+        py::buffer_info bi_qindex = info.qindex_array.request(true);
+        if (static_cast<uint64_t>(bi_qindex.size) != info.numWeights) {
+            throw std::runtime_error("qindex de " + info.param_name + " não tem o mesmo número de elementos que os pesos");
         }
+        info.pQIndex = static_cast<int32_t*>(bi_qindex.ptr);
+    }
+    info.qStepSize = block_dict["qStepSize"].cast<float32_t>();
+    info.lambdaScale = block_dict["lambdaScale"].cast<float32_t>();
+    info.dq_flag = block_dict["dq_flag"].cast<uint8_t>();
+    info.maxNumNoRem = block_dict["maxNumNoRem"].cast<uint32_t>();
+    info.scan_order = block_dict["scan_order"].cast<int32_t>();
+    info.original_qp = block_dict["qp"].cast<int32_t>();
+    info.qpDensity = block_dict["qpDensity"].cast<int32_t>();
+    if (info.layerWidth == 1 || info.numWeights == info.layerWidth) info.scan_order = 0;
+
+    return info;
+}
 
-        // Escreve o QP final
-        (*(data->all_final_qps))[block_idx] = current_qp;
-
-        // --- Logging CSV (Opcional) ---
-    } // Fim do loop sobre block_indices_to_process
+// Vista somente leitura de um qindex: cada tensor recebe o próprio objeto, e escrever
+// num duplicado (ou no original) não muda os níveis dos outros em silêncio
+static py::array read_only_view(const py::array& levels) {
+    py::array view = levels.attr("view")().cast<py::array>();
+    view.attr("setflags")(py::arg("write") = false);
+    return view;
+}
 
-    pthread_exit(nullptr);
-    return nullptr;
+// Cópia dos níveis para um duplicado cujo original escreveu no "qindex" de quem
+// chamou (esse array não pode ser congelado)
+static py::array copy_of_levels(const py::array& levels) {
+    return levels.attr("copy")().cast<py::array>();
 }
 
+// Copia numWeights níveis (int8/int16/int32) de source para dst em int32
+static void copy_levels(const py::array& source, int32_t* dst, uint64_t numWeights) {
+    py::buffer_info bi_source = source.request();
+    if (static_cast<uint64_t>(bi_source.size) != numWeights) {
+        throw std::runtime_error("qindex do duplicado não tem o mesmo número de elementos que o original");
+    }
+    py::gil_scoped_release release_gil;
+    switch (bi_source.itemsize) {
+        case 1: { const int8_t* src = static_cast<const int8_t*>(bi_source.ptr); std::copy(src, src + numWeights, dst); break; }
+        case 2: { const int16_t* src = static_cast<const int16_t*>(bi_source.ptr); std::copy(src, src + numWeights, dst); break; }
+        default: { const int32_t* src = static_cast<const int32_t*>(bi_source.ptr); std::copy(src, src + numWeights, dst); break; }
+    }
+}
 
-py::list quantize_all_blocks_parallel_pthreads(py::list py_block_info_list) {
+py::list quantize_all_blocks_parallel_pthreads(py::list py_block_info_list, const ParallelQuantOptions& options) {
 
     // 1. Extrair informações do Python
     std::vector<BlockQuantInfo> block_infos;
-    std::vector<int32_t> final_qps;
     try {
         block_infos.reserve(py_block_info_list.size());
         for (const auto& item : py_block_info_list) {
-            py::dict block_dict = item.cast<py::dict>();
-            BlockQuantInfo info; // <-- Declarada dentro do loop
-
-            info.param_name = block_dict["param_name"].cast<std::string>();
-            info.weights_array = block_dict["weights"].cast<py::array_t<float32_t, py::array::c_style | py::array::forcecast>>();
-            info.qindex_array = block_dict["qindex"].cast<py::array_t<int32_t, py::array::c_style | py::array::forcecast>>();
-            py::buffer_info bi_weights = info.weights_array.request();
-            info.numWeights = 1; info.layerWidth = 1;
-            for (py::ssize_t i = 0; i < bi_weights.ndim; ++i) { info.numWeights *= bi_weights.shape[i]; if (i > 0) info.layerWidth *= bi_weights.shape[i];}
-            if (bi_weights.ndim <= 1) info.layerWidth = 1;
-            info.qStepSize = block_dict["qStepSize"].cast<float32_t>();
-            info.lambdaScale = block_dict["lambdaScale"].cast<float32_t>();
-            info.dq_flag = block_dict["dq_flag"].cast<uint8_t>();
-            info.maxNumNoRem = block_dict["maxNumNoRem"].cast<uint32_t>();
-            info.scan_order = block_dict["scan_order"].cast<int32_t>();
-            info.original_qp = block_dict["qp"].cast<int32_t>();
-            info.qpDensity = block_dict["qpDensity"].cast<int32_t>();
-            if (info.layerWidth == 1 || info.numWeights == info.layerWidth) info.scan_order = 0;
-
+            BlockQuantInfo info = extract_block_quant_info(item.cast<py::dict>(), options, true); // <-- Declarada dentro do loop
             block_infos.push_back(std::move(info)); // push_back DENTRO do loop
         }
-        final_qps.resize(block_infos.size());
     } catch (const std::exception& e) {
         py::gil_scoped_acquire acquire_gil;
         throw std::runtime_error(std::string("Erro ao extrair dados do Python: ") + e.what());
     }
 
-    // --- Gerenciamento de Threads Pthreads com Contador Atômico ---
     int num_blocks = static_cast<int>(block_infos.size());
     if (num_blocks == 0) return py::list();
 
-    int num_threads = std::thread::hardware_concurrency(); 
-    if (num_threads == 0) { // Fallback se a detecção falhar
-        num_threads = 12; // Ou um valor padrão razoável como 8
-        std::cout << "[Pthreads] Aviso: Não foi possível detectar o número de núcleos, usando " << num_threads << " threads." << std::endl;
-    } else {
-         std::cout << "[Pthreads] Detectado " << num_threads << " threads de hardware." << std::endl;
-         // Você pode optar por usar todos ou limitar (ex: num_threads = std::max(1, num_threads - 1); // deixa um núcleo livre)
+    // 2. Quantização no motor C++ (QuantEngine), sem o GIL
+    QuantEngineOptions engine_options;
+    engine_options.num_threads = options.num_threads;
+    engine_options.numa = options.numa;
+    engine_options.pool = options.arena != nullptr ? options.arena->pool() : nullptr;
+    engine_options.coalesce_target_weights = options.coalesce_target_weights;
+    engine_options.cache_dir = options.cache_dir;
+    engine_options.dedup = options.dedup;
+    engine_options.tuning_profile = options.tuning_profile;
+    engine_options.calibrate = options.calibrate;
+    engine_options.max_memory_bytes = options.max_memory_bytes;
+
+    std::vector<QuantBlock> blocks(block_infos.begin(), block_infos.end());
+    QuantEngineResult engine_result;
+    {
+        py::gil_scoped_release release_gil;
+        quantize_blocks_parallel(blocks, engine_options, engine_result);
     }
-    std::cout << "[Pthreads Atomic] Usando " << num_threads << " threads para " << num_blocks << " blocos." << std::endl;
-    std::vector<pthread_t> threads(num_threads);
-    std::vector<ThreadWorkerDataAtomic> thread_worker_data(num_threads);
-    std::atomic<int> next_block_idx(0);
-    std::vector<std::vector<int>> block_indices_per_thread(num_threads);
-    std::vector<bool> thread_launched_successfully(num_threads, false); 
-    py::gil_scoped_release release_gil;
+    std::vector<int32_t>& final_qps = engine_result.final_qps;
+    const std::vector<NarrowQIndex>& narrow_qindex = engine_result.narrow_qindex;
+    const std::vector<int>& duplicate_of = engine_result.duplicate_of;
 
-    // Lança as threads
-    for (int i = 0; i < num_threads; ++i) {
-        // Preenche a estrutura de dados para esta thread
-        thread_worker_data[i].thread_id = i;
-        thread_worker_data[i].all_block_infos = &block_infos;
-        thread_worker_data[i].all_final_qps = &final_qps;
-        thread_worker_data[i].next_block_idx_ptr = &next_block_idx; // Passa ponteiro p/ contador
-        thread_worker_data[i].total_num_blocks = num_blocks;       // Passa o total de blocos
-
-        // Cria a thread, passando a nova função worker
-        int rc = pthread_create(&threads[i], nullptr, quantize_blocks_pthread_worker_atomic, &thread_worker_data[i]);
-        if (rc == 0) { // Sucesso na criação
-             thread_launched_successfully[i] = true; // Marca como sucesso
+    // Embrulha as saídas estreitadas em arrays NumPy (o array passa a ser dono do buffer)
+    for (int i = 0; i < num_blocks; ++i) {
+        if (block_infos[i].pQIndex != nullptr || duplicate_of[i] >= 0) continue;
+        const NarrowQIndex& narrow = narrow_qindex[i];
+        if (narrow.ptr == nullptr) {
+            throw std::runtime_error("Falha ao produzir o qindex estreito de " + block_infos[i].param_name);
+        }
+        py::dtype dtype = narrow.itemsize == 1 ? py::dtype::of<int8_t>() : (narrow.itemsize == 2 ? py::dtype::of<int16_t>() : py::dtype::of<int32_t>());
+        std::vector<py::ssize_t> shape(block_infos[i].shape.begin(), block_infos[i].shape.end());
+        if (narrow.from_pool) {
+            OutputArena::Buffer buffer;
+            buffer.ptr = narrow.ptr;
+            buffer.bytes = narrow.bytes;
+            block_infos[i].qindex_array = options.arena->adopt(buffer, shape, dtype);
         } else {
-             #pragma omp critical // Protege cerr
-             {
-                std::cerr << "ERRO: pthread_create falhou para thread " << i << " com código " << rc << std::endl;
-             }
+            py::capsule owner(narrow.ptr, [](void* p) { std::free(p); });
+            block_infos[i].qindex_array = py::array(dtype, shape, narrow.ptr, owner);
         }
     }
 
-    // Espera (Join) as threads terminarem
-    std::cout << "[Pthreads Atomic] Esperando threads terminarem..." << std::endl;
-    for (int i = 0; i < num_threads; ++i) {
-         // Usa o flag booleano para decidir se faz join
-         if (thread_launched_successfully[i]) {
-            pthread_join(threads[i], nullptr);
-         }
+    // Duplicados recebem os níveis do original (que vem sempre antes na lista):
+    // - com "qindex" de quem chamou, esse array recebe uma cópia dos níveis;
+    // - sem, uma vista somente leitura dos níveis do original, que também é congelado
+    //   (ninguém mais o escreveu); se o qindex do original for de quem chamou, uma cópia.
+    std::vector<char> shared(num_blocks, 0);
+    for (int i = 0; i < num_blocks; ++i) {
+        if (duplicate_of[i] < 0 || block_infos[i].caller_qindex) continue;
+        if (!block_infos[duplicate_of[i]].caller_qindex) shared[duplicate_of[i]] = 1;
+    }
+    for (int i = 0; i < num_blocks; ++i) {
+        if (shared[i]) block_infos[i].qindex_array = read_only_view(block_infos[i].qindex_array);
+    }
+    for (int i = 0; i < num_blocks; ++i) {
+        if (duplicate_of[i] < 0) continue;
+        const BlockQuantInfo& original = block_infos[duplicate_of[i]];
+        final_qps[i] = final_qps[duplicate_of[i]];
+        if (block_infos[i].caller_qindex) {
+            copy_levels(original.qindex_array, block_infos[i].pQIndex, block_infos[i].numWeights);
+        } else if (original.caller_qindex) {
+            block_infos[i].qindex_array = copy_of_levels(original.qindex_array);
+        } else {
+            block_infos[i].qindex_array = read_only_view(original.qindex_array);
+        }
     }
-    std::cout << "[Pthreads Atomic] Todas as threads terminaram." << std::endl;
-    py::gil_scoped_acquire acquire_gil;
 
     // Monta a lista de resultados
     py::list py_results;
@@ -210,7 +190,13 @@ py::list quantize_all_blocks_parallel_pthreads(py::list py_block_info_list) {
         py::dict result_dict;
         result_dict["param_name"] = block_infos[i].param_name;
         result_dict["final_qp"] = final_qps[i];
+        result_dict["qindex"] = block_infos[i].qindex_array;
         result_dict["dq_flag"] = block_infos[i].dq_flag;
+        if (duplicate_of[i] >= 0) {
+            result_dict["duplicate_of"] = block_infos[duplicate_of[i]].param_name;
+        } else {
+            result_dict["duplicate_of"] = py::none();
+        }
         py_results.append(result_dict);
     }
     return py_results;
@@ -0,0 +1,49 @@
+#ifndef PARALLEL_QUANT_H
+#define PARALLEL_QUANT_H
+
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <Lib/CommonLib/TypeDef.h>
+#include "OutputArena.h"
+#include "QuantEngine.h"
+
+namespace py = pybind11;
+
+// Opções da quantização paralela vindas do Python (quantize_all_blocks_parallel);
+// convertidas para QuantEngineOptions antes de chamar o motor
+struct ParallelQuantOptions {
+    int  num_threads;   // 0 = usa std::thread::hardware_concurrency()
+    bool numa;          // Fixa os workers por nó NUMA e distribui os blocos entre os nós
+    OutputArena* arena; // Se não nulo, os qindex alocados em C++ vêm deste pool reutilizável
+    bool narrow_qindex; // qindex alocados em C++ no menor tipo suficiente (int8/int16/int32) por bloco
+    uint64_t coalesce_target_weights; // Blocos menores que isso são agrupados em itens de até esse total (0 = desliga, kCoalesceTargetAuto = perfil)
+    std::string cache_dir;  // Se não vazio, diretório (já existente) do cache de blocos quantizados
+    bool dedup;             // Quantiza uma só vez blocos idênticos (mesmo buffer ou mesmo conteúdo)
+    std::string tuning_profile; // Perfil de ajuste (vazio = caminho padrão); usado com num_threads == 0
+    bool calibrate;         // Calibra nos próprios blocos e grava o perfil antes de quantizar
+    uint64_t max_memory_bytes; // Orçamento de memória de trabalho dos itens em andamento (0 = sem limite)
+
+    ParallelQuantOptions() : num_threads(0), numa(false), arena(nullptr), narrow_qindex(false), coalesce_target_weights(kCoalesceTargetAuto), dedup(false), calibrate(false),
+                             max_memory_bytes(0) {}
+};
+
+// Bloco a quantizar, lido do dicionário Python de quantize_all_blocks_parallel.
+// Os ponteiros de QuantBlock são obtidos com o GIL, antes de lançar as threads,
+// e os arrays abaixo os mantêm vivos.
+struct BlockQuantInfo : QuantBlock {
+    py::array_t<float32_t, py::array::c_style | py::array::forcecast> weights_array;
+    py::array_t<float32_t, py::array::c_style | py::array::forcecast> reference_array; // Só no modo delta
+    py::array qindex_array;         // int32, ou int8/int16/int32 com narrow_qindex
+    bool caller_qindex;             // qindex_array veio de quem chamou ("qindex" no dicionário)
+
+    BlockQuantInfo() : caller_qindex(false) {}
+};
+
+BlockQuantInfo extract_block_quant_info(py::dict block_dict, const ParallelQuantOptions& options, bool allocate_qindex);
+
+py::list quantize_all_blocks_parallel_pthreads(py::list py_block_info_list, const ParallelQuantOptions& options);
+
+#endif // PARALLEL_QUANT_H
@@ -0,0 +1,177 @@
+#include <pybind11/pybind11.h>
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <iostream>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <algorithm>
+
+#include "Pipeline.h"
+#include "ParallelFor.h"
+
+// Estado compartilhado entre as threads de quantização (produtoras) e o estágio de
+// codificação (consumidor). O bloco i só pode começar a ser quantizado quando
+// i < next_to_encode + window (window = threads + max_queued_blocks: um bloco em
+// quantização por thread e até max_queued_blocks prontos na fila), então há no máximo
+// window buffers vivos: o bloco i usa o buffer i % window, liberado quando o bloco
+// i - window foi codificado.
+struct PipelineShared {
+    const std::vector<BlockQuantInfo>* block_infos;
+    int num_blocks;
+    int window;
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    int next_to_quantize;
+    int next_to_encode;
+    bool aborted;                   // Erro num dos estágios: ninguém começa blocos novos
+    std::exception_ptr error;       // Primeira exceção (quantização ou codificação), relançada depois do join
+    std::vector<char> ready;
+    std::vector<int32_t> quantize_ok;
+    std::vector<std::vector<int32_t>> slots;
+};
+
+struct PipelineThreadData {
+    int thread_id;
+    PipelineShared* shared;
+};
+
+void* pipeline_quantize_worker(void* arg) {
+    PipelineThreadData* data = static_cast<PipelineThreadData*>(arg);
+    PipelineShared& shared = *(data->shared);
+
+    while (true) {
+        int block_idx;
+        {
+            std::unique_lock<std::mutex> lock(shared.mutex);
+            shared.cond.wait(lock, [&shared] {
+                return shared.aborted || shared.next_to_quantize >= shared.num_blocks ||
+                       shared.next_to_quantize < shared.next_to_encode + shared.window;
+            });
+            if (shared.aborted || shared.next_to_quantize >= shared.num_blocks) break;
+            block_idx = shared.next_to_quantize++;
+        }
+
+        // Só esta thread usa o buffer do bloco até ele ser marcado como pronto
+        const BlockQuantInfo& info = (*shared.block_infos)[block_idx];
+        int32_t success = 0;
+        try {
+            std::vector<int32_t>& slot = shared.slots[block_idx % shared.window];
+            slot.resize(info.numWeights);
+            success = quantize_block_levels(info, slot.data());
+        } catch (...) {
+            // Sem relançar aqui (a exceção não pode sair da pthread): o estágio de
+            // codificação acorda com aborted e a exceção é relançada depois do join
+            {
+                std::lock_guard<std::mutex> lock(shared.mutex);
+                if (!shared.error) shared.error = std::current_exception();
+                shared.aborted = true;
+            }
+            shared.cond.notify_all();
+            break;
+        }
+        if (!success) {
+            std::cerr << "[Thread " << data->thread_id << "] ERRO FATAL: Overflow para " << info.param_name << " mesmo após ajuste!" << std::endl;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(shared.mutex);
+            shared.quantize_ok[block_idx] = success;
+            shared.ready[block_idx] = 1;
+        }
+        shared.cond.notify_all();
+    }
+    return nullptr;
+}
+
+py::list quantize_and_encode_pipelined(py::list py_block_info_list, const EncodeStageFn& encode_stage, const PipelineOptions& options) {
+
+    // 1. Extrair informações do Python (sem alocar qindex: o pipeline usa buffers próprios)
+    ParallelQuantOptions extract_options;
+    std::vector<BlockQuantInfo> block_infos;
+    block_infos.reserve(py_block_info_list.size());
+    for (const auto& item : py_block_info_list) {
+        block_infos.push_back(extract_block_quant_info(item.cast<py::dict>(), extract_options, false));
+    }
+    int num_blocks = static_cast<int>(block_infos.size());
+    if (num_blocks == 0) return py::list();
+
+    PipelineShared shared;
+    shared.block_infos = &block_infos;
+    shared.num_blocks = num_blocks;
+    // Threads pedidas (não mais que blocos); a fila limita só os blocos prontos em espera
+    int num_threads = std::max(1, std::min(resolve_num_threads(options.num_threads), num_blocks));
+    int max_queued = std::max(0, options.max_queued_blocks);
+    shared.window = num_threads + max_queued;
+    shared.next_to_quantize = 0;
+    shared.next_to_encode = 0;
+    shared.aborted = false;
+    shared.ready.assign(num_blocks, 0);
+    shared.quantize_ok.assign(num_blocks, 0);
+    shared.slots.resize(std::min(shared.window, num_blocks));
+
+    std::cout << "[Pthreads Pipeline] " << num_threads << " threads de quantização, até " << max_queued
+              << " blocos em fila, " << num_blocks << " blocos." << std::endl;
+
+    std::vector<uint32_t> encode_results(num_blocks, 0);
+    bool any_launched = false;
+    {
+        py::gil_scoped_release release_gil;
+
+        std::vector<pthread_t> threads(num_threads);
+        std::vector<PipelineThreadData> thread_data(num_threads);
+        std::vector<bool> launched(num_threads, false);
+        for (int i = 0; i < num_threads; ++i) {
+            thread_data[i].thread_id = i;
+            thread_data[i].shared = &shared;
+            launched[i] = pthread_create(&threads[i], nullptr, pipeline_quantize_worker, &thread_data[i]) == 0;
+            any_launched = any_launched || launched[i];
+        }
+
+        // Estágio de codificação: consome os blocos na ordem da lista
+        for (int block_idx = 0; block_idx < num_blocks && any_launched; ++block_idx) {
+            {
+                std::unique_lock<std::mutex> lock(shared.mutex);
+                shared.cond.wait(lock, [&shared, block_idx] { return shared.aborted || shared.ready[block_idx] != 0; });
+                if (shared.aborted) break;
+            }
+            bool failed = false;
+            try {
+                encode_results[block_idx] = encode_stage(block_infos[block_idx], shared.slots[block_idx % shared.window].data());
+            } catch (...) {
+                failed = true;
+                std::lock_guard<std::mutex> lock(shared.mutex);
+                if (!shared.error) shared.error = std::current_exception();
+                shared.aborted = true;
+            }
+            {
+                std::lock_guard<std::mutex> lock(shared.mutex);
+                shared.next_to_encode = block_idx + 1;
+            }
+            shared.cond.notify_all();
+            if (failed) break;
+        }
+
+        for (int i = 0; i < num_threads; ++i) {
+            if (launched[i]) pthread_join(threads[i], nullptr);
+        }
+    }
+    // Com o GIL de volta: relança a exceção original do estágio que falhou
+    if (shared.error) std::rethrow_exception(shared.error);
+    if (!any_launched) throw std::runtime_error("Erro no pipeline de codificação: pthread_create falhou para todas as threads do pipeline");
+
+    // Monta a lista de resultados
+    py::list py_results;
+    for (int i = 0; i < num_blocks; ++i) {
+        py::dict result_dict;
+        result_dict["param_name"] = block_infos[i].param_name;
+        result_dict["final_qp"] = block_infos[i].original_qp;
+        result_dict["dq_flag"] = block_infos[i].dq_flag;
+        result_dict["quantize_ok"] = shared.quantize_ok[i] != 0;
+        result_dict["encode_result"] = encode_results[i];
+        py_results.append(result_dict);
+    }
+    return py_results;
+}
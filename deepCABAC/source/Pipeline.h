@@ -0,0 +1,24 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <pybind11/pybind11.h>
+#include <functional>
+#include "ParallelQuant.h"
+
+namespace py = pybind11;
+
+// Opções do pipeline quantização -> codificação (quantize_and_encode_pipelined)
+struct PipelineOptions {
+    int num_threads;        // Threads de quantização (0 = std::thread::hardware_concurrency())
+    int max_queued_blocks;  // Máximo de blocos já quantizados esperando a codificação (além de um em quantização por thread)
+
+    PipelineOptions() : num_threads(0), max_queued_blocks(4) {}
+};
+
+// Estágio de codificação: recebe os níveis int32 de cada bloco, na ordem da lista.
+// Roda sem o GIL, na thread que chamou o pipeline.
+typedef std::function<uint32_t(const BlockQuantInfo& info, int32_t* pQIndex)> EncodeStageFn;
+
+py::list quantize_and_encode_pipelined(py::list py_block_info_list, const EncodeStageFn& encode_stage, const PipelineOptions& options);
+
+#endif // PIPELINE_H
@@ -0,0 +1,711 @@
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <memory>
+#include <map>
+#include <unordered_map>
+#include <cstring>
+
+#ifndef HAVE_STRUCT_TIMESPEC
+#define HAVE_STRUCT_TIMESPEC 1
+#endif
+#include <thread>
+#include <pthread.h> // Pthreads
+#include <atomic> 
+#include <mutex>
+#include <condition_variable>
+
+#include <Lib/CommonLib/TypeDef.h>
+#include <Lib/CommonLib/Quant.h>
+
+#include "QuantEngine.h"
+#include "ParallelFor.h"
+#include "BlockCache.h"
+#include "AutoTune.h"
+#include "LayerCoder.h"
+
+// Um segmento de um bloco (blocos com até kMaxSegmentWeights pesos têm um só)
+struct BlockSegment {
+    int block_idx;
+    LayerSegment segment;
+};
+
+// Unidade de trabalho pega pelas threads: um segmento grande, ou vários segmentos
+// pequenos consecutivos agrupados até coalesce_target_weights pesos
+struct WorkItem {
+    int first_segment;      // Índice em all_segments
+    int num_segments;
+    uint64_t numWeights;    // Soma dos pesos dos segmentos (usada no balanceamento NUMA)
+};
+
+// Fila de trabalho de um nó NUMA (uma única fila quando o modo NUMA está desligado)
+struct NodeWorkQueue {
+    std::vector<int> item_indices;    // Itens atribuídos a este nó, na ordem de processamento
+    std::atomic<int> next;            // Próxima posição livre em item_indices
+
+    NodeWorkQueue() : next(0) {}
+};
+
+// Estimativas (conservadoras) dos temporários de quantize() por peso: no URQ, a cópia
+// reordenada pela varredura; no TCQ, também os custos e decisões da treliça de 8 estados
+static const uint64_t kQuantWorkBytesPerWeightURQ = 8;
+static const uint64_t kQuantWorkBytesPerWeightTCQ = 48;
+
+// Admissão por orçamento de memória (max_memory_bytes > 0). Substitui os contadores
+// atômicos das filas: as threads andam pelas mesmas filas, sob o mutex, e pegam o
+// primeiro item ainda livre cuja estimativa cabe no que sobra do orçamento.
+struct MemoryAdmission {
+    std::mutex mutex;
+    std::condition_variable released;   // Sinalizado quando um item termina e devolve sua memória
+    uint64_t budget;
+    uint64_t in_use;                    // Soma das estimativas dos itens em andamento
+    uint64_t peak;                      // Maior in_use durante a chamada
+    std::vector<uint64_t> item_bytes;   // Estimativa de cada item
+    std::vector<char> taken;            // Item já pego por alguma thread
+    std::vector<size_t> first_open;     // Por nó: posições anteriores de item_indices já foram todas pegas
+
+    MemoryAdmission() : budget(0), in_use(0), peak(0) {}
+};
+
+// --- ESTRUTURA DE DADOS PARA THREADS (MODIFICADA PARA ATOMIC) ---
+struct ThreadWorkerDataAtomic {
+    int thread_id;
+    int numa_node;                                  // Nó cuja fila esta thread consome primeiro
+    const std::vector<QuantBlock>* all_blocks; // Ponteiro para TODOS os blocos
+    const std::vector<BlockSegment>* all_segments;  // Segmentos de todos os blocos
+    const std::vector<WorkItem>* all_work_items;    // Agrupamentos de segmentos
+    std::vector<int32_t>* all_final_qps;            // Ponteiro para TODOS os resultados
+    std::vector<char>* segment_failed;              // Por segmento: quantize() falhou (escrito só pela thread que o quantizou)
+    std::vector<NodeWorkQueue>* node_queues;        // Filas por nó (contadores ATÔMICOS compartilhados)
+    std::vector<NarrowQIndex>* all_narrow_qindex;   // Saídas estreitadas (só com narrow_qindex)
+    std::vector<NarrowQIndex>* segment_narrow_qindex; // Por segmento: partes estreitadas de blocos com vários segmentos
+    BufferPool* pool;                               // Pool para as saídas estreitadas (pode ser nulo)
+    MemoryAdmission* admission;                     // Orçamento de memória (nulo = sem limite)
+    ScratchArena* scratch;                          // Arena emprestada pelo worker: níveis int32 antes do estreitamento e delta
+};
+
+// Copia os níveis para o tipo estreito escolhido
+template <typename T>
+static void narrow_levels(const int32_t* src, void* dst, uint32_t n) {
+    T* out = static_cast<T*>(dst);
+    for (uint32_t i = 0; i < n; ++i) out[i] = static_cast<T>(src[i]);
+}
+
+// Alarga níveis estreitados para um tipo de mesmo tamanho ou maior (int32 na gravação no cache)
+template <typename T, typename D>
+static void widen_levels(const void* src, D* dst, uint64_t n) {
+    const T* in = static_cast<const T*>(src);
+    for (uint64_t i = 0; i < n; ++i) dst[i] = static_cast<D>(in[i]);
+}
+
+template <typename D>
+static void widen_narrow(const NarrowQIndex& src, D* dst, uint64_t n) {
+    switch (src.itemsize) {
+        case 1:  widen_levels<int8_t>(src.ptr, dst, n); break;
+        case 2:  widen_levels<int16_t>(src.ptr, dst, n); break;
+        default: widen_levels<int32_t>(src.ptr, dst, n); break;
+    }
+}
+
+// Buffer sem inicializar para n níveis de itemsize bytes (pool ou malloc)
+static NarrowQIndex allocate_narrow_qindex(uint64_t n, int itemsize, BufferPool* pool) {
+    NarrowQIndex out;
+    out.itemsize = itemsize;
+    size_t bytes = static_cast<size_t>(n) * itemsize;
+    if (pool != nullptr) {
+        BufferPool::Buffer buffer = pool->allocate(bytes);
+        out.ptr = buffer.ptr;
+        out.bytes = buffer.bytes;
+        out.from_pool = true;
+    } else {
+        out.ptr = std::malloc(bytes > 0 ? bytes : 1);
+        out.bytes = bytes;
+        if (out.ptr == nullptr) throw std::bad_alloc();
+    }
+    return out;
+}
+
+// Escolhe o menor tipo inteiro que representa todos os níveis e copia para um buffer novo
+static NarrowQIndex make_narrow_qindex(const int32_t* levels, uint32_t n, BufferPool* pool) {
+    int32_t max_level = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+        int32_t level = levels[i] < 0 ? -levels[i] : levels[i];
+        if (level > max_level) max_level = level;
+    }
+    int itemsize = max_level <= std::numeric_limits<int8_t>::max() ? 1 : (max_level <= std::numeric_limits<int16_t>::max() ? 2 : 4);
+    NarrowQIndex out = allocate_narrow_qindex(n, itemsize, pool);
+    switch (out.itemsize) {
+        case 1:  narrow_levels<int8_t>(levels, out.ptr, n); break;
+        case 2:  narrow_levels<int16_t>(levels, out.ptr, n); break;
+        default: narrow_levels<int32_t>(levels, out.ptr, n); break;
+    }
+    return out;
+}
+
+// Dois blocos dão o mesmo qindex e o mesmo QP no bitstream se tiverem os mesmos
+// parâmetros de quantização e shape
+static bool same_quant_params(const QuantBlock& a, const QuantBlock& b) {
+    return a.shape == b.shape && a.layerWidth == b.layerWidth && a.qStepSize == b.qStepSize &&
+           a.lambdaScale == b.lambdaScale && a.dq_flag == b.dq_flag && a.maxNumNoRem == b.maxNumNoRem &&
+           a.scan_order == b.scan_order && a.original_qp == b.original_qp && a.qpDensity == b.qpDensity &&
+           (a.pReference == nullptr) == (b.pReference == nullptr);
+}
+
+// ... e os mesmos pesos (e referência, no modo delta), por ponteiro ou conteúdo
+static bool same_block_content(const QuantBlock& a, const QuantBlock& b) {
+    if (!same_quant_params(a, b)) return false;
+    size_t bytes = a.numWeights * sizeof(float32_t);
+    bool same_weights = a.pWeights == b.pWeights || std::memcmp(a.pWeights, b.pWeights, bytes) == 0;
+    bool same_reference = a.pReference == b.pReference || std::memcmp(a.pReference, b.pReference, bytes) == 0;
+    return same_weights && same_reference;
+}
+
+// Interpreta listas de CPUs/nós no formato do Linux ("0-15,32-47")
+static std::vector<int> parse_cpu_list(const std::string& text) {
+    std::vector<int> ids;
+    std::stringstream ss(text);
+    std::string range;
+    while (std::getline(ss, range, ',')) {
+        if (range.empty() || range[0] == '\n') continue;
+        size_t dash = range.find('-');
+        int first = std::atoi(range.c_str());
+        int last = (dash == std::string::npos) ? first : std::atoi(range.c_str() + dash + 1);
+        for (int id = first; id <= last; ++id) ids.push_back(id);
+    }
+    return ids;
+}
+
+// Lê a topologia NUMA de /sys. Retorna as CPUs de cada nó com CPUs;
+// vazio se a topologia não estiver disponível (ex.: Windows).
+static std::vector<std::vector<int>> detect_numa_nodes() {
+    std::vector<std::vector<int>> nodes;
+#ifdef __linux__
+    std::ifstream online("/sys/devices/system/node/online");
+    std::string line;
+    if (!online || !std::getline(online, line)) return nodes;
+    for (int node : parse_cpu_list(line)) {
+        std::ifstream cpulist("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        std::string cpus;
+        if (!cpulist || !std::getline(cpulist, cpus)) continue;
+        std::vector<int> node_cpus = parse_cpu_list(cpus);
+        if (!node_cpus.empty()) nodes.push_back(node_cpus); // Ignora nós só de memória
+    }
+#endif
+    return nodes;
+}
+
+// Pega o próximo item: primeiro da fila do próprio nó, depois rouba dos outros nós
+static int fetch_next_item(ThreadWorkerDataAtomic* data) {
+    std::vector<NodeWorkQueue>& queues = *(data->node_queues);
+    int num_nodes = static_cast<int>(queues.size());
+    for (int k = 0; k < num_nodes; ++k) {
+        NodeWorkQueue& queue = queues[(data->numa_node + k) % num_nodes];
+        int pos = queue.next++;
+        if (pos < static_cast<int>(queue.item_indices.size())) {
+            return queue.item_indices[pos];
+        }
+    }
+    return -1;
+}
+
+// Como fetch_next_item, mas só pega um item se a estimativa dele couber no orçamento.
+// Itens que não cabem ficam na fila para depois; se nenhum item livre cabe, espera
+// algum item em andamento terminar. Sem nada em andamento, o item entra mesmo acima
+// do orçamento (roda sozinho), para que a chamada sempre termine.
+static int fetch_item_within_budget(ThreadWorkerDataAtomic* data) {
+    MemoryAdmission& admission = *(data->admission);
+    std::vector<NodeWorkQueue>& queues = *(data->node_queues);
+    int num_nodes = static_cast<int>(queues.size());
+    std::unique_lock<std::mutex> lock(admission.mutex);
+    while (true) {
+        bool pending = false;
+        for (int k = 0; k < num_nodes; ++k) {
+            int node = (data->numa_node + k) % num_nodes;
+            const std::vector<int>& items = queues[node].item_indices;
+            size_t& first = admission.first_open[node];
+            while (first < items.size() && admission.taken[items[first]]) ++first;
+            for (size_t pos = first; pos < items.size(); ++pos) {
+                int item_idx = items[pos];
+                if (admission.taken[item_idx]) continue;
+                pending = true;
+                uint64_t bytes = admission.item_bytes[item_idx];
+                if (admission.in_use == 0 || admission.in_use + bytes <= admission.budget) {
+                    admission.taken[item_idx] = 1;
+                    admission.in_use += bytes;
+                    admission.peak = std::max(admission.peak, admission.in_use);
+                    return item_idx;
+                }
+            }
+        }
+        if (!pending) return -1;
+        admission.released.wait(lock);
+    }
+}
+
+// Devolve ao orçamento a memória de um item terminado e acorda quem espera
+static void release_item_budget(ThreadWorkerDataAtomic* data, int item_idx) {
+    // Rascunhos grandes não ficam retidos pela thread entre itens
+    data->scratch->trim(kScratchKeepBytes);
+    MemoryAdmission& admission = *(data->admission);
+    {
+        std::lock_guard<std::mutex> lock(admission.mutex);
+        admission.in_use -= admission.item_bytes[item_idx];
+    }
+    admission.released.notify_all();
+}
+
+// Junta as partes estreitadas dos segmentos de um bloco num buffer do bloco, no maior
+// tipo entre elas, e libera as partes (malloc). Se faltar alguma parte, o bloco fica sem saída.
+static NarrowQIndex merge_narrow_segments(const std::vector<BlockSegment>& segments, std::vector<NarrowQIndex>& parts,
+                                          int first_segment, int num_segments, uint64_t numWeights, BufferPool* pool) {
+    NarrowQIndex out;
+    int itemsize = 1;
+    bool complete = true;
+    for (int k = 0; k < num_segments; ++k) {
+        const NarrowQIndex& part = parts[first_segment + k];
+        complete = complete && part.ptr != nullptr;
+        itemsize = std::max(itemsize, part.itemsize);
+    }
+    if (complete) {
+        try {
+            out = allocate_narrow_qindex(numWeights, itemsize, pool);
+        } catch (const std::exception& e) {
+            std::cerr << "ERRO ao alocar qindex de " << numWeights << " pesos: " << e.what() << std::endl;
+            complete = false;
+        }
+    }
+    if (complete) {
+        for (int k = 0; k < num_segments; ++k) {
+            const LayerSegment& seg = segments[first_segment + k].segment;
+            switch (itemsize) {
+                case 1:  widen_narrow(parts[first_segment + k], static_cast<int8_t*>(out.ptr) + seg.offset, seg.numWeights); break;
+                case 2:  widen_narrow(parts[first_segment + k], static_cast<int16_t*>(out.ptr) + seg.offset, seg.numWeights); break;
+                default: widen_narrow(parts[first_segment + k], static_cast<int32_t*>(out.ptr) + seg.offset, seg.numWeights); break;
+            }
+        }
+    }
+    for (int k = 0; k < num_segments; ++k) {
+        std::free(parts[first_segment + k].ptr);
+        parts[first_segment + k] = NarrowQIndex();
+    }
+    return out;
+}
+
+// Quantiza um segmento de um bloco. Devolve false se quantize() falhou.
+static bool quantize_block_segment(ThreadWorkerDataAtomic* data, int seg_idx) {
+    const BlockSegment& unit = (*(data->all_segments))[seg_idx];
+    const LayerSegment& seg = unit.segment;
+    int block_idx = unit.block_idx;
+    const QuantBlock& info = (*(data->all_blocks))[block_idx];
+
+    int32_t current_qp = info.original_qp;
+    float32_t current_qStepSize = info.qStepSize;
+
+    // Sem saída int32 pré-alocada, quantiza no buffer de rascunho da thread (no máximo
+    // um segmento) e estreita depois
+    int32_t* pQIndex = info.pQIndex != nullptr ? info.pQIndex + seg.offset : nullptr;
+    if (pQIndex == nullptr) {
+        pQIndex = data->scratch->get<int32_t>(SCRATCH_QINDEX, seg.numWeights);
+    }
+
+    // Chamada quantize
+    int32_t success = quantize(
+        block_segment_input(info, seg, *data->scratch), // Pesos originais (ou delta contra a referência)
+        pQIndex,                // Ponteiro para o array onde os níveis serão escritos
+        current_qStepSize,      // O qStep calculado (pode ter sido ajustado)
+        seg.layerWidth,         // O stride
+        seg.numWeights,         // O número de pesos do segmento
+        DIST_MSE,               // O tipo de distorção (assumindo MSE como antes)
+        info.lambdaScale,       // O fator lambda
+        info.dq_flag,           // O flag TCQ/URQ
+        info.maxNumNoRem,       // Parâmetro do CABAC
+        segmentScanOrder(info.scan_order, seg) // A ordem de varredura
+    );
+
+    // Lógica de ajuste de QP
+    if (!success) {
+         if (!success) {
+              // Protege escrita concorrente no cerr
+             #pragma omp critical // Usa pragma omp critical mesmo sem omp parallel for
+             {
+                 std::cerr << "[Thread " << data->thread_id << "] ERRO FATAL: Overflow para " << info.param_name << " mesmo após ajuste!" << std::endl;
+             }
+         }
+    }
+
+    if (info.pQIndex == nullptr) {
+        try {
+            // Bloco de um segmento: direto na saída do bloco; de vários, numa parte
+            // (malloc) que é juntada às outras depois do join
+            if (seg.numWeights == info.numWeights) {
+                (*(data->all_narrow_qindex))[block_idx] = make_narrow_qindex(pQIndex, seg.numWeights, data->pool);
+            } else {
+                (*(data->segment_narrow_qindex))[seg_idx] = make_narrow_qindex(pQIndex, seg.numWeights, nullptr);
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "[Thread " << data->thread_id << "] ERRO ao alocar qindex de " << info.param_name << ": " << e.what() << std::endl;
+        }
+    }
+
+    // Escreve o QP final (uma vez por bloco)
+    if (seg.offset == 0) (*(data->all_final_qps))[block_idx] = current_qp;
+
+    // --- Logging CSV (Opcional) ---
+    return success != 0;
+}
+
+// Função Worker (sem mudanças significativas na lógica principal)
+void* quantize_blocks_pthread_worker_atomic(void* arg) {
+    ThreadWorkerDataAtomic* data = static_cast<ThreadWorkerDataAtomic*>(arg);
+    ScratchArenaLease scratch; // Rascunhos reaproveitados de chamadas anteriores
+    data->scratch = &scratch.arena();
+
+    // Loop principal da thread: pega e processa itens até acabar
+    while (true) {
+        // Pega o próximo índice de forma atômica e incrementa o contador
+        // (ou, com orçamento de memória, o próximo item que cabe nele)
+        int item_idx = data->admission != nullptr ? fetch_item_within_budget(data) : fetch_next_item(data);
+
+        // Verifica se o índice pego é válido
+        if (item_idx < 0) {
+            break; // Não há mais blocos para esta thread, sai do loop
+        }
+
+        // Processa, em ordem, todos os segmentos agrupados no item
+        const WorkItem& item = (*(data->all_work_items))[item_idx];
+        for (int k = 0; k < item.num_segments; ++k) {
+            int seg_idx = item.first_segment + k;
+            (*(data->segment_failed))[seg_idx] = !quantize_block_segment(data, seg_idx);
+        }
+        if (data->admission != nullptr) release_item_budget(data, item_idx);
+    } // Fim do loop sobre os itens
+
+    return nullptr;
+}
+
+
+uint64_t estimate_quant_working_set(const QuantBlock& info, uint64_t numWeights) {
+    uint64_t per_weight = info.dq_flag ? kQuantWorkBytesPerWeightTCQ : kQuantWorkBytesPerWeightURQ;
+    if (info.pReference != nullptr) per_weight += sizeof(float32_t);  // scratch_delta
+    if (info.pQIndex == nullptr) per_weight += 2 * sizeof(int32_t);   // scratch_qindex + saída estreitada (até int32)
+    return per_weight * numWeights;
+}
+
+// Entrada de quantize() para um segmento: os próprios pesos, ou no modo delta
+// pesos - referência, calculado no slot SCRATCH_DELTA da arena da thread
+float32_t* block_segment_input(const QuantBlock& info, const LayerSegment& seg, ScratchArena& scratch) {
+    if (info.pReference == nullptr) return info.pWeights + seg.offset;
+    float32_t* delta = scratch.get<float32_t>(SCRATCH_DELTA, seg.numWeights);
+    const float32_t* w = info.pWeights + seg.offset;
+    const float32_t* ref = info.pReference + seg.offset;
+    for (uint32_t i = 0; i < seg.numWeights; ++i) delta[i] = w[i] - ref[i];
+    return delta;
+}
+
+// Quantiza todos os segmentos do bloco em pQIndex (numWeights elementos). Não usa o GIL.
+int32_t quantize_block_levels(const QuantBlock& info, int32_t* pQIndex) {
+    int32_t success = 1;
+    ScratchArenaLease scratch;
+    for (const LayerSegment& seg : splitLayerIntoSegments(info.numWeights, info.layerWidth)) {
+        success &= quantize(block_segment_input(info, seg, scratch.arena()), pQIndex + seg.offset, info.qStepSize, seg.layerWidth, seg.numWeights,
+                            DIST_MSE, info.lambdaScale, info.dq_flag, info.maxNumNoRem, segmentScanOrder(info.scan_order, seg));
+    }
+    return success;
+}
+
+
+void quantize_blocks_parallel(const std::vector<QuantBlock>& block_infos, const QuantEngineOptions& requested_options, QuantEngineResult& result) {
+    QuantEngineOptions options = requested_options;
+    if (options.calibrate || options.num_threads <= 0) {
+        apply_quant_tuning(block_infos, options);
+    }
+    if (options.coalesce_target_weights == kCoalesceTargetAuto) options.coalesce_target_weights = kDefaultCoalesceTargetWeights;
+    int num_blocks = static_cast<int>(block_infos.size());
+    std::vector<int32_t>& final_qps = result.final_qps;
+    std::vector<NarrowQIndex>& narrow_qindex = result.narrow_qindex;
+    std::vector<int>& duplicate_of = result.duplicate_of;
+    final_qps.assign(num_blocks, 0);
+    narrow_qindex.assign(num_blocks, NarrowQIndex());
+    duplicate_of.assign(num_blocks, -1);
+    if (num_blocks == 0) return;
+
+    // --- Deduplicação (opcional) ---
+    // Blocos idênticos a um anterior (mesmo buffer, ex.: embeddings amarrados, ou mesmo
+    // conteúdo) não são quantizados: reusam o qindex do primeiro, e o resultado aponta para ele
+    if (options.dedup) {
+        std::map<std::pair<const float32_t*, const float32_t*>, std::vector<int>> by_pointer;
+        for (int i = 0; i < num_blocks; ++i) {
+            std::vector<int>& same_ptr = by_pointer[std::make_pair(static_cast<const float32_t*>(block_infos[i].pWeights), block_infos[i].pReference)];
+            for (int j : same_ptr) {
+                if (same_quant_params(block_infos[i], block_infos[j])) { duplicate_of[i] = j; break; }
+            }
+            if (duplicate_of[i] < 0) same_ptr.push_back(i);
+        }
+    }
+
+    // Chaves de conteúdo (hash dos pesos + parâmetros), usadas pela deduplicação e pelo cache
+    std::vector<uint64_t> block_keys;
+    if (options.dedup || !options.cache_dir.empty()) {
+        block_keys.resize(num_blocks);
+        parallel_for_pthreads(num_blocks, options.num_threads, [&](int i, int) {
+            if (duplicate_of[i] >= 0) return;
+            const QuantBlock& info = block_infos[i];
+            block_keys[i] = BlockCache::blockKey(info.pWeights, info.pReference, info.numWeights, info.layerWidth, info.qStepSize,
+                                                 info.lambdaScale, info.dq_flag, info.maxNumNoRem, info.scan_order, info.original_qp, info.qpDensity);
+        });
+    }
+    if (options.dedup) {
+        std::unordered_map<uint64_t, std::vector<int>> by_key;
+        for (int i = 0; i < num_blocks; ++i) {
+            if (duplicate_of[i] >= 0) continue;
+            std::vector<int>& same_key = by_key[block_keys[i]];
+            for (int j : same_key) {
+                if (same_block_content(block_infos[i], block_infos[j])) { duplicate_of[i] = j; break; }
+            }
+            if (duplicate_of[i] < 0) same_key.push_back(i);
+        }
+        int num_duplicates = static_cast<int>(std::count_if(duplicate_of.begin(), duplicate_of.end(), [](int d) { return d >= 0; }));
+        if (options.verbose) std::cout << "[Pthreads Dedup] " << num_duplicates << " de " << num_blocks << " blocos são duplicados." << std::endl;
+    }
+
+    // --- Cache de blocos quantizados (opcional) ---
+    // Blocos encontrados no cache já saem com qindex e não viram segmentos. O QP final
+    // é o do próprio bloco (o cache não o guarda; o QP faz parte da chave)
+    std::unique_ptr<BlockCache> cache;
+    std::vector<char> cached(num_blocks, 0);
+    if (!options.cache_dir.empty()) {
+        cache.reset(new BlockCache(options.cache_dir));
+        parallel_for_pthreads(num_blocks, options.num_threads, [&](int i, int) {
+            const QuantBlock& info = block_infos[i];
+            if (duplicate_of[i] >= 0) return;
+            if (info.pQIndex != nullptr) {
+                cached[i] = cache->load(block_keys[i], info.numWeights, info.pQIndex);
+            } else {
+                ScratchArenaLease scratch;
+                int32_t* levels = scratch->get<int32_t>(SCRATCH_QINDEX, info.numWeights);
+                if (cache->load(block_keys[i], info.numWeights, levels)) {
+                    narrow_qindex[i] = make_narrow_qindex(levels, static_cast<uint32_t>(info.numWeights), options.pool);
+                    cached[i] = 1;
+                }
+            }
+            if (cached[i]) final_qps[i] = info.original_qp;
+        });
+        int hits = static_cast<int>(std::count(cached.begin(), cached.end(), 1));
+        if (options.verbose) std::cout << "[Pthreads Cache] " << hits << " de " << num_blocks << " blocos vieram do cache." << std::endl;
+    }
+
+    int num_threads = options.num_threads > 0 ? options.num_threads : static_cast<int>(std::thread::hardware_concurrency());
+    if (num_threads == 0) { // Fallback se a detecção falhar
+        num_threads = 12; // Ou um valor padrão razoável como 8
+        if (options.verbose) std::cout << "[Pthreads] Aviso: Não foi possível detectar o número de núcleos, usando " << num_threads << " threads." << std::endl;
+    } else if (options.num_threads <= 0) {
+         if (options.verbose) std::cout << "[Pthreads] Detectado " << num_threads << " threads de hardware." << std::endl;
+         // Você pode optar por usar todos ou limitar (ex: num_threads = std::max(1, num_threads - 1); // deixa um núcleo livre)
+    }
+
+    // --- Distribuição dos blocos entre os nós NUMA ---
+    std::vector<std::vector<int>> numa_cpus;
+    if (options.numa) {
+        numa_cpus = detect_numa_nodes();
+        if (numa_cpus.size() <= 1) {
+            if (options.verbose) std::cout << "[Pthreads NUMA] Aviso: topologia NUMA indisponível ou com um único nó, modo NUMA ignorado." << std::endl;
+            numa_cpus.clear();
+        }
+    }
+    int num_nodes = numa_cpus.empty() ? 1 : static_cast<int>(numa_cpus.size());
+    // Cada bloco vira um ou mais segmentos (de até kMaxSegmentWeights pesos)
+    std::vector<BlockSegment> segments;
+    std::vector<int> block_first_segment(num_blocks, -1);
+    for (int block_idx = 0; block_idx < num_blocks; ++block_idx) {
+        if (cached[block_idx] || duplicate_of[block_idx] >= 0) continue;
+        block_first_segment[block_idx] = static_cast<int>(segments.size());
+        for (const LayerSegment& seg : splitLayerIntoSegments(block_infos[block_idx].numWeights, block_infos[block_idx].layerWidth)) {
+            segmentScanOrder(block_infos[block_idx].scan_order, seg); // scan_order inválido falha aqui, antes das threads
+            BlockSegment unit = { block_idx, seg };
+            segments.push_back(unit);
+        }
+    }
+
+    // Segmentos pequenos e consecutivos (bias, normalização...) são agrupados num mesmo
+    // item até coalesce_target_weights pesos: um único fetch atômico para todos eles
+    std::vector<WorkItem> work_items;
+    for (int seg_idx = 0; seg_idx < static_cast<int>(segments.size()); ++seg_idx) {
+        uint64_t seg_weights = segments[seg_idx].segment.numWeights;
+        bool small = seg_weights < options.coalesce_target_weights;
+        if (small && !work_items.empty()) {
+            WorkItem& last = work_items.back();
+            // Item anterior também é um lote de pequenos e o total continua dentro do alvo
+            if (last.numWeights < options.coalesce_target_weights && seg_weights <= options.coalesce_target_weights - last.numWeights) {
+                last.num_segments += 1;
+                last.numWeights += seg_weights;
+                continue;
+            }
+        }
+        WorkItem item = { seg_idx, 1, seg_weights };
+        work_items.push_back(item);
+    }
+    int num_items = static_cast<int>(work_items.size());
+    std::vector<char> segment_failed(segments.size(), 0);
+    std::vector<NarrowQIndex> segment_narrow_qindex(segments.size());
+
+    // Memória de trabalho de cada item: os segmentos de um item rodam um após o outro
+    // e reusam os rascunhos da thread, então vale o maior deles
+    std::vector<uint64_t> item_bytes;
+    if (options.max_memory_bytes > 0) {
+        item_bytes.resize(num_items);
+        for (int item_idx = 0; item_idx < num_items; ++item_idx) {
+            const WorkItem& item = work_items[item_idx];
+            for (int k = 0; k < item.num_segments; ++k) {
+                const BlockSegment& unit = segments[item.first_segment + k];
+                item_bytes[item_idx] = std::max(item_bytes[item_idx], estimate_quant_working_set(block_infos[unit.block_idx], unit.segment.numWeights));
+            }
+        }
+    }
+
+    std::vector<NodeWorkQueue> node_queues(num_nodes);
+    if (num_nodes == 1 && options.max_memory_bytes > 0) {
+        // Com orçamento, maiores itens primeiro: começam cedo, e os menores preenchem o
+        // orçamento que sobra em vez de deixar um item grande sozinho no fim
+        node_queues[0].item_indices.resize(num_items);
+        std::iota(node_queues[0].item_indices.begin(), node_queues[0].item_indices.end(), 0);
+        std::stable_sort(node_queues[0].item_indices.begin(), node_queues[0].item_indices.end(), [&item_bytes](int a, int b) {
+            return item_bytes[a] > item_bytes[b];
+        });
+    } else if (num_nodes == 1) {
+        node_queues[0].item_indices.resize(num_items);
+        std::iota(node_queues[0].item_indices.begin(), node_queues[0].item_indices.end(), 0);
+    } else {
+        // Maiores itens primeiro, cada um para o nó com menos pesos atribuídos até agora
+        std::vector<int> order(num_items);
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&work_items](int a, int b) {
+            return work_items[a].numWeights > work_items[b].numWeights;
+        });
+        std::vector<uint64_t> node_load(num_nodes, 0);
+        for (int item_idx : order) {
+            int node = static_cast<int>(std::min_element(node_load.begin(), node_load.end()) - node_load.begin());
+            node_queues[node].item_indices.push_back(item_idx);
+            node_load[node] += work_items[item_idx].numWeights;
+        }
+        if (options.verbose) std::cout << "[Pthreads NUMA] " << num_nodes << " nós NUMA, threads fixadas por nó." << std::endl;
+    }
+
+    std::unique_ptr<MemoryAdmission> admission;
+    if (options.max_memory_bytes > 0) {
+        admission.reset(new MemoryAdmission());
+        admission->budget = options.max_memory_bytes;
+        admission->item_bytes = item_bytes;
+        admission->taken.assign(num_items, 0);
+        admission->first_open.assign(num_nodes, 0);
+        if (options.verbose) {
+            int oversized = static_cast<int>(std::count_if(item_bytes.begin(), item_bytes.end(), [&options](uint64_t bytes) { return bytes > options.max_memory_bytes; }));
+            std::cout << "[Pthreads Mem] Orçamento de " << (options.max_memory_bytes >> 20) << " MB para a memória de trabalho";
+            if (oversized > 0) std::cout << " (" << oversized << " itens maiores que o orçamento rodarão sozinhos)";
+            std::cout << "." << std::endl;
+        }
+    }
+
+    if (options.verbose) std::cout << "[Pthreads Atomic] Usando " << num_threads << " threads para " << num_blocks << " blocos (" << segments.size() << " segmentos em " << num_items << " itens)." << std::endl;
+    std::vector<pthread_t> threads(num_threads);
+    std::vector<ThreadWorkerDataAtomic> thread_worker_data(num_threads);
+    std::vector<bool> thread_launched_successfully(num_threads, false); 
+
+    // Lança as threads
+    for (int i = 0; i < num_threads; ++i) {
+        // Preenche a estrutura de dados para esta thread
+        thread_worker_data[i].thread_id = i;
+        thread_worker_data[i].numa_node = i % num_nodes;            // Threads distribuídas em round-robin pelos nós
+        thread_worker_data[i].all_blocks = &block_infos;
+        thread_worker_data[i].all_segments = &segments;
+        thread_worker_data[i].all_work_items = &work_items;
+        thread_worker_data[i].all_final_qps = &final_qps;
+        thread_worker_data[i].segment_failed = &segment_failed;
+        thread_worker_data[i].node_queues = &node_queues;          // Passa ponteiro p/ filas (contadores atômicos)
+        thread_worker_data[i].all_narrow_qindex = &narrow_qindex;
+        thread_worker_data[i].segment_narrow_qindex = &segment_narrow_qindex;
+        thread_worker_data[i].pool = options.pool;
+        thread_worker_data[i].admission = admission.get();
+
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+#ifdef __linux__
+        // Fixa a thread nas CPUs do seu nó antes de ela começar (first-touch local)
+        if (!numa_cpus.empty()) {
+            cpu_set_t cpu_set;
+            CPU_ZERO(&cpu_set);
+            for (int cpu : numa_cpus[thread_worker_data[i].numa_node]) {
+                if (cpu < CPU_SETSIZE) CPU_SET(cpu, &cpu_set);
+            }
+            pthread_attr_setaffinity_np(&attr, sizeof(cpu_set), &cpu_set);
+        }
+#endif
+        // Cria a thread, passando a nova função worker
+        int rc = pthread_create(&threads[i], &attr, quantize_blocks_pthread_worker_atomic, &thread_worker_data[i]);
+        pthread_attr_destroy(&attr);
+        if (rc == 0) { // Sucesso na criação
+             thread_launched_successfully[i] = true; // Marca como sucesso
+        } else {
+             #pragma omp critical // Protege cerr
+             {
+                std::cerr << "ERRO: pthread_create falhou para thread " << i << " com código " << rc << std::endl;
+             }
+        }
+    }
+
+    // Espera (Join) as threads terminarem
+    if (options.verbose) std::cout << "[Pthreads Atomic] Esperando threads terminarem..." << std::endl;
+    for (int i = 0; i < num_threads; ++i) {
+         // Usa o flag booleano para decidir se faz join
+         if (thread_launched_successfully[i]) {
+            pthread_join(threads[i], nullptr);
+         }
+    }
+    if (options.verbose) std::cout << "[Pthreads Atomic] Todas as threads terminaram." << std::endl;
+
+    // Blocos estreitados com vários segmentos: junta as partes na saída do bloco
+    parallel_for_pthreads(num_blocks, options.num_threads, [&](int i, int) {
+        const QuantBlock& info = block_infos[i];
+        int first = block_first_segment[i];
+        if (info.pQIndex != nullptr || first < 0 || info.numWeights == segments[first].segment.numWeights) return;
+        int count = 1;
+        while (first + count < static_cast<int>(segments.size()) && segments[first + count].block_idx == i) ++count;
+        narrow_qindex[i] = merge_narrow_segments(segments, segment_narrow_qindex, first, count, info.numWeights, options.pool);
+    });
+    for (int i = 0; i < num_blocks; ++i) {
+        if (duplicate_of[i] >= 0) final_qps[i] = final_qps[duplicate_of[i]];
+    }
+    if (admission && options.verbose) {
+        std::cout << "[Pthreads Mem] Pico estimado de " << (admission->peak >> 20) << " MB em andamento." << std::endl;
+    }
+
+    // Grava no cache os blocos que foram quantizados agora, menos os que falharam
+    // (um segmento com overflow deixaria níveis errados para as próximas execuções)
+    if (cache) {
+        std::vector<char> block_failed(num_blocks, 0);
+        for (size_t seg_idx = 0; seg_idx < segments.size(); ++seg_idx) {
+            if (segment_failed[seg_idx]) block_failed[segments[seg_idx].block_idx] = 1;
+        }
+        parallel_for_pthreads(num_blocks, options.num_threads, [&](int i, int) {
+            const QuantBlock& info = block_infos[i];
+            if (cached[i] || duplicate_of[i] >= 0 || block_failed[i]) return;
+            if (info.pQIndex != nullptr) {
+                cache->store(block_keys[i], info.numWeights, info.pQIndex);
+                return;
+            }
+            const NarrowQIndex& narrow = narrow_qindex[i];
+            if (narrow.ptr == nullptr) return;
+            ScratchArenaLease scratch;
+            int32_t* levels = scratch->get<int32_t>(SCRATCH_QINDEX, info.numWeights);
+            widen_narrow(narrow, levels, info.numWeights);
+            cache->store(block_keys[i], info.numWeights, levels);
+        });
+    }
+}
@@ -0,0 +1,92 @@
+#ifndef QUANT_ENGINE_H
+#define QUANT_ENGINE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <Lib/CommonLib/TypeDef.h>
+#include "BufferPool.h"
+#include "LayerSegments.h"
+#include "ScratchArena.h"
+
+// Motor da quantização paralela, sem dependência de Python: pode ser ligado direto
+// num programa C++. O módulo deepCABAC (ParallelQuant.cpp) só converte os
+// dicionários Python para QuantBlock e os resultados de volta.
+
+// Bloco a quantizar. Os buffers pertencem a quem chama e precisam viver até o fim da chamada.
+struct QuantBlock {
+    std::string param_name;
+    std::vector<int64_t> shape;
+    float32_t* pWeights;
+    const float32_t* pReference; // Modo delta: quantiza pWeights - pReference (nullptr = pesos diretos)
+    int32_t* pQIndex;       // Saída int32; nullptr = o motor aloca a saída estreitada (int8/int16/int32)
+    uint64_t numWeights;
+    uint64_t layerWidth;
+    float32_t qStepSize;
+    float32_t lambdaScale;
+    uint8_t dq_flag;
+    uint32_t maxNumNoRem;
+    int32_t scan_order;
+    int32_t original_qp;
+    int32_t qpDensity;
+
+    QuantBlock() : pWeights(nullptr), pReference(nullptr), pQIndex(nullptr), numWeights(0), layerWidth(1), qStepSize(1.0f),
+                   lambdaScale(0.0f), dq_flag(0), maxNumNoRem(0), scan_order(0), original_qp(0), qpDensity(0) {}
+};
+
+// Saída estreitada de um bloco: níveis no menor tipo inteiro suficiente (int8/int16/int32)
+struct NarrowQIndex {
+    void* ptr;              // Alocado pelo worker (pool ou malloc); quem recebe passa a ser o dono
+    size_t bytes;           // Tamanho alocado (arredondado no caso do pool)
+    int itemsize;           // 1, 2 ou 4
+    bool from_pool;         // true: devolver com BufferPool::release; false: std::free
+
+    NarrowQIndex() : ptr(nullptr), bytes(0), itemsize(0), from_pool(false) {}
+};
+
+// coalesce_target_weights sem perfil de ajuste; kCoalesceTargetAuto pede o do perfil
+// (AutoTune.h) e, sem perfil aplicado, fica com o padrão
+static const uint64_t kDefaultCoalesceTargetWeights = 1 << 16;
+static const uint64_t kCoalesceTargetAuto = UINT64_MAX;
+
+struct QuantEngineOptions {
+    int  num_threads;       // 0 = usa std::thread::hardware_concurrency()
+    bool numa;              // Fixa os workers por nó NUMA e distribui os blocos entre os nós
+    BufferPool* pool;       // Se não nulo, as saídas estreitadas vêm deste pool
+    uint64_t coalesce_target_weights; // Blocos menores que isso são agrupados em itens de até esse total (0 = desliga, kCoalesceTargetAuto = perfil)
+    std::string cache_dir;  // Se não vazio, diretório (já existente) do cache de blocos quantizados
+    bool dedup;             // Quantiza uma só vez blocos idênticos (mesmo buffer ou mesmo conteúdo)
+    std::string tuning_profile; // Perfil de ajuste (AutoTune.h); vazio = default_tuning_profile_path()
+    bool calibrate;         // Calibra nos próprios blocos e grava o perfil antes de quantizar
+    bool verbose;           // Mensagens [Pthreads ...] no stdout
+    uint64_t max_memory_bytes; // Teto para a memória de trabalho estimada dos itens em andamento (0 = sem limite)
+
+    QuantEngineOptions() : num_threads(0), numa(false), pool(nullptr), coalesce_target_weights(kCoalesceTargetAuto), dedup(false), calibrate(false), verbose(true),
+                           max_memory_bytes(0) {}
+};
+
+struct QuantEngineResult {
+    std::vector<int32_t> final_qps;
+    std::vector<NarrowQIndex> narrow_qindex; // Só para blocos com pQIndex == nullptr
+    std::vector<int> duplicate_of;           // Índice do bloco original, ou -1
+};
+
+// Quantiza todos os blocos com pthreads. Blocos com pQIndex == nullptr saem estreitados
+// em narrow_qindex (os de vários segmentos, juntados no maior tipo entre as partes). Duplicados (dedup) não têm a saída escrita:
+// duplicate_of aponta para o original, de onde quem chama copia ou compartilha os
+// níveis (o final_qps do duplicado já é o do original). Com num_threads == 0, um perfil de ajuste
+// gravado antes (calibrate) escolhe num_threads e, se pedido (kCoalesceTargetAuto),
+// coalesce_target_weights.
+// Com max_memory_bytes, uma thread só começa um item se a estimativa da memória de
+// trabalho dele couber no que sobra do orçamento; senão pega um item menor da fila
+// ou espera. Um item maior que o orçamento inteiro roda sozinho.
+void quantize_blocks_parallel(const std::vector<QuantBlock>& blocks, const QuantEngineOptions& options, QuantEngineResult& result);
+
+// Estimativa da memória de trabalho ao quantizar numWeights pesos do bloco: temporários
+// de quantize() (bem maiores no TCQ), rascunho do delta e níveis int32 antes do estreitamento
+uint64_t estimate_quant_working_set(const QuantBlock& block, uint64_t numWeights);
+
+int32_t quantize_block_levels(const QuantBlock& block, int32_t* pQIndex);
+float32_t* block_segment_input(const QuantBlock& block, const LayerSegment& seg, ScratchArena& scratch);
+
+#endif // QUANT_ENGINE_H
@@ -0,0 +1,176 @@
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+#include <stdexcept>
+#include <iostream>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "QuantFuture.h"
+
+static bool open_wakeup_pipe(int fds[2]) {
+#ifdef _WIN32
+    return _pipe(fds, 64, _O_BINARY) == 0;
+#else
+    return pipe(fds) == 0;
+#endif
+}
+
+static void close_fd(int fd) {
+    if (fd < 0) return;
+#ifdef _WIN32
+    _close(fd);
+#else
+    close(fd);
+#endif
+}
+
+static void signal_wakeup(int fd) {
+    const char byte = 1;
+#ifdef _WIN32
+    _write(fd, &byte, 1);
+#else
+    ssize_t rc = write(fd, &byte, 1);
+    (void)rc;
+#endif
+}
+
+QuantizeFuture::QuantizeFuture(py::list py_block_info_list, const ParallelQuantOptions& options)
+    : m_TotalWeights(0), m_NextBlock(0), m_Running(0), m_Cancel(false), m_Failed(false),
+      m_CompletedBlocks(0), m_CompletedWeights(0), m_Done(false), m_Joined(false) {
+    m_WakeupFds[0] = m_WakeupFds[1] = -1;
+
+    // Saída sempre em int32 alocada aqui, com o GIL (sem narrow_qindex)
+    ParallelQuantOptions extract_options = options;
+    extract_options.narrow_qindex = false;
+    m_BlockInfos.reserve(py_block_info_list.size());
+    for (const auto& item : py_block_info_list) {
+        m_BlockInfos.push_back(extract_block_quant_info(item.cast<py::dict>(), extract_options, true));
+        m_TotalWeights += m_BlockInfos.back().numWeights;
+    }
+    m_Success.assign(m_BlockInfos.size(), 0);
+
+    if (!open_wakeup_pipe(m_WakeupFds)) {
+        throw std::runtime_error("QuantizeFuture: não foi possível criar o pipe de notificação");
+    }
+
+    int num_blocks = static_cast<int>(m_BlockInfos.size());
+    int num_threads = std::max(1, std::min(resolve_num_threads(options.num_threads), std::max(num_blocks, 1)));
+    m_Running = 1; // Referência do próprio construtor, liberada depois de lançar as threads
+    for (int i = 0; i < num_threads; ++i) {
+        pthread_t thread;
+        m_Running++;
+        int rc = pthread_create(&thread, nullptr, QuantizeFuture::worker, this);
+        if (rc == 0) {
+            m_Threads.push_back(thread);
+        } else {
+            std::cerr << "ERRO: pthread_create falhou para thread " << i << " com código " << rc << std::endl;
+            m_Running--;
+        }
+    }
+    if (m_Threads.empty()) {
+        process_blocks(); // Sem threads: executa na thread atual
+    }
+    finish_worker();
+    std::cout << "[Pthreads Async] " << m_Threads.size() << " threads para " << num_blocks << " blocos." << std::endl;
+}
+
+QuantizeFuture::~QuantizeFuture() {
+    // Um handle abandonado não deve prender o processo: cancela e espera os blocos em andamento
+    cancel();
+    wait();
+    close_fd(m_WakeupFds[0]);
+    close_fd(m_WakeupFds[1]);
+}
+
+void* QuantizeFuture::worker(void* arg) {
+    QuantizeFuture* future = static_cast<QuantizeFuture*>(arg);
+    future->process_blocks();
+    future->finish_worker();
+    return nullptr;
+}
+
+void QuantizeFuture::process_blocks() {
+    int num_blocks = static_cast<int>(m_BlockInfos.size());
+    while (!m_Cancel.load() && !m_Failed.load()) {
+        int block_idx = m_NextBlock++;
+        if (block_idx >= num_blocks) break;
+
+        const BlockQuantInfo& info = m_BlockInfos[block_idx];
+        try {
+            m_Success[block_idx] = quantize_block_levels(info, info.pQIndex);
+        } catch (...) {
+            // A exceção não pode sair da pthread: fica para result(), e finish_worker
+            // ainda acorda quem espera em fileno()
+            {
+                std::lock_guard<std::mutex> lock(m_Mutex);
+                if (!m_Error) m_Error = std::current_exception();
+            }
+            m_Failed.store(true);
+            break;
+        }
+        if (!m_Success[block_idx]) {
+            std::cerr << "[Async] ERRO FATAL: Overflow para " << info.param_name << " mesmo após ajuste!" << std::endl;
+        }
+        m_CompletedWeights += info.numWeights;
+        m_CompletedBlocks++;
+    }
+}
+
+// O último a sair (worker ou o construtor) sinaliza o fim
+void QuantizeFuture::finish_worker() {
+    if (--m_Running == 0) {
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            m_Done = true;
+        }
+        m_DoneCond.notify_all();
+        signal_wakeup(m_WakeupFds[1]);
+    }
+}
+
+bool QuantizeFuture::done() {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return m_Done;
+}
+
+// Espera os workers (sem o GIL) e os junta uma única vez
+void QuantizeFuture::wait() {
+    py::gil_scoped_release release_gil;
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    m_DoneCond.wait(lock, [this] { return m_Done; });
+    if (!m_Joined) {
+        for (pthread_t thread : m_Threads) {
+            pthread_join(thread, nullptr);
+        }
+        m_Joined = true;
+    }
+}
+
+py::list QuantizeFuture::result() {
+    wait();
+    std::exception_ptr error;
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        error = m_Error;
+    }
+    if (error) std::rethrow_exception(error);
+    if (m_Cancel.load() && m_CompletedBlocks.load() < m_BlockInfos.size()) {
+        throw std::runtime_error("QuantizeFuture: quantização cancelada");
+    }
+
+    py::list py_results;
+    for (const BlockQuantInfo& info : m_BlockInfos) {
+        py::dict result_dict;
+        result_dict["param_name"] = info.param_name;
+        result_dict["final_qp"] = info.original_qp;
+        result_dict["qindex"] = info.qindex_array;
+        result_dict["dq_flag"] = info.dq_flag;
+        py_results.append(result_dict);
+    }
+    return py_results;
+}
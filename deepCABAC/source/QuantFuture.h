@@ -0,0 +1,65 @@
+#ifndef QUANT_FUTURE_H
+#define QUANT_FUTURE_H
+
+#include <pybind11/pybind11.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <vector>
+#include "ParallelFor.h"
+#include "ParallelQuant.h"
+
+namespace py = pybind11;
+
+// Handle devolvido por quantize_all_blocks_async: a quantização roda em pthreads
+// próprias e quem chama continua livre. Quando o último worker termina, um byte é
+// escrito em fileno(), que fica legível (para loop.add_reader do asyncio).
+// cancel() é cooperativo: blocos já iniciados terminam, os demais são pulados.
+// Uma exceção num worker marca o handle como falho (failed()), para os outros
+// workers da mesma forma que cancel(), acorda fileno() e é relançada por result().
+class QuantizeFuture {
+public:
+    QuantizeFuture(py::list py_block_info_list, const ParallelQuantOptions& options);
+    ~QuantizeFuture();
+
+    bool done();
+    bool cancelled() const { return m_Cancel.load(); }
+    bool failed() const { return m_Failed.load(); }
+    void cancel() { m_Cancel.store(true); }
+    py::list result();
+    int fileno() const { return m_WakeupFds[0]; }
+
+    uint64_t completed_blocks() const { return m_CompletedBlocks.load(); }
+    uint64_t total_blocks() const { return m_BlockInfos.size(); }
+    uint64_t completed_weights() const { return m_CompletedWeights.load(); }
+    uint64_t total_weights() const { return m_TotalWeights; }
+
+private:
+    static void* worker(void* arg);
+    void process_blocks();
+    void finish_worker();
+    void wait();
+
+    std::vector<BlockQuantInfo> m_BlockInfos;
+    std::vector<int32_t> m_Success;
+    uint64_t m_TotalWeights;
+
+    std::vector<pthread_t> m_Threads;
+    std::atomic<int> m_NextBlock;
+    std::atomic<int> m_Running;
+    std::atomic<bool> m_Cancel;
+    std::atomic<bool> m_Failed;
+    std::atomic<uint64_t> m_CompletedBlocks;
+    std::atomic<uint64_t> m_CompletedWeights;
+
+    std::mutex m_Mutex;
+    std::condition_variable m_DoneCond;
+    bool m_Done;
+    bool m_Joined;
+    std::exception_ptr m_Error;     // Primeira exceção dos workers (sob m_Mutex)
+    int m_WakeupFds[2];     // [0] leitura (fileno), [1] escrita pelos workers
+};
+
+#endif // QUANT_FUTURE_H
@@ -0,0 +1,169 @@
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+#include <stdexcept>
+#include <iostream>
+
+#include "QuantSession.h"
+
+QuantizeSession::QuantizeSession(const ParallelQuantOptions& options)
+    : m_Options(options), m_Submitted(0), m_Completed(0), m_Closing(false) {
+    // Os blocos chegam um a um: a saída estreitada e o agrupamento ficam com quantize_all_blocks_parallel
+    m_Options.narrow_qindex = false;
+
+    int num_threads = resolve_num_threads(options.num_threads);
+    for (int i = 0; i < num_threads; ++i) {
+        pthread_t thread;
+        int rc = pthread_create(&thread, nullptr, QuantizeSession::worker, this);
+        if (rc == 0) {
+            m_Threads.push_back(thread);
+        } else {
+            std::cerr << "ERRO: pthread_create falhou para thread " << i << " com código " << rc << std::endl;
+        }
+    }
+    if (m_Threads.empty()) {
+        throw std::runtime_error("QuantizeSession: nenhuma thread de quantização pôde ser criada");
+    }
+    std::cout << "[Pthreads Session] " << m_Threads.size() << " threads aguardando blocos." << std::endl;
+}
+
+static ParallelQuantOptions session_options(int num_threads, OutputArena* arena) {
+    ParallelQuantOptions options;
+    options.num_threads = num_threads;
+    options.arena = arena;
+    return options;
+}
+
+QuantizeSession::QuantizeSession(int num_threads, OutputArena* arena)
+    : QuantizeSession(session_options(num_threads, arena)) {
+}
+
+QuantizeSession::~QuantizeSession() {
+    try {
+        close();
+    } catch (...) {
+        // Destrutor não relança: o erro de um worker só chega por poll/wait_all/close
+    }
+}
+
+void* QuantizeSession::worker(void* arg) {
+    static_cast<QuantizeSession*>(arg)->run_worker();
+    return nullptr;
+}
+
+void QuantizeSession::run_worker() {
+    while (true) {
+        std::unique_ptr<SessionJob> job;
+        {
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            m_WorkCond.wait(lock, [this] { return m_Closing || !m_Pending.empty(); });
+            if (m_Pending.empty()) break; // Fechando e sem trabalho
+            job = std::move(m_Pending.front());
+            m_Pending.pop_front();
+        }
+
+        std::exception_ptr error;
+        try {
+            job->success = quantize_block_levels(job->info, job->info.pQIndex);
+        } catch (...) {
+            error = std::current_exception();
+            job->failed = true;
+        }
+        if (!job->failed && !job->success) {
+            std::cerr << "[Session] ERRO FATAL: Overflow para " << job->info.param_name << " mesmo após ajuste!" << std::endl;
+        }
+
+        {
+            // O job que falhou também vai para m_Finished: seus arrays só podem
+            // ser liberados com o GIL, em poll()
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            if (error && !m_Error) m_Error = error;
+            m_Finished.push_back(std::move(job));
+            m_Completed++;
+        }
+        m_DoneCond.notify_all();
+    }
+}
+
+void QuantizeSession::submit(py::dict block_dict) {
+    std::unique_ptr<SessionJob> job(new SessionJob());
+    job->info = extract_block_quant_info(block_dict, m_Options, true);
+    job->success = 0;
+    job->failed = false;
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        if (m_Closing) {
+            throw std::runtime_error("QuantizeSession: submit() após close()");
+        }
+        m_Pending.push_back(std::move(job));
+        m_Submitted++;
+    }
+    m_WorkCond.notify_one();
+}
+
+py::list QuantizeSession::poll() {
+    std::vector<std::unique_ptr<SessionJob>> finished;
+    std::exception_ptr error;
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        finished.swap(m_Finished);
+        error.swap(m_Error);
+    }
+    if (error) std::rethrow_exception(error);
+
+    py::list py_results;
+    for (const std::unique_ptr<SessionJob>& job : finished) {
+        if (job->failed) continue;
+        py::dict result_dict;
+        result_dict["param_name"] = job->info.param_name;
+        result_dict["final_qp"] = job->info.original_qp;
+        result_dict["qindex"] = job->info.qindex_array;
+        result_dict["dq_flag"] = job->info.dq_flag;
+        py_results.append(result_dict);
+    }
+    return py_results;
+}
+
+py::list QuantizeSession::wait_all() {
+    {
+        py::gil_scoped_release release_gil;
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        m_DoneCond.wait(lock, [this] { return m_Completed == m_Submitted; });
+    }
+    return poll();
+}
+
+void QuantizeSession::close() {
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        if (m_Closing && m_Threads.empty()) return;
+        m_Closing = true;
+    }
+    m_WorkCond.notify_all();
+
+    // Os workers terminam os jobs pendentes antes de sair; não precisam do GIL
+    {
+        py::gil_scoped_release release_gil;
+        for (pthread_t thread : m_Threads) {
+            pthread_join(thread, nullptr);
+        }
+        m_Threads.clear();
+    }
+
+    // Erro que nenhum poll()/wait_all() relançou
+    std::exception_ptr error;
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        error.swap(m_Error);
+    }
+    if (error) std::rethrow_exception(error);
+}
+
+uint64_t QuantizeSession::submitted() {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return m_Submitted;
+}
+
+uint64_t QuantizeSession::completed() {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return m_Completed;
+}
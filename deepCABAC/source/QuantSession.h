@@ -0,0 +1,62 @@
+#ifndef QUANT_SESSION_H
+#define QUANT_SESSION_H
+
+#include <pybind11/pybind11.h>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "ParallelFor.h"
+#include "ParallelQuant.h"
+
+namespace py = pybind11;
+
+// Bloco submetido a uma QuantizeSession
+struct SessionJob {
+    BlockQuantInfo info;
+    int32_t success;
+    bool failed;        // quantize lançou uma exceção (guardada na sessão)
+};
+
+// Quantização incremental: os workers começam nos primeiros blocos enquanto
+// o Python ainda percorre o modelo. submit() enfileira um bloco, poll() devolve
+// os resultados prontos desde a última chamada e wait_all() espera o resto.
+// Os objetos Python dos jobs só são criados/destruídos com o GIL (submit/poll);
+// os workers só usam os ponteiros crus. Uma exceção num worker é guardada e
+// relançada pelo próximo poll()/wait_all() (ou por close(), se ninguém a viu).
+class QuantizeSession {
+public:
+    QuantizeSession(const ParallelQuantOptions& options);
+    QuantizeSession(int num_threads, OutputArena* arena);
+    ~QuantizeSession();
+
+    void submit(py::dict block_dict);
+    py::list poll();
+    py::list wait_all();
+    void close();
+
+    uint64_t submitted();
+    uint64_t completed();
+
+private:
+    static void* worker(void* arg);
+    void run_worker();
+
+    ParallelQuantOptions m_Options;
+    std::vector<pthread_t> m_Threads;
+
+    std::mutex m_Mutex;
+    std::condition_variable m_WorkCond;   // Há jobs pendentes ou a sessão foi fechada
+    std::condition_variable m_DoneCond;   // Algum job terminou
+    std::deque<std::unique_ptr<SessionJob>> m_Pending;
+    std::vector<std::unique_ptr<SessionJob>> m_Finished;  // Prontos e ainda não devolvidos por poll()
+    uint64_t m_Submitted;
+    uint64_t m_Completed;
+    bool m_Closing;
+    std::exception_ptr m_Error;           // Primeira exceção de um worker ainda não relançada
+};
+
+#endif // QUANT_SESSION_H
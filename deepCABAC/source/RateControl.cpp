@@ -0,0 +1,433 @@
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <iostream>
+#include <limits>
+#include <cmath>
+#include <algorithm>
+
+#include <Lib/CommonLib/TypeDef.h>
+#include <Lib/CommonLib/Quant.h>
+
+#include "RateControl.h"
+#include "BitCounter.h"
+#include "ParallelFor.h"
+#include "LayerSegments.h"
+#include "LayerCoder.h"
+#include "ScratchArena.h"
+
+// Rodadas da distribuição do orçamento que sobrou (cada uma mede um QP por bloco candidato)
+static const int kMaxPoolRounds = 64;
+
+// Quantiza o bloco com o QP dado e estima o tamanho com o BitCounter (contextos novos,
+// mesma binarização e param_opt_flag do encode). Retorna o tamanho em bytes, ou
+// UINT64_MAX se a quantização estourar int32.
+static uint64_t quantize_and_count_bytes(const RateBlockInfo& info, int32_t qp, ScratchArena& scratch) {
+    float32_t qStepSize = qpToStepSize(info.qpDensity, qp);
+
+    BitCounter counter(info.maxNumNoRem, info.param_opt_flag);
+    for (const LayerSegment& seg : splitLayerIntoSegments(info.numWeights, info.layerWidth)) {
+        int32_t* levels = scratch.get<int32_t>(SCRATCH_QINDEX, seg.numWeights);
+        int32_t scan_order = segmentScanOrder(info.scan_order, seg);
+        if (!quantize(info.pWeights + seg.offset, levels, qStepSize, seg.layerWidth, seg.numWeights, DIST_MSE, info.lambdaScale, info.dq_flag, info.maxNumNoRem, scan_order)) {
+            return std::numeric_limits<uint64_t>::max();
+        }
+        counter.addWeights(levels, seg.layerWidth, seg.numWeights, info.dq_flag, scan_order);
+    }
+    return (counter.finish() + 7) / 8;
+}
+
+// Bisseção em [lo, hi]: menor QP (maior qualidade) cujo tamanho cabe no orçamento.
+// Assume que o tamanho não cresce com o QP. hi_bytes é o tamanho já medido em hi
+// (UINT64_MAX: mede aqui).
+static void bisect_block_qp(RateBlockInfo& info, int32_t lo, int32_t hi, uint64_t hi_bytes) {
+    ScratchArenaLease lease;
+    ScratchArena& scratch = lease.arena();
+
+    if (hi_bytes == std::numeric_limits<uint64_t>::max()) hi_bytes = quantize_and_count_bytes(info, hi, scratch);
+    if (hi_bytes > info.byte_budget) {
+        // Nem o maior QP cabe: devolve o maior QP e sinaliza
+        info.chosen_qp = hi;
+        info.chosen_bytes = hi_bytes;
+        info.budget_met = false;
+        return;
+    }
+    while (lo < hi) {
+        int32_t mid = lo + (hi - lo) / 2;
+        uint64_t bytes = quantize_and_count_bytes(info, mid, scratch);
+        if (bytes <= info.byte_budget) {
+            hi = mid;
+            hi_bytes = bytes;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    info.chosen_qp = hi;
+    info.chosen_bytes = hi_bytes;
+    info.budget_met = true;
+}
+
+// Lê um bloco no mesmo formato de dicionário de quantize_all_blocks_parallel
+static RateBlockInfo extract_rate_block(py::dict block_dict, const RateControlOptions& options) {
+    RateBlockInfo info;
+
+    info.param_name = block_dict["param_name"].cast<std::string>();
+    info.weights_array = block_dict["weights"].cast<py::array_t<float32_t, py::array::c_style | py::array::forcecast>>();
+    py::buffer_info bi_weights = info.weights_array.request();
+    getLayerDims(bi_weights.shape, info.numWeights, info.layerWidth);
+    info.pWeights = static_cast<float32_t*>(bi_weights.ptr);
+    if (block_dict.contains("reference") && !block_dict["reference"].is_none()) {
+        // Modo delta: taxa e distorção medidas sobre w - w_ref (a distorção é a mesma de w)
+        auto reference = block_dict["reference"].cast<py::array_t<float32_t, py::array::c_style | py::array::forcecast>>();
+        if (static_cast<uint64_t>(reference.size()) != info.numWeights) {
+            throw std::runtime_error("reference de " + info.param_name + " não tem o mesmo número de elementos que os pesos");
+        }
+        py::array_t<float32_t, py::array::c_style | py::array::forcecast> delta(bi_weights.shape);
+        float32_t* pDelta = static_cast<float32_t*>(delta.request(true).ptr);
+        const float32_t* pReference = static_cast<const float32_t*>(reference.request().ptr);
+        for (uint64_t i = 0; i < info.numWeights; ++i) pDelta[i] = info.pWeights[i] - pReference[i];
+        info.weights_array = delta;
+        info.pWeights = pDelta;
+    }
+    info.lambdaScale = block_dict["lambdaScale"].cast<float32_t>();
+    info.dq_flag = block_dict["dq_flag"].cast<uint8_t>();
+    info.maxNumNoRem = block_dict["maxNumNoRem"].cast<uint32_t>();
+    info.param_opt_flag = block_dict.contains("param_opt_flag") ? block_dict["param_opt_flag"].cast<uint8_t>() : options.param_opt_flag;
+    info.scan_order = block_dict["scan_order"].cast<int32_t>();
+    info.qpDensity = block_dict["qpDensity"].cast<int32_t>();
+    info.byte_budget = block_dict.contains("byte_budget") ? block_dict["byte_budget"].cast<uint64_t>() : 0;
+    info.qp_min = block_dict.contains("qp_min") ? block_dict["qp_min"].cast<int32_t>() : options.qp_min;
+    info.qp_max = block_dict.contains("qp_max") ? block_dict["qp_max"].cast<int32_t>() : options.qp_max;
+    if (info.qp_min > info.qp_max) {
+        throw std::runtime_error("qp_min > qp_max para " + info.param_name);
+    }
+    info.chosen_qp = info.qp_max;
+    info.chosen_bytes = 0;
+    info.budget_met = false;
+    return info;
+}
+
+// Bytes do fundo comum que os blocos ainda não usam (0 se já estourou)
+static uint64_t spare_budget(const std::vector<RateBlockInfo>& block_infos, const std::vector<int>& pooled, uint64_t pool_budget) {
+    uint64_t used = 0;
+    for (int block_idx : pooled) used += block_infos[block_idx].chosen_bytes;
+    return used < pool_budget ? pool_budget - used : 0;
+}
+
+// Devolve ao fundo comum o orçamento que os blocos do modelo não usaram e o reparte
+// entre os que ainda podem baixar o QP. Primeiro em rodadas proporcionais ao número de
+// pesos (cada candidato refaz a bisseção abaixo do QP atual), enquanto algum QP mudar;
+// depois, um QP por vez, dando a sobra aos passos mais baratos enquanto couberem.
+// Os blocos que cabem terminam com byte_budget = bytes usados, e a soma fica em pool_budget.
+static void redistribute_spare_budget(std::vector<RateBlockInfo>& block_infos, const std::vector<int>& pooled, uint64_t pool_budget, int num_threads) {
+    for (int round = 0; round < kMaxPoolRounds; ++round) {
+        uint64_t spare = spare_budget(block_infos, pooled, pool_budget);
+        std::vector<int> candidates;
+        uint64_t candidate_weights = 0;
+        for (int block_idx : pooled) {
+            RateBlockInfo& info = block_infos[block_idx];
+            if (info.budget_met) info.byte_budget = info.chosen_bytes;
+            if (info.budget_met && info.chosen_qp > info.qp_min) {
+                candidates.push_back(block_idx);
+                candidate_weights += info.numWeights;
+            }
+        }
+        if (spare == 0 || candidates.empty()) return;
+
+        std::vector<int32_t> previous_qp(candidates.size());
+        for (size_t c = 0; c < candidates.size(); ++c) {
+            RateBlockInfo& info = block_infos[candidates[c]];
+            previous_qp[c] = info.chosen_qp;
+            info.byte_budget += static_cast<uint64_t>(static_cast<double>(spare) * info.numWeights / candidate_weights);
+        }
+        parallel_for_pthreads(static_cast<int>(candidates.size()), num_threads, [&](int c, int) {
+            RateBlockInfo& info = block_infos[candidates[c]];
+            bisect_block_qp(info, info.qp_min, info.chosen_qp, info.chosen_bytes);
+        });
+        bool changed = false;
+        for (size_t c = 0; c < candidates.size(); ++c) changed |= block_infos[candidates[c]].chosen_qp != previous_qp[c];
+        if (!changed) break;
+    }
+    for (int block_idx : pooled) {
+        RateBlockInfo& info = block_infos[block_idx];
+        if (info.budget_met) info.byte_budget = info.chosen_bytes;
+    }
+
+    // Passos de um QP: mede o próximo QP de cada candidato e aplica os mais baratos.
+    // Quem não coube sai da lista (a sobra só diminui).
+    std::vector<int> candidates;
+    for (int block_idx : pooled) {
+        const RateBlockInfo& info = block_infos[block_idx];
+        if (info.budget_met && info.chosen_qp > info.qp_min) candidates.push_back(block_idx);
+    }
+    int resolved_threads = resolve_num_threads(num_threads);
+    std::vector<ScratchArenaLease> scratch(resolved_threads); // Uma arena por thread do parallel_for
+    for (int round = 0; round < kMaxPoolRounds && !candidates.empty(); ++round) {
+        uint64_t spare = spare_budget(block_infos, pooled, pool_budget);
+        std::vector<uint64_t> next_bytes(candidates.size());
+        parallel_for_pthreads(static_cast<int>(candidates.size()), resolved_threads, [&](int c, int thread_id) {
+            const RateBlockInfo& info = block_infos[candidates[c]];
+            next_bytes[c] = quantize_and_count_bytes(info, info.chosen_qp - 1, scratch[thread_id].arena());
+        });
+        std::vector<size_t> order(candidates.size());
+        for (size_t c = 0; c < order.size(); ++c) order[c] = c;
+        auto step_cost = [&](size_t c) {
+            uint64_t bytes = next_bytes[c], current = block_infos[candidates[c]].chosen_bytes;
+            return bytes > current ? bytes - current : 0;
+        };
+        std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return step_cost(a) < step_cost(b); });
+
+        std::vector<int> next_candidates;
+        for (size_t c : order) {
+            RateBlockInfo& info = block_infos[candidates[c]];
+            if (next_bytes[c] == std::numeric_limits<uint64_t>::max() || step_cost(c) > spare) continue;
+            spare -= step_cost(c);
+            info.chosen_qp -= 1;
+            info.chosen_bytes = next_bytes[c];
+            info.byte_budget = info.chosen_bytes;
+            if (info.chosen_qp > info.qp_min) next_candidates.push_back(candidates[c]);
+        }
+        candidates.swap(next_candidates);
+    }
+}
+
+py::list search_qps_for_budget(py::list py_block_info_list, const RateControlOptions& options) {
+
+    // 1. Extrair informações do Python
+    std::vector<RateBlockInfo> block_infos;
+    block_infos.reserve(py_block_info_list.size());
+    for (const auto& item : py_block_info_list) {
+        RateBlockInfo info = extract_rate_block(item.cast<py::dict>(), options);
+        block_infos.push_back(std::move(info));
+    }
+
+    // Blocos sem orçamento próprio dividem o do modelo (menos a margem): primeiro pelo
+    // número de pesos, depois o que os blocos fáceis não usaram volta para um fundo comum
+    std::vector<int> pooled;
+    uint64_t pooled_weights = 0;
+    for (size_t block_idx = 0; block_idx < block_infos.size(); ++block_idx) {
+        if (block_infos[block_idx].byte_budget > 0) continue;
+        if (options.model_byte_budget == 0) {
+            throw std::runtime_error("Sem byte_budget para " + block_infos[block_idx].param_name + " e sem orçamento do modelo");
+        }
+        pooled.push_back(static_cast<int>(block_idx));
+        pooled_weights += block_infos[block_idx].numWeights;
+    }
+    const uint64_t pool_budget = static_cast<uint64_t>(static_cast<double>(options.model_byte_budget) * (1.0 - options.budget_margin));
+    for (int block_idx : pooled) {
+        RateBlockInfo& info = block_infos[block_idx];
+        info.byte_budget = static_cast<uint64_t>(static_cast<double>(pool_budget) * info.numWeights / std::max<uint64_t>(pooled_weights, 1));
+    }
+
+    int num_blocks = static_cast<int>(block_infos.size());
+    std::cout << "[Pthreads RateControl] Buscando QPs para " << num_blocks << " blocos." << std::endl;
+    {
+        py::gil_scoped_release release_gil;
+        parallel_for_pthreads(num_blocks, options.num_threads, [&block_infos](int block_idx, int) {
+            RateBlockInfo& info = block_infos[block_idx];
+            bisect_block_qp(info, info.qp_min, info.qp_max, std::numeric_limits<uint64_t>::max());
+        });
+        redistribute_spare_budget(block_infos, pooled, pool_budget, options.num_threads);
+    }
+
+    // Monta a lista de resultados
+    py::list py_results;
+    for (const RateBlockInfo& info : block_infos) {
+        py::dict result_dict;
+        result_dict["param_name"] = info.param_name;
+        result_dict["qp"] = info.chosen_qp;
+        result_dict["bytes"] = info.chosen_bytes;
+        result_dict["byte_budget"] = info.byte_budget;
+        result_dict["budget_met"] = info.budget_met;
+        py_results.append(result_dict);
+    }
+    return py_results;
+}
+
+// Quantiza, mede a taxa com o BitCounter e a distorção com deQuantize
+static RDPoint compute_rd_point(const RateBlockInfo& info, int32_t qp, ScratchArena& scratch) {
+    RDPoint point;
+    point.bytes = 0;
+    point.distortion = 0.0;
+    float32_t qStepSize = qpToStepSize(info.qpDensity, qp);
+
+    BitCounter counter(info.maxNumNoRem, info.param_opt_flag);
+    for (const LayerSegment& seg : splitLayerIntoSegments(info.numWeights, info.layerWidth)) {
+        int32_t* levels = scratch.get<int32_t>(SCRATCH_QINDEX, seg.numWeights);
+        float32_t* recon = scratch.get<float32_t>(SCRATCH_RECON, seg.numWeights);
+        int32_t scan_order = segmentScanOrder(info.scan_order, seg);
+        const float32_t* pOrig = info.pWeights + seg.offset;
+        if (!quantize(info.pWeights + seg.offset, levels, qStepSize, seg.layerWidth, seg.numWeights, DIST_MSE, info.lambdaScale, info.dq_flag, info.maxNumNoRem, scan_order)) {
+            point.bytes = std::numeric_limits<uint64_t>::max();
+            point.distortion = std::numeric_limits<double>::max();
+            return point;
+        }
+        counter.addWeights(levels, seg.layerWidth, seg.numWeights, info.dq_flag, scan_order);
+        deQuantize(recon, levels, qStepSize, seg.numWeights, seg.layerWidth, scan_order);
+        for (uint32_t i = 0; i < seg.numWeights; ++i) {
+            double diff = static_cast<double>(recon[i]) - pOrig[i];
+            point.distortion += diff * diff;
+        }
+    }
+    point.bytes = (counter.finish() + 7) / 8;
+    return point;
+}
+
+RateDistortionAllocator::RateDistortionAllocator( py::list block_info_list, int num_threads )
+  : m_NumThreads( num_threads )
+{
+    RateControlOptions options;
+    for (const auto& item : block_info_list) {
+        m_Blocks.push_back(extract_rate_block(item.cast<py::dict>(), options));
+    }
+    m_Points.resize(m_Blocks.size());
+}
+
+void RateDistortionAllocator::compute( const std::vector<int32_t>& qps )
+{
+    // Pares (bloco, QP) que ainda não estão no cache
+    std::vector<std::pair<int, int32_t>> pending;
+    for (size_t block_idx = 0; block_idx < m_Blocks.size(); ++block_idx) {
+        for (int32_t qp : qps) {
+            if (m_Points[block_idx].count(qp) == 0) pending.push_back(std::make_pair(static_cast<int>(block_idx), qp));
+        }
+    }
+    if (pending.empty()) return;
+
+    std::cout << "[Pthreads RD] Calculando " << pending.size() << " pontos taxa/distorção." << std::endl;
+    std::vector<RDPoint> results(pending.size());
+    int num_threads = resolve_num_threads(m_NumThreads);
+    std::vector<ScratchArenaLease> scratch(num_threads); // Uma arena por thread do parallel_for
+    {
+        py::gil_scoped_release release_gil;
+        parallel_for_pthreads(static_cast<int>(pending.size()), num_threads, [&](int item, int thread_id) {
+            results[item] = compute_rd_point(m_Blocks[pending[item].first], pending[item].second, scratch[thread_id].arena());
+        });
+    }
+    for (size_t item = 0; item < pending.size(); ++item) {
+        m_Points[pending[item].first][pending[item].second] = results[item];
+    }
+}
+
+RateDistortionAllocator::Choice RateDistortionAllocator::choose( double lambda ) const
+{
+    Choice choice;
+    choice.bytes = 0;
+    choice.distortion = 0.0;
+    for (size_t block_idx = 0; block_idx < m_Blocks.size(); ++block_idx) {
+        const std::map<int32_t, RDPoint>& points = m_Points[block_idx];
+        if (points.empty()) {
+            throw std::runtime_error("Sem pontos R/D para " + m_Blocks[block_idx].param_name + "; chame compute() antes");
+        }
+        const RDPoint* best = nullptr;
+        int32_t best_qp = 0;
+        double best_cost = std::numeric_limits<double>::max();
+        for (const auto& entry : points) {
+            if (entry.second.bytes == std::numeric_limits<uint64_t>::max()) continue; // Overflow
+            double cost = entry.second.distortion + lambda * static_cast<double>(entry.second.bytes);
+            if (best == nullptr || cost < best_cost) {
+                best = &entry.second;
+                best_qp = entry.first;
+                best_cost = cost;
+            }
+        }
+        if (best == nullptr) {
+            throw std::runtime_error("Todos os QPs estouraram int32 para " + m_Blocks[block_idx].param_name);
+        }
+        choice.qps.push_back(best_qp);
+        choice.bytes += best->bytes;
+        choice.distortion += best->distortion;
+    }
+    return choice;
+}
+
+py::dict RateDistortionAllocator::allocate( uint64_t target_bytes, double target_distortion )
+{
+    if ((target_bytes > 0) == (target_distortion > 0.0)) {
+        throw std::runtime_error("Informe exatamente um entre target_bytes e target_distortion");
+    }
+    // A taxa total decresce e a distorção total cresce com lambda
+    const int max_doublings = 200;
+    const int bisection_steps = 64;
+
+    if (target_bytes > 0) {
+        // Menor lambda (menor distorção) cuja taxa total cabe em target_bytes
+        Choice best = choose(0.0);
+        if (best.bytes <= target_bytes) return toDict(best, true);
+        double lo = 0.0, hi = 1.0;
+        best = choose(hi);
+        for (int iter = 0; iter < max_doublings && best.bytes > target_bytes; ++iter) {
+            lo = hi;
+            hi *= 2.0;
+            best = choose(hi);
+        }
+        if (best.bytes > target_bytes) return toDict(best, false); // Nem a menor taxa cabe
+        for (int iter = 0; iter < bisection_steps; ++iter) {
+            double mid = 0.5 * (lo + hi);
+            Choice mid_choice = choose(mid);
+            if (mid_choice.bytes <= target_bytes) {
+                hi = mid;
+                best = mid_choice;
+            } else {
+                lo = mid;
+            }
+        }
+        return toDict(best, true);
+    }
+
+    // Maior lambda (menor taxa) cuja distorção total fica em target_distortion
+    Choice best = choose(0.0);
+    if (best.distortion > target_distortion) return toDict(best, false); // Nem a menor distorção atinge
+    double lo = 0.0, hi = 1.0;
+    Choice hi_choice = choose(hi);
+    for (int iter = 0; iter < max_doublings && hi_choice.distortion <= target_distortion; ++iter) {
+        lo = hi;
+        best = hi_choice;
+        hi *= 2.0;
+        hi_choice = choose(hi);
+    }
+    if (hi_choice.distortion <= target_distortion) return toDict(hi_choice, true);
+    for (int iter = 0; iter < bisection_steps; ++iter) {
+        double mid = 0.5 * (lo + hi);
+        Choice mid_choice = choose(mid);
+        if (mid_choice.distortion <= target_distortion) {
+            lo = mid;
+            best = mid_choice;
+        } else {
+            hi = mid;
+        }
+    }
+    return toDict(best, true);
+}
+
+py::dict RateDistortionAllocator::toDict( const Choice& choice, bool target_met ) const
+{
+    py::dict qps;
+    for (size_t block_idx = 0; block_idx < m_Blocks.size(); ++block_idx) {
+        qps[py::str(m_Blocks[block_idx].param_name)] = choice.qps[block_idx];
+    }
+    py::dict result;
+    result["qps"] = qps;
+    result["bytes"] = choice.bytes;
+    result["distortion"] = choice.distortion;
+    result["target_met"] = target_met;
+    return result;
+}
+
+py::list RateDistortionAllocator::points() const
+{
+    py::list py_points;
+    for (size_t block_idx = 0; block_idx < m_Blocks.size(); ++block_idx) {
+        py::list block_points;
+        for (const auto& entry : m_Points[block_idx]) {
+            block_points.append(py::make_tuple(entry.first, entry.second.bytes, entry.second.distortion));
+        }
+        py::dict block_dict;
+        block_dict["param_name"] = m_Blocks[block_idx].param_name;
+        block_dict["points"] = block_points;
+        py_points.append(block_dict);
+    }
+    return py_points;
+}
@@ -0,0 +1,86 @@
+#ifndef RATE_CONTROL_H
+#define RATE_CONTROL_H
+
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+#include <Lib/CommonLib/TypeDef.h>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace py = pybind11;
+
+// Opções da busca de QP por orçamento de bytes (search_qps_for_budget)
+struct RateControlOptions {
+    int      num_threads;        // 0 = usa std::thread::hardware_concurrency()
+    uint64_t model_byte_budget;  // Orçamento do modelo inteiro, repartido entre os blocos sem byte_budget próprio
+    double   budget_margin;      // Fração do orçamento do modelo reservada para o erro da estimativa
+    int32_t  qp_min;             // Intervalo de busca (cada bloco pode sobrescrever com "qp_min"/"qp_max")
+    int32_t  qp_max;
+    uint8_t  param_opt_flag;     // O mesmo do initCtxModels do encode (cada bloco pode sobrescrever)
+
+    RateControlOptions() : num_threads(0), model_byte_budget(0), budget_margin(0.02), qp_min(-128), qp_max(32), param_opt_flag(0) {}
+};
+
+// Bloco da busca de QP: mesmas chaves de quantize_all_blocks_parallel, mais
+// "byte_budget" (opcional quando há orçamento do modelo), "qp_min"/"qp_max" e "param_opt_flag"
+struct RateBlockInfo {
+    std::string param_name;
+    py::array_t<float32_t, py::array::c_style | py::array::forcecast> weights_array;
+    float32_t* pWeights;
+    uint64_t numWeights;
+    uint64_t layerWidth;
+    float32_t lambdaScale;
+    uint8_t dq_flag;
+    uint32_t maxNumNoRem;
+    uint8_t param_opt_flag;
+    int32_t scan_order;
+    int32_t qpDensity;
+    uint64_t byte_budget;
+    int32_t qp_min;
+    int32_t qp_max;
+
+    // Resultado
+    int32_t chosen_qp;
+    uint64_t chosen_bytes;
+    bool budget_met;
+};
+
+py::list search_qps_for_budget(py::list py_block_info_list, const RateControlOptions& options);
+
+// Ponto taxa/distorção de um bloco num QP
+struct RDPoint {
+    uint64_t bytes;       // UINT64_MAX se a quantização estourou int32
+    double   distortion;  // Soma dos erros quadráticos após quantização + dequantização
+};
+
+// Alocação de QPs do modelo inteiro por otimização Lagrangiana: calcula em paralelo
+// os pontos R/D de uma grade de QPs por bloco (guardados em cache por (bloco, QP))
+// e escolhe, para cada bloco, o QP que minimiza D + lambda * R, ajustando lambda
+// até atingir o tamanho (ou a distorção) alvo do modelo.
+class RateDistortionAllocator
+{
+public:
+  RateDistortionAllocator( py::list block_info_list, int num_threads );
+
+  void     compute  ( const std::vector<int32_t>& qps );          // Calcula os pontos que ainda não estão no cache
+  py::dict allocate ( uint64_t target_bytes, double target_distortion );
+  py::list points   () const;                                     // Pontos em cache, por bloco
+
+private:
+  struct Choice
+  {
+    std::vector<int32_t> qps;
+    uint64_t             bytes;
+    double               distortion;
+  };
+  Choice   choose   ( double lambda ) const;
+  py::dict toDict   ( const Choice& choice, bool target_met ) const;
+
+  std::vector<RateBlockInfo>               m_Blocks;
+  std::vector<std::map<int32_t, RDPoint>>  m_Points;   // Cache por bloco: QP -> ponto R/D
+  int                                      m_NumThreads;
+};
+
+#endif // RATE_CONTROL_H
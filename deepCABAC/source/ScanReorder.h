@@ -0,0 +1,121 @@
+#ifndef SCAN_REORDER_H
+#define SCAN_REORDER_H
+
+#include <cstdint>
+#include <cstring>
+#include <Lib/CommonLib/TypeDef.h>
+
+// Reordenação entre a ordem raster (linhas de layerWidth elementos) e a ordem da
+// varredura em blocos: blocos quadrados percorridos linha a linha, e dentro de cada
+// bloco as linhas em ordem; blocos da borda direita/inferior são cortados. Cada linha
+// de um bloco é copiada inteira (cópia de tamanho fixo, vetorizada), em grupos de blocos
+// vizinhos e com prefetch do grupo seguinte: a cópia custa perto de uma passada
+// raster, e quem percorre a varredura anda depois na sequência já contígua.
+//
+// Usado pelo BitCounter; quantize()/encodeWeights/decodeWeights/deQuantize da
+// biblioteca recebem scan_order e seguem o próprio iterador. A ordem (e a volta
+// reorderFromScan(reorderToScan(x)) == x) é verificada em tests/deepcabac_tests.cpp.
+
+// Lado do bloco de scan_order (1: 8x8, 2: 16x16, 3: 32x32, 4: 64x64); 0 = raster.
+// O maior bloco (64) é o kSegmentRowAlign de LayerSegments.h.
+inline uint32_t scanBlockSize( int32_t scan_order )
+{
+  return scan_order > 0 ? 4u << scan_order : 0;
+}
+
+#if defined( __GNUC__ ) || defined( __clang__ )
+#define SCAN_PREFETCH( ptr ) __builtin_prefetch( ptr )
+#else
+#define SCAN_PREFETCH( ptr ) ( (void) ( ptr ) )
+#endif
+
+// Núcleo com o lado do bloco constante: as linhas de blocos inteiros viram cópias de
+// tamanho fixo, que o compilador expande em instruções vetoriais sem chamar memcpy.
+// Os blocos de uma faixa são tratados em grupos de tileBlocks vizinhos, linha a linha:
+// cada linha lida (ou escrita) do lado raster cobre o grupo todo, e só tileBlocks
+// blocos da ordem da varredura ficam abertos ao mesmo tempo (64x64 float: 4 por grupo).
+template <typename T, uint32_t blockSize, bool toScan>
+inline void scanBlockCopyFixed( const T* src, T* dst, uint64_t rows, uint32_t layerWidth )
+{
+  const uint32_t tileBlocks = blockSize * blockSize * sizeof( T ) >= 8192 ? (uint32_t) ( blockSize * blockSize * sizeof( T ) / 4096 ) : 1;
+  uint64_t blockStart[16] = { 0 };  // Posição de cada bloco do grupo na ordem da varredura
+  uint32_t blockWidth[16] = { 0 };
+
+  uint64_t pos = 0;  // Posição na ordem da varredura
+  for( uint64_t row0 = 0; row0 < rows; row0 += blockSize )
+  {
+    uint32_t height = (uint32_t) ( rows - row0 < blockSize ? rows - row0 : blockSize );
+    for( uint32_t col0 = 0; col0 < layerWidth; col0 += blockSize * tileBlocks )
+    {
+      uint32_t numBlocks = 0;
+      for( uint32_t col = col0; col < layerWidth && numBlocks < tileBlocks; col += blockSize, numBlocks++ )
+      {
+        blockWidth[numBlocks] = layerWidth - col < blockSize ? layerWidth - col : blockSize;
+        blockStart[numBlocks] = pos;
+        pos += (uint64_t) blockWidth[numBlocks] * height;
+      }
+      uint32_t tileWidth = col0 + blockSize * numBlocks <= layerWidth ? blockSize * numBlocks : layerWidth - col0;
+      if( col0 + tileWidth < layerWidth )
+      {
+        // Linhas do próximo grupo do lado raster (lidas em toScan, escritas no inverso)
+        const T* next = ( toScan ? src : dst ) + row0 * layerWidth + col0 + tileWidth;
+        for( uint32_t r = 0; r < height; r++ ) { SCAN_PREFETCH( next + (uint64_t) r * layerWidth ); }
+      }
+      for( uint32_t r = 0; r < height; r++ )
+      {
+        uint64_t rasterPos = ( row0 + r ) * layerWidth + col0;
+        for( uint32_t b = 0; b < numBlocks; b++ )
+        {
+          uint64_t scanPos = blockStart[b] + (uint64_t) r * blockWidth[b];
+          const T* from    = toScan ? src + rasterPos : src + scanPos;
+          T*       to      = toScan ? dst + scanPos   : dst + rasterPos;
+          if( blockWidth[b] == blockSize ) { std::memcpy( to, from, blockSize * sizeof( T ) ); }
+          else                             { std::memcpy( to, from, blockWidth[b] * sizeof( T ) ); }
+          rasterPos += blockSize;
+        }
+      }
+    }
+  }
+}
+
+// toScan: raster -> varredura; senão varredura -> raster. Linhas incompletas no fim
+// (numWeights não múltiplo de layerWidth) ficam em ordem raster, depois dos blocos.
+template <typename T, bool toScan>
+inline void scanBlockCopy( const T* src, T* dst, uint32_t numWeights, uint32_t layerWidth, int32_t scan_order )
+{
+  uint32_t blockSize = scanBlockSize( scan_order );
+  uint64_t rows      = layerWidth > 0 ? numWeights / layerWidth : 0;
+  if( blockSize == 0 || layerWidth <= 1 || rows <= 1 )
+  {
+    std::memcpy( dst, src, (size_t) numWeights * sizeof( T ) );
+    return;
+  }
+
+  switch( blockSize )
+  {
+    case 8:  scanBlockCopyFixed<T, 8,  toScan>( src, dst, rows, layerWidth ); break;
+    case 16: scanBlockCopyFixed<T, 16, toScan>( src, dst, rows, layerWidth ); break;
+    case 32: scanBlockCopyFixed<T, 32, toScan>( src, dst, rows, layerWidth ); break;
+    case 64: scanBlockCopyFixed<T, 64, toScan>( src, dst, rows, layerWidth ); break;
+    default: CHECK( true, "Unsupported scan_order!" );
+  }
+  uint64_t blocked = rows * layerWidth;
+  if( numWeights > blocked )
+  {
+    std::memcpy( dst + blocked, src + blocked, (size_t) ( numWeights - blocked ) * sizeof( T ) );
+  }
+}
+
+template <typename T>
+inline void reorderToScan( const T* raster, T* scan, uint32_t numWeights, uint32_t layerWidth, int32_t scan_order )
+{
+  scanBlockCopy<T, true>( raster, scan, numWeights, layerWidth, scan_order );
+}
+
+template <typename T>
+inline void reorderFromScan( const T* scan, T* raster, uint32_t numWeights, uint32_t layerWidth, int32_t scan_order )
+{
+  scanBlockCopy<T, false>( scan, raster, numWeights, layerWidth, scan_order );
+}
+
+#endif // SCAN_REORDER_H
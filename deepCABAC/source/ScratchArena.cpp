@@ -0,0 +1,117 @@
+#include "ScratchArena.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+// Total reservado por todas as arenas; atualizado por quem está com a arena
+static std::atomic<uint64_t> s_ReservedBytes( 0 );
+
+// Conjunto global: todas as arenas já criadas e as que estão livres para empréstimo.
+// Criado sob demanda e nunca destruído, para que workers ainda vivos na saída do
+// processo não encontrem o conjunto já destruído.
+struct ScratchArenaSet
+{
+  std::mutex                                  mutex;
+  std::vector<std::unique_ptr<ScratchArena>>  all;
+  std::vector<ScratchArena*>                  free;
+};
+
+static ScratchArenaSet& arenaSet()
+{
+  static ScratchArenaSet* set = new ScratchArenaSet();
+  return *set;
+}
+
+ScratchArena::ScratchArena()
+{
+  for( int s = 0; s < SCRATCH_NUM_SLOTS; s++ )
+  {
+    m_Buffers[s] = nullptr;
+    m_Bytes[s]   = 0;
+  }
+}
+
+ScratchArena::~ScratchArena()
+{
+  trim( 0 );
+}
+
+void* ScratchArena::reserve( ScratchSlot slot, size_t bytes )
+{
+  if( bytes <= m_Bytes[slot] && m_Buffers[slot] != nullptr )
+  {
+    return m_Buffers[slot];
+  }
+  // Cresce pelo menos 50%: segmentos de tamanhos crescentes não realocam a cada bloco
+  size_t newBytes = m_Bytes[slot] + m_Bytes[slot] / 2;
+  if( newBytes < bytes ) { newBytes = bytes; }
+  if( newBytes == 0 )    { newBytes = 1; }
+  void* ptr = std::malloc( newBytes );
+  if( ptr == nullptr ) { throw std::bad_alloc(); }
+  std::free( m_Buffers[slot] );
+  s_ReservedBytes += newBytes - m_Bytes[slot];
+  m_Buffers[slot] = ptr;
+  m_Bytes[slot]   = newBytes;
+  return ptr;
+}
+
+void ScratchArena::trim( size_t keepBytes )
+{
+  for( int s = 0; s < SCRATCH_NUM_SLOTS; s++ )
+  {
+    if( m_Bytes[s] > keepBytes )
+    {
+      std::free( m_Buffers[s] );
+      s_ReservedBytes -= m_Bytes[s];
+      m_Buffers[s] = nullptr;
+      m_Bytes[s]   = 0;
+    }
+  }
+}
+
+size_t ScratchArena::reservedBytes() const
+{
+  size_t total = 0;
+  for( int s = 0; s < SCRATCH_NUM_SLOTS; s++ ) { total += m_Bytes[s]; }
+  return total;
+}
+
+ScratchArenaLease::ScratchArenaLease()
+{
+  ScratchArenaSet& set = arenaSet();
+  std::lock_guard<std::mutex> lock( set.mutex );
+  if( set.free.empty() )
+  {
+    set.all.emplace_back( new ScratchArena() );
+    m_Arena = set.all.back().get();
+  }
+  else
+  {
+    m_Arena = set.free.back();
+    set.free.pop_back();
+  }
+}
+
+ScratchArenaLease::~ScratchArenaLease()
+{
+  m_Arena->trim( kScratchKeepBytes ); // Fora da trava: free de buffers grandes pode demorar
+  ScratchArenaSet& set = arenaSet();
+  std::lock_guard<std::mutex> lock( set.mutex );
+  set.free.push_back( m_Arena );
+}
+
+void trimScratchArenas( size_t keepBytes )
+{
+  ScratchArenaSet& set = arenaSet();
+  std::lock_guard<std::mutex> lock( set.mutex );
+  for( ScratchArena* arena : set.free ) { arena->trim( keepBytes ); }
+}
+
+uint64_t scratchArenasReservedBytes()
+{
+  return s_ReservedBytes.load();
+}
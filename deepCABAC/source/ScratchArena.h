@@ -0,0 +1,73 @@
+#ifndef SCRATCH_ARENA_H
+#define SCRATCH_ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Arenas de rascunho para os temporários do caminho paralelo (níveis int32 antes do
+// estreitamento, delta contra a referência, reconstrução da taxa-distorção, níveis
+// alargados do encoder/decoder). Cada worker empresta uma arena do conjunto global
+// enquanto roda: os buffers crescem uma vez e são reusados entre blocos e entre
+// chamadas, sem malloc/free por bloco disputando o alocador entre as threads.
+// Ao devolver a arena, os slots maiores que kScratchKeepBytes são liberados: um
+// segmento grande não deixa a memória dele reservada por thread depois da chamada.
+
+static const size_t kScratchKeepBytes = 1 << 20;
+
+enum ScratchSlot
+{
+  SCRATCH_QINDEX = 0,   // Níveis int32 de um segmento
+  SCRATCH_DELTA,        // Pesos - referência (modo delta)
+  SCRATCH_RECON,        // Pesos reconstruídos (medida de distorção)
+  SCRATCH_LEVELS,       // Níveis alargados/estreitados no encoder/decoder
+  SCRATCH_NUM_SLOTS
+};
+
+class ScratchArena
+{
+public:
+  ScratchArena();
+  ~ScratchArena();
+
+  // Buffer do slot com espaço para count elementos. O conteúdo anterior não é preservado
+  // e o ponteiro vale até o próximo get do mesmo slot (ou trim).
+  template <typename T>
+  T*     get          ( ScratchSlot slot, size_t count ) { return static_cast<T*>( reserve( slot, count * sizeof( T ) ) ); }
+  void   trim         ( size_t keepBytes );       // Libera os slots maiores que keepBytes
+  size_t reservedBytes() const;
+
+private:
+  ScratchArena( const ScratchArena& );
+  ScratchArena& operator=( const ScratchArena& );
+
+  void*  reserve      ( ScratchSlot slot, size_t bytes );
+
+  void*  m_Buffers[SCRATCH_NUM_SLOTS];
+  size_t m_Bytes  [SCRATCH_NUM_SLOTS];
+};
+
+// Empresta uma arena do conjunto global durante o escopo. Uma arena só é usada por
+// um worker de cada vez, então get() não precisa de trava. No fim do escopo a arena
+// é aparada para kScratchKeepBytes por slot e volta ao conjunto.
+class ScratchArenaLease
+{
+public:
+  ScratchArenaLease();
+  ~ScratchArenaLease();
+
+  ScratchArena& arena()      { return *m_Arena; }
+  ScratchArena* operator->() { return m_Arena; }
+
+private:
+  ScratchArenaLease( const ScratchArenaLease& );
+  ScratchArenaLease& operator=( const ScratchArenaLease& );
+
+  ScratchArena* m_Arena;
+};
+
+// Libera, nas arenas que não estão emprestadas, os slots maiores que keepBytes
+void     trimScratchArenas( size_t keepBytes );
+// Total reservado por todas as arenas (emprestadas ou não)
+uint64_t scratchArenasReservedBytes();
+
+#endif // SCRATCH_ARENA_H
@@ -1,32 +1,135 @@
 #include <pybind11/pybind11.h>
 #include <pybind11/numpy.h>
+#include <pybind11/stl.h>
 #include <Lib/CommonLib/TypeDef.h>
 #include <Lib/CommonLib/Quant.h>
 #include <Lib/EncLib/CABACEncoder.h>
 #include <Lib/DecLib/CABACDecoder.h>
 #include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <limits>
+#include <vector>
 #include <math.h>
 #include <pybind11/pybind11.h>
+#include "ParallelQuant.h"
+#include "OutputArena.h"
+#include "LayerSegments.h"
+#include "LayerCoder.h"
+#include "RateControl.h"
+#include "BitCounter.h"
+#include "Pipeline.h"
+#include "QuantSession.h"
+#include "QuantFuture.h"
+#include "ScratchArena.h"
 
 namespace py = pybind11;
-py::list quantize_all_blocks_parallel_pthreads(py::list py_block_info_list);
+
+// Snapshot of an Encoder's CABAC state: context models and arithmetic coder, plus the
+// length of the bytestream at that point (the bytes themselves are not copied)
+struct EncoderContexts
+{
+  uint64_t              originId;
+  size_t                bytestreamSize;
+  size_t                rewindCount;      // Rewinds of the origin encoder before the snapshot
+  CABACEncoder          cabacEncoder;
+};
+
+// Snapshot of a Decoder's CABAC state; keeps the bitstream it reads from alive
+struct DecoderContexts
+{
+  py::object            stream;
+  CABACDecoder          cabacDecoder;
+};
 
 class Encoder
 {
 public:
-  Encoder() { m_CABACEncoder.startCabacEncoding( &m_Bytestream ); }
+  Encoder() : m_Id( ++s_NextId ), m_NumRewinds( 0 ), m_UnaryLengthMinus1( 10 ), m_ParamOptFlag( 0 ) { m_CABACEncoder.startCabacEncoding( &m_Bytestream ); }
   ~Encoder() {}
-  void                  initCtxModels(uint32_t cabac_unary_length_minus1, uint8_t param_opt_flag) { m_CABACEncoder.initCtxMdls(cabac_unary_length_minus1+1, param_opt_flag); }
+  void                  initCtxModels(uint32_t cabac_unary_length_minus1, uint8_t param_opt_flag)
+  {
+    m_CABACEncoder.initCtxMdls(cabac_unary_length_minus1+1, param_opt_flag);
+    m_UnaryLengthMinus1 = cabac_unary_length_minus1;
+    m_ParamOptFlag      = param_opt_flag;
+  }
   void                  iae_v( uint8_t v, int32_t value )            { m_CABACEncoder.iae_v( v, value ); }
   void                  uae_v( uint8_t v, uint32_t value )           { m_CABACEncoder.uae_v( v, value ); }
   uint32_t              encodeLayer( py::array_t<int32_t, py::array::c_style> qindex, uint8_t dq_flag, int32_t scan_order  );
+  template <typename T>
+  uint32_t              encodeLayerNarrow( py::array_t<T, py::array::c_style> qindex, uint8_t dq_flag, int32_t scan_order );
+  uint64_t              estimateLayerBits( py::array_t<int32_t, py::array::c_style> qindex, uint8_t dq_flag, int32_t scan_order );
   int32_t               quantLayer( py::array_t<float32_t, py::array::c_style> Weights, py::array_t<int32_t, py::array::c_style> qIndex, uint8_t dq_flag, int32_t qpDensity, int32_t qp,float32_t lambdaScale, uint32_t maxNumNoRem, int32_t scan_order );
+  std::shared_ptr<EncoderContexts> saveContexts() const;
+  void                  restoreContexts( const EncoderContexts& snapshot );
   py::array_t<uint8_t>  finish();
+  // Encodes native int32 levels without touching Python (encode stage of quantize_and_encode_pipelined)
+  uint32_t              encodeSegments( int32_t* pQindex, uint64_t numWeights, uint64_t layerWidth, uint8_t dq_flag, int32_t scan_order );
 private:
   std::vector<uint8_t>  m_Bytestream;
   CABACEncoder          m_CABACEncoder;
+  uint64_t              m_Id;
+  // Rewinds as (rewind number, bytestream length cut to), kept with increasing lengths:
+  // the first entry at or after a rewind number is the shortest cut since then
+  std::vector<std::pair<size_t, size_t>> m_Rewinds;
+  size_t                m_NumRewinds;
+  // Binarization settings of the last initCtxModels, used by estimateLayerBits
+  uint32_t              m_UnaryLengthMinus1;
+  uint8_t               m_ParamOptFlag;
+
+  void                  recordRewind( size_t length );
+
+  static std::atomic<uint64_t> s_NextId;
 };
 
+std::atomic<uint64_t> Encoder::s_NextId( 0 );
+
+std::shared_ptr<EncoderContexts> Encoder::saveContexts() const
+{
+  std::shared_ptr<EncoderContexts> snapshot = std::make_shared<EncoderContexts>();
+  snapshot->originId       = m_Id;
+  snapshot->bytestreamSize = m_Bytestream.size();
+  snapshot->rewindCount    = m_NumRewinds;
+  snapshot->cabacEncoder   = m_CABACEncoder;
+  return snapshot;
+}
+
+// On the encoder the snapshot was taken from, this rewinds the complete coding state:
+// bytes the coder has not flushed yet are part of the copied CABACEncoder, and flushed
+// bytes are only ever appended, so cutting the bytestream back to the snapshot length
+// restores it. That holds as long as no later rewind cut below that length.
+// On any other encoder it adopts the context models only and restarts arithmetic coding
+// into an empty bytestream, so trial encodes can start from a common state on several
+// encoders (and threads) without replaying the earlier layers.
+void Encoder::restoreContexts( const EncoderContexts& snapshot )
+{
+  if( snapshot.originId == m_Id )
+  {
+    auto shortestCut = std::lower_bound( m_Rewinds.begin(), m_Rewinds.end(), std::make_pair( snapshot.rewindCount, (size_t) 0 ) );
+    CHECK( shortestCut != m_Rewinds.end() && shortestCut->second < snapshot.bytestreamSize, "Snapshot was invalidated by restoring an earlier snapshot!" );
+    m_CABACEncoder = snapshot.cabacEncoder;
+    m_Bytestream.resize( snapshot.bytestreamSize );
+    recordRewind( snapshot.bytestreamSize );
+  }
+  else
+  {
+    m_CABACEncoder = snapshot.cabacEncoder;
+    m_Bytestream.clear();
+    recordRewind( 0 );
+    m_CABACEncoder.startCabacEncoding( &m_Bytestream );
+  }
+}
+
+void Encoder::recordRewind( size_t length )
+{
+  while( !m_Rewinds.empty() && m_Rewinds.back().second >= length )
+  {
+    m_Rewinds.pop_back();
+  }
+  m_Rewinds.push_back( std::make_pair( m_NumRewinds++, length ) );
+}
+
 int32_t Encoder::quantLayer(py::array_t<float32_t, py::array::c_style> Weights, py::array_t<int32_t, py::array::c_style> qIndex, uint8_t dq_flag, int32_t qpDensity, int32_t qp, float32_t lambdaScale, uint32_t maxNumNoRem, int32_t scan_order )
 {
   py::buffer_info bi_Weights = Weights.request();
@@ -34,69 +137,69 @@ int32_t Encoder::quantLayer(py::array_t<float32_t, py::array::c_style> Weights,
   float32_t* pWeights          = (float32_t*) bi_Weights.ptr;
   int32_t* pQIndex = (int32_t*) bi_qIndex.ptr;
 
-  uint32_t layerWidth = 1;
-  uint32_t numWeights = 1;
-  for (size_t idx = 0; idx < (size_t)bi_Weights.ndim; idx++)
-  {
-    numWeights *= bi_Weights.shape[idx];
-    if( idx == 0 ) { continue; }
-    layerWidth *= bi_Weights.shape[idx];
-  }
-  if( layerWidth == 1 || numWeights == layerWidth )
-      scan_order = 0;
-      
-  int32_t k = 1 << qpDensity;
-  int32_t mul = k + (qp & (k-1));
-  int32_t shift = qp >> qpDensity;
-  float32_t qStepSize = mul * pow(2.0, shift - qpDensity);
+  uint64_t layerWidth, numWeights;
+  getLayerDims( bi_Weights.shape, numWeights, layerWidth );
 
-  int32_t success = quantize(pWeights, pQIndex, qStepSize, layerWidth, numWeights, DIST_MSE, lambdaScale, dq_flag, maxNumNoRem, scan_order);
+  return quantizeLayer( pWeights, pQIndex, numWeights, layerWidth, qpDensity, qp, lambdaScale, dq_flag, maxNumNoRem, scan_order );
+}
 
-  if( !success )
-  {
-    float32_t maxAbs = 0.0;
+uint32_t Encoder::encodeSegments( int32_t* pQindex, uint64_t numWeights, uint64_t layerWidth, uint8_t dq_flag, int32_t scan_order )
+{
+  return encodeLayerLevels( m_CABACEncoder, pQindex, numWeights, layerWidth, dq_flag, scan_order );
+}
 
-    for(uint32_t i = 0; i < numWeights; i++)
-    {
-      if( abs( pWeights[i] ) > maxAbs )
-      {
-        maxAbs = abs(pWeights[i]);
-      }
-    }
+uint32_t Encoder::encodeLayer( py::array_t<int32_t, py::array::c_style> qindex, uint8_t dq_flag, int32_t scan_order )
+{
+  py::buffer_info bi_qindex = qindex.request();
+  int32_t* pQindex          = (int32_t*) bi_qindex.ptr;
 
-    double minStepsize = (double)(maxAbs) / ((double)((1u << 31) - 3));
+  uint64_t layerWidth, numWeights;
+  getLayerDims( bi_qindex.shape, numWeights, layerWidth );
 
-    float32_t baseQP = floor(log2(minStepsize)) * k;
-    float32_t newQp = baseQP + ((minStepsize * k) / pow(2.0, (baseQP / k)) - k);
-    qp = (int32_t)(ceil(newQp));
+  py::gil_scoped_release release_gil;
+  return encodeSegments(pQindex, numWeights, layerWidth, dq_flag, scan_order);
+}
+
+uint64_t Encoder::estimateLayerBits( py::array_t<int32_t, py::array::c_style> qindex, uint8_t dq_flag, int32_t scan_order )
+{
+  py::buffer_info bi_qindex = qindex.request();
+  int32_t* pQindex          = (int32_t*) bi_qindex.ptr;
 
-    mul = k + (qp & (k - 1));
-    shift = qp >> qpDensity;
-    qStepSize = mul * pow(2.0, shift - qpDensity);
+  uint64_t layerWidth, numWeights;
+  getLayerDims( bi_qindex.shape, numWeights, layerWidth );
 
-    success = quantize(pWeights, pQIndex, qStepSize, layerWidth, numWeights, DIST_MSE, lambdaScale, dq_flag, maxNumNoRem, scan_order);
-    CHECK( !success, "Prevention of integer-overflow failed!");
+  // Sums fractional bits from the counter's own fresh contexts (same binarization as
+  // initCtxModels); no arithmetic coding, and this encoder's state is left untouched
+  BitCounter counter( m_UnaryLengthMinus1, m_ParamOptFlag );
+  py::gil_scoped_release release_gil;
+  for( const LayerSegment& seg : splitLayerIntoSegments( numWeights, layerWidth ) )
+  {
+    counter.addWeights(pQindex + seg.offset, seg.layerWidth, seg.numWeights, dq_flag, segmentScanOrder( scan_order, seg ));
   }
-  return qp;
+  return counter.finish();
 }
 
-uint32_t Encoder::encodeLayer( py::array_t<int32_t, py::array::c_style> qindex, uint8_t dq_flag, int32_t scan_order )
+template <typename T>
+uint32_t Encoder::encodeLayerNarrow( py::array_t<T, py::array::c_style> qindex, uint8_t dq_flag, int32_t scan_order )
 {
   py::buffer_info bi_qindex = qindex.request();
-  int32_t* pQindex          = (int32_t*) bi_qindex.ptr;
+  T* pQindex                = (T*) bi_qindex.ptr;
+
+  uint64_t layerWidth, numWeights;
+  getLayerDims( bi_qindex.shape, numWeights, layerWidth );
 
-  uint32_t layerWidth = 1;
-  uint32_t numWeights = 1;
-  for( size_t idx = 0; idx < (size_t)bi_qindex.ndim; idx++ )
+  // The CABAC engine codes one int32 array per call, so each segment (at most
+  // kMaxSegmentWeights levels) is widened into scratch (released when the call returns)
+  py::gil_scoped_release release_gil;
+  uint32_t result = 0;
+  ScratchArenaLease scratch;
+  for( const LayerSegment& seg : splitLayerIntoSegments( numWeights, layerWidth ) )
   {
-    numWeights *= bi_qindex.shape[idx];
-    if( idx == 0 ) { continue; }
-    layerWidth *= bi_qindex.shape[idx];
+    int32_t* levels = scratch->get<int32_t>( SCRATCH_LEVELS, seg.numWeights );
+    std::copy( pQindex + seg.offset, pQindex + seg.offset + seg.numWeights, levels );
+    result += m_CABACEncoder.encodeWeights(levels, seg.layerWidth, seg.numWeights, dq_flag, segmentScanOrder( scan_order, seg ));
   }
-  if( layerWidth == 1 || numWeights == layerWidth )
-      scan_order = 0;
-
-  return m_CABACEncoder.encodeWeights(pQindex, layerWidth, numWeights, dq_flag, scan_order);
+  return result;
 }
 
 py::array_t<uint8_t> Encoder::finish()
@@ -121,6 +224,8 @@ public:
   ~Decoder() {}
 
   void     setStream    ( py::array_t<uint8_t, py::array::c_style> Bytestream );
+  std::shared_ptr<DecoderContexts> saveContexts() const;
+  void     restoreContexts( const DecoderContexts& snapshot );
   void     initCtxModels( uint32_t cabac_unary_length_minus1 ) { m_CABACDecoder.initCtxMdls( cabac_unary_length_minus1+1 ); }
   int32_t  iae_v        (uint8_t v) { return m_CABACDecoder.iae_v(v); }
   uint32_t uae_v        ( uint8_t v )                   { return m_CABACDecoder.uae_v( v ); }
@@ -128,11 +233,25 @@ public:
   py::array_t<uint64_t> decodeLayerAndCreateEPs(py::array_t<int32_t, py::array::c_style> Weights, uint8_t dq_flag, int32_t scan_order); //Return value -> Array? Ptr?
   void     setEntryPoints( py::array_t<uint64_t, py::array::c_style> entryPoints);
   void     decodeLayer  ( py::array_t<int32_t, py::array::c_style> Weights, uint8_t dq_flag, int32_t scan_order );
-  void     dequantLayer ( py::array_t<float32_t, py::array::c_style> Weights, py::array_t<int32_t, py::array::c_style> qIndex, int32_t qpDensity, int32_t qp, int32_t scan_order);
+  template <typename T>
+  void     decodeLayerNarrow( py::array_t<T, py::array::c_style> Weights, uint8_t dq_flag, int32_t scan_order );
+  py::dict decodeLayerSparse( std::vector<int64_t> shape, uint8_t dq_flag, int32_t scan_order, const std::string& format, bool dequantize, int32_t qpDensity, int32_t qp );
+  void     dequantLayer ( py::array_t<float32_t, py::array::c_style> Weights, py::array_t<int32_t, py::array::c_style> qIndex, int32_t qpDensity, int32_t qp, int32_t scan_order, int num_threads );
+  template <typename T>
+  void     dequantLayerNarrow( py::array_t<float32_t, py::array::c_style> Weights, py::array_t<T, py::array::c_style> qIndex, int32_t qpDensity, int32_t qp, int32_t scan_order, int num_threads );
+  template <typename T>
+  void     dequantLayerDelta( py::array_t<float32_t, py::array::c_style> Weights, py::array_t<T, py::array::c_style> qIndex, int32_t qpDensity, int32_t qp, int32_t scan_order,
+                              py::array_t<float32_t, py::array::c_style | py::array::forcecast> reference, int num_threads );
   uint32_t finish       ();
 
 private:
+  void     dequantLevels( py::array_t<float32_t, py::array::c_style> Weights, py::array_t<int32_t, py::array::c_style> qIndex, int32_t qpDensity, int32_t qp, int32_t scan_order, int num_threads ) { dequantLayer( Weights, qIndex, qpDensity, qp, scan_order, num_threads ); }
+  template <typename T>
+  void     dequantLevels( py::array_t<float32_t, py::array::c_style> Weights, py::array_t<T, py::array::c_style> qIndex, int32_t qpDensity, int32_t qp, int32_t scan_order, int num_threads ) { dequantLayerNarrow<T>( Weights, qIndex, qpDensity, qp, scan_order, num_threads ); }
+  void     decodeSegments( int32_t* pWeights, uint64_t numWeights, uint64_t layerWidth, uint8_t dq_flag, int32_t scan_order );
+
   CABACDecoder  m_CABACDecoder;
+  py::object    m_Stream;
 };
 
 void Decoder::setStream( py::array_t<uint8_t, py::array::c_style> Bytestream )
@@ -140,6 +259,23 @@ void Decoder::setStream( py::array_t<uint8_t, py::array::c_style> Bytestream )
   py::buffer_info bi_Bytestream = Bytestream.request();
   uint8_t* pBytestream          = (uint8_t*) bi_Bytestream.ptr;
   m_CABACDecoder.startCabacDecoding( pBytestream );
+  m_Stream = Bytestream;
+}
+
+std::shared_ptr<DecoderContexts> Decoder::saveContexts() const
+{
+  std::shared_ptr<DecoderContexts> snapshot = std::make_shared<DecoderContexts>();
+  snapshot->stream       = m_Stream;
+  snapshot->cabacDecoder = m_CABACDecoder;
+  return snapshot;
+}
+
+// The decoder state points into the external bitstream, so a snapshot can be restored
+// into any Decoder: it continues reading exactly where the snapshot was taken.
+void Decoder::restoreContexts( const DecoderContexts& snapshot )
+{
+  m_CABACDecoder = snapshot.cabacDecoder;
+  m_Stream       = snapshot.stream;
 }
 
 py::array_t<uint64_t> Decoder::decodeLayerAndCreateEPs(py::array_t<int32_t, py::array::c_style> Weights, uint8_t dq_flag, int32_t scan_order)
@@ -148,21 +284,13 @@ py::array_t<uint64_t> Decoder::decodeLayerAndCreateEPs(py::array_t<int32_t, py::
   py::buffer_info bi_Weights = Weights.request();
 
   int32_t *pWeights = (int32_t *)bi_Weights.ptr;
-  uint32_t layerWidth = 1;
-  uint32_t numWeights = 1;
-  for (size_t idx = 0; idx < (size_t)bi_Weights.ndim; idx++)
+  uint64_t layerWidth, numWeights;
+  getLayerDims( bi_Weights.shape, numWeights, layerWidth );
+
+  for( const LayerSegment& seg : splitLayerIntoSegments( numWeights, layerWidth ) )
   {
-    numWeights *= bi_Weights.shape[idx];
-    if (idx == 0)
-    {
-      continue;
-    }
-    layerWidth *= bi_Weights.shape[idx];
+    m_CABACDecoder.decodeWeightsAndCreateEPs(pWeights + seg.offset, seg.layerWidth, seg.numWeights, dq_flag, segmentScanOrder( scan_order, seg ), entryPoints);
   }
-  if (layerWidth == 1 || numWeights == layerWidth)
-    scan_order = 0;
-
-  m_CABACDecoder.decodeWeightsAndCreateEPs(pWeights, layerWidth, numWeights, dq_flag, scan_order, entryPoints);
 
   auto Result = py::array_t<uint64_t, py::array::c_style>(entryPoints.size());
   py::buffer_info bi_Result = Result.request();
@@ -191,51 +319,138 @@ void Decoder::setEntryPoints(py::array_t<uint64_t, py::array::c_style> entryPoin
   m_CABACDecoder.setEntryPoints(pEntryPoints, numEntryPoints);
 }
 
+void Decoder::decodeSegments( int32_t* pWeights, uint64_t numWeights, uint64_t layerWidth, uint8_t dq_flag, int32_t scan_order )
+{
+  decodeLayerLevels( m_CABACDecoder, pWeights, numWeights, layerWidth, dq_flag, scan_order );
+}
+
 void Decoder::decodeLayer( py::array_t<int32_t, py::array::c_style> Weights , uint8_t dq_flag, int32_t scan_order )    
 {
   py::buffer_info bi_Weights = Weights.request();
 
   int32_t* pWeights   = (int32_t*) bi_Weights.ptr;
-  uint32_t layerWidth = 1;
-  uint32_t numWeights = 1;
-  for (size_t idx = 0; idx < (size_t)bi_Weights.ndim; idx++)
+  uint64_t layerWidth, numWeights;
+  getLayerDims( bi_Weights.shape, numWeights, layerWidth );
+
+  decodeSegments(pWeights, numWeights, layerWidth, dq_flag, scan_order);
+}
+
+template <typename T>
+void Decoder::decodeLayerNarrow( py::array_t<T, py::array::c_style> Weights, uint8_t dq_flag, int32_t scan_order )
+{
+  py::buffer_info bi_Weights = Weights.request();
+
+  T* pWeights         = (T*) bi_Weights.ptr;
+  uint64_t layerWidth, numWeights;
+  getLayerDims( bi_Weights.shape, numWeights, layerWidth );
+
+  // Decoded segment by segment into int32 scratch (at most kMaxSegmentWeights levels)
+  py::gil_scoped_release release_gil;
+  ScratchArenaLease scratch;
+  for( const LayerSegment& seg : splitLayerIntoSegments( numWeights, layerWidth ) )
   {
-    numWeights *= bi_Weights.shape[idx];
-    if( idx == 0 ) { continue; }
-    layerWidth *= bi_Weights.shape[idx];
+    int32_t* levels = scratch->get<int32_t>( SCRATCH_LEVELS, seg.numWeights );
+    m_CABACDecoder.decodeWeights(levels, seg.layerWidth, seg.numWeights, dq_flag, segmentScanOrder( scan_order, seg ));
+    for( uint32_t i = 0; i < seg.numWeights; i++ )
+    {
+      CHECK( levels[i] < std::numeric_limits<T>::min() || levels[i] > std::numeric_limits<T>::max(), "Decoded level does not fit into the narrow qindex type!" );
+      pWeights[seg.offset + i] = (T) levels[i];
+    }
   }
-  if( layerWidth == 1 || numWeights == layerWidth )
-      scan_order = 0;
-  m_CABACDecoder.decodeWeights(pWeights, layerWidth, numWeights, dq_flag, scan_order);
 }
 
 
-void Decoder::dequantLayer(py::array_t<float32_t, py::array::c_style> Weights, py::array_t<int32_t, py::array::c_style> qIndex, int32_t qpDensity, int32_t qp, int32_t scan_order)
+// Hands a vector over to NumPy without copying it: the array owns the heap-allocated vector
+template <typename T>
+static py::array_t<T> moveToArray( std::vector<T>& data )
+{
+  std::vector<T>* owner = new std::vector<T>( std::move( data ) );
+  py::capsule base( owner, []( void* o ) { delete static_cast<std::vector<T>*>( o ); } );
+  return py::array_t<T>( (py::ssize_t) owner->size(), owner->data(), base );
+}
+
+// Decodes the next layer straight into CSR ("indptr", "indices", "data") or COO ("row", "col", "data"),
+// keys as in scipy.sparse. The matrix has shape[0] rows; data holds levels, or weights with dequantize.
+py::dict Decoder::decodeLayerSparse( std::vector<int64_t> shape, uint8_t dq_flag, int32_t scan_order, const std::string& format, bool dequantize, int32_t qpDensity, int32_t qp )
+{
+  CHECK( format != "csr" && format != "coo", "Sparse format must be 'csr' or 'coo'!" );
+  bool coo = format == "coo";
+  uint64_t layerWidth, numWeights;
+  getLayerDims( shape, numWeights, layerWidth );
+
+  SparseLayer sparse;
+  {
+    py::gil_scoped_release release_gil;
+    ::decodeLayerSparse( m_CABACDecoder, numWeights, layerWidth, dq_flag, scan_order, coo, dequantize, qpDensity, qp, sparse );
+  }
+
+  py::dict result;
+  result["format"] = format;
+  result["shape"]  = py::make_tuple( sparse.numRows, sparse.numCols );
+  if( coo )
+  {
+    result["row"] = moveToArray( sparse.rowIndex );
+    result["col"] = moveToArray( sparse.colIndex );
+  }
+  else
+  {
+    result["indptr"]  = moveToArray( sparse.rowPtr );
+    result["indices"] = moveToArray( sparse.colIndex );
+  }
+  if( dequantize ) { result["data"] = moveToArray( sparse.values ); }
+  else             { result["data"] = moveToArray( sparse.levels ); }
+  return result;
+}
+
+// num_threads != 1 splits large layers into row ranges dequantized in parallel (0 = all hardware threads)
+void Decoder::dequantLayer(py::array_t<float32_t, py::array::c_style> Weights, py::array_t<int32_t, py::array::c_style> qIndex, int32_t qpDensity, int32_t qp, int32_t scan_order, int num_threads)
 {
   py::buffer_info bi_Weights = Weights.request();
   py::buffer_info bi_qIndex = qIndex.request();
 
   float32_t *pWeights = (float32_t *)bi_Weights.ptr;
   int32_t *pQIndex = (int32_t *)bi_qIndex.ptr;
-  uint32_t layerWidth = 1;
-  uint32_t numWeights = 1;
-  for (size_t idx = 0; idx < (size_t)bi_Weights.ndim; idx++)
+  uint64_t layerWidth, numWeights;
+  getLayerDims( bi_Weights.shape, numWeights, layerWidth );
+
+  py::gil_scoped_release release_gil;
+  dequantizeLayer( pWeights, pQIndex, numWeights, layerWidth, qpDensity, qp, scan_order, num_threads );
+}
+
+template <typename T>
+void Decoder::dequantLayerNarrow(py::array_t<float32_t, py::array::c_style> Weights, py::array_t<T, py::array::c_style> qIndex, int32_t qpDensity, int32_t qp, int32_t scan_order, int num_threads)
+{
+  py::buffer_info bi_Weights = Weights.request();
+  py::buffer_info bi_qIndex = qIndex.request();
+
+  float32_t *pWeights = (float32_t *)bi_Weights.ptr;
+  const T* pQIndex = (const T*) bi_qIndex.ptr;
+  uint64_t layerWidth, numWeights;
+  getLayerDims( bi_Weights.shape, numWeights, layerWidth );
+
+  // Levels are widened one row range at a time inside dequantizeLayer
+  py::gil_scoped_release release_gil;
+  dequantizeLayer( pWeights, pQIndex, numWeights, layerWidth, qpDensity, qp, scan_order, num_threads );
+}
+
+// Delta mode: the levels code w - w_ref, so the reference reconstruction is added back
+template <typename T>
+void Decoder::dequantLayerDelta(py::array_t<float32_t, py::array::c_style> Weights, py::array_t<T, py::array::c_style> qIndex, int32_t qpDensity, int32_t qp, int32_t scan_order,
+                                py::array_t<float32_t, py::array::c_style | py::array::forcecast> reference, int num_threads)
+{
+  dequantLevels( Weights, qIndex, qpDensity, qp, scan_order, num_threads );
+
+  py::buffer_info bi_Weights   = Weights.request();
+  py::buffer_info bi_Reference = reference.request();
+  CHECK( bi_Reference.size != bi_Weights.size, "Reference does not match the layer size!" );
+
+  float32_t*       pWeights   = (float32_t*) bi_Weights.ptr;
+  const float32_t* pReference = (const float32_t*) bi_Reference.ptr;
+  py::gil_scoped_release release_gil;
+  for( py::ssize_t idx = 0; idx < bi_Weights.size; idx++ )
   {
-    numWeights *= bi_Weights.shape[idx];
-    if (idx == 0)
-    {
-      continue;
-    }
-    layerWidth *= bi_Weights.shape[idx];
+    pWeights[idx] += pReference[idx];
   }
-  if( layerWidth == 1 || numWeights == layerWidth )
-      scan_order = 0;
-
-  int32_t k = 1 << qpDensity;
-  int32_t mul = k + (qp & (k-1));
-  int32_t shift = qp >> qpDensity;
-  float32_t qStepSize = mul * pow(2.0, shift - qpDensity);
-  deQuantize(pWeights, pQIndex, qStepSize, numWeights, layerWidth, scan_order);
 }
 
 
@@ -246,8 +461,14 @@ uint32_t Decoder::finish()
 }
 
 
+#define DEQUANT_ARGS       py::arg("weights"), py::arg("qindex"), py::arg("qp_density"), py::arg("qp"), py::arg("scan_order"), py::arg("num_threads") = 1
+#define DEQUANT_DELTA_ARGS py::arg("weights"), py::arg("qindex"), py::arg("qp_density"), py::arg("qp"), py::arg("scan_order"), py::arg("reference"), py::arg("num_threads") = 1
+
 PYBIND11_MODULE(deepCABAC, m) 
 {
+    py::class_<EncoderContexts, std::shared_ptr<EncoderContexts>>(m, "EncoderContexts");
+    py::class_<DecoderContexts, std::shared_ptr<DecoderContexts>>(m, "DecoderContexts");
+
     py::class_<Encoder>(m, "Encoder")
         .def( py::init<>())
         .def( "iae_v",         &Encoder::iae_v         )
@@ -255,22 +476,159 @@ PYBIND11_MODULE(deepCABAC, m)
         .def( "initCtxModels", &Encoder::initCtxModels )
         .def( "quantLayer",    &Encoder::quantLayer    )
         .def( "encodeLayer",   &Encoder::encodeLayer   )
+        .def( "encodeLayer",   &Encoder::encodeLayerNarrow<int8_t>  )
+        .def( "encodeLayer",   &Encoder::encodeLayerNarrow<int16_t> )
+        .def( "estimateLayerBits", &Encoder::estimateLayerBits, py::arg("qindex"), py::arg("dq_flag"), py::arg("scan_order") )
+        .def( "saveContexts",  &Encoder::saveContexts  )
+        .def( "restoreContexts", &Encoder::restoreContexts, py::arg("snapshot") )
         .def( "finish",        &Encoder::finish        );
 
     py::class_<Decoder>(m, "Decoder")
         .def( py::init<>())
         .def( "setStream",     &Decoder::setStream, py::keep_alive<1, 2>() )
+        .def( "saveContexts",  &Decoder::saveContexts  )
+        .def( "restoreContexts", &Decoder::restoreContexts, py::arg("snapshot") )
         .def( "initCtxModels", &Decoder::initCtxModels )
         .def( "iae_v",         &Decoder::iae_v         )
         .def( "uae_v",         &Decoder::uae_v         )
         .def( "decodeLayer",   &Decoder::decodeLayer   )
+        .def( "decodeLayer",   &Decoder::decodeLayerNarrow<int8_t>  )
+        .def( "decodeLayer",   &Decoder::decodeLayerNarrow<int16_t> )
+        .def( "decodeLayerSparse", &Decoder::decodeLayerSparse, py::arg("shape"), py::arg("dq_flag"), py::arg("scan_order"),
+              py::arg("format") = std::string( "csr" ), py::arg("dequantize") = false, py::arg("qp_density") = 0, py::arg("qp") = 0 )
         .def( "decodeLayerAndCreateEPs",   &Decoder::decodeLayerAndCreateEPs   )
         .def( "setEntryPoints",&Decoder::setEntryPoints)
-        .def( "dequantLayer",  &Decoder::dequantLayer  )
+        .def( "dequantLayer",  &Decoder::dequantLayer,                DEQUANT_ARGS )
+        .def( "dequantLayer",  &Decoder::dequantLayerNarrow<int8_t>,  DEQUANT_ARGS )
+        .def( "dequantLayer",  &Decoder::dequantLayerNarrow<int16_t>, DEQUANT_ARGS )
+        .def( "dequantLayerDelta", &Decoder::dequantLayerDelta<int32_t>, DEQUANT_DELTA_ARGS )
+        .def( "dequantLayerDelta", &Decoder::dequantLayerDelta<int8_t>,  DEQUANT_DELTA_ARGS )
+        .def( "dequantLayerDelta", &Decoder::dequantLayerDelta<int16_t>, DEQUANT_DELTA_ARGS )
         .def( "finish",        &Decoder::finish        );
 
+    py::class_<OutputArena>(m, "OutputArena")
+        .def( py::init<bool>(), py::arg("huge_pages") = true )
+        .def( "empty",         &OutputArena::empty, py::arg("shape"), py::arg("dtype") )
+        .def( "trim",          &OutputArena::trim          )
+        .def_property_readonly( "reserved_bytes", &OutputArena::reservedBytes )
+        .def_property_readonly( "pooled_bytes",   &OutputArena::pooledBytes   );
+
+    m.def( "trim_scratch_arenas", &trimScratchArenas,
+           "Free the idle per-worker scratch buffers larger than keep_bytes",
+           py::arg("keep_bytes") = 0 );
+    m.def( "scratch_arenas_reserved_bytes", &scratchArenasReservedBytes,
+           "Bytes currently reserved by the per-worker scratch arenas" );
+
     m.def("quantize_all_blocks_parallel", 
-          &quantize_all_blocks_parallel_pthreads, 
+          []( py::list block_info_list, int num_threads, bool numa, OutputArena* arena, bool narrow_qindex, py::object coalesce_target_weights, std::string cache_dir, bool dedup,
+              std::string tuning_profile, bool calibrate, uint64_t max_memory_bytes )
+          {
+            ParallelQuantOptions options;
+            options.num_threads   = num_threads;
+            options.numa          = numa;
+            options.arena         = arena;
+            options.narrow_qindex = narrow_qindex;
+            // None: the tuning profile's tile size when one applies, otherwise the default
+            if( !coalesce_target_weights.is_none() ) { options.coalesce_target_weights = coalesce_target_weights.cast<uint64_t>(); }
+            options.cache_dir     = cache_dir;
+            options.dedup         = dedup;
+            options.tuning_profile = tuning_profile;
+            options.calibrate     = calibrate;
+            options.max_memory_bytes = max_memory_bytes;
+            return quantize_all_blocks_parallel_pthreads( block_info_list, options );
+          },
           "Parallel quantization of multiple blocks using pthreads",
-          py::arg("block_info_list"));
+          py::arg("block_info_list"),
+          py::arg("num_threads") = 0,
+          py::arg("numa") = false,
+          py::arg("arena") = static_cast<OutputArena*>(nullptr),
+          py::arg("narrow_qindex") = false,
+          py::arg("coalesce_target_weights") = py::none(),
+          py::arg("cache_dir") = std::string(),
+          py::arg("dedup") = false,
+          py::arg("tuning_profile") = std::string(),
+          py::arg("calibrate") = false,
+          py::arg("max_memory_bytes") = 0);
+
+    py::class_<QuantizeSession>(m, "QuantizeSession")
+        .def( py::init<int, OutputArena*>(), py::arg("num_threads") = 0, py::arg("arena") = static_cast<OutputArena*>(nullptr), py::keep_alive<1, 3>() )
+        .def( "submit",        &QuantizeSession::submit, py::arg("block") )
+        .def( "poll",          &QuantizeSession::poll      )
+        .def( "wait_all",      &QuantizeSession::wait_all  )
+        .def( "close",         &QuantizeSession::close     )
+        .def_property_readonly( "submitted", &QuantizeSession::submitted )
+        .def_property_readonly( "completed", &QuantizeSession::completed );
+
+    py::class_<QuantizeFuture>(m, "QuantizeFuture")
+        .def( "done",          &QuantizeFuture::done      )
+        .def( "cancelled",     &QuantizeFuture::cancelled )
+        .def( "failed",        &QuantizeFuture::failed    )
+        .def( "cancel",        &QuantizeFuture::cancel    )
+        .def( "result",        &QuantizeFuture::result    )
+        .def( "fileno",        &QuantizeFuture::fileno    )
+        .def_property_readonly( "completed_blocks",  &QuantizeFuture::completed_blocks  )
+        .def_property_readonly( "total_blocks",      &QuantizeFuture::total_blocks      )
+        .def_property_readonly( "completed_weights", &QuantizeFuture::completed_weights )
+        .def_property_readonly( "total_weights",     &QuantizeFuture::total_weights     );
+
+    m.def("quantize_all_blocks_async",
+          []( py::list block_info_list, int num_threads, OutputArena* arena )
+          {
+            ParallelQuantOptions options;
+            options.num_threads = num_threads;
+            options.arena       = arena;
+            return new QuantizeFuture( block_info_list, options );
+          },
+          "Starts parallel quantization and returns a QuantizeFuture; fileno() becomes readable when it is done",
+          py::arg("block_info_list"),
+          py::arg("num_threads") = 0,
+          py::arg("arena") = static_cast<OutputArena*>(nullptr),
+          py::return_value_policy::take_ownership,
+          py::keep_alive<0, 3>());
+
+    m.def("search_qps_for_budget",
+          []( py::list block_info_list, uint64_t model_byte_budget, int32_t qp_min, int32_t qp_max, int num_threads, uint8_t param_opt_flag,
+              double budget_margin )
+          {
+            RateControlOptions options;
+            options.model_byte_budget = model_byte_budget;
+            options.qp_min            = qp_min;
+            options.qp_max            = qp_max;
+            options.num_threads       = num_threads;
+            options.param_opt_flag    = param_opt_flag;
+            options.budget_margin     = budget_margin;
+            return search_qps_for_budget( block_info_list, options );
+          },
+          "Parallel per-block QP bisection against a byte budget; budget the model's blocks leave unused is handed back to the others",
+          py::arg("block_info_list"),
+          py::arg("model_byte_budget") = 0,
+          py::arg("qp_min") = RateControlOptions().qp_min,
+          py::arg("qp_max") = RateControlOptions().qp_max,
+          py::arg("num_threads") = 0,
+          py::arg("param_opt_flag") = RateControlOptions().param_opt_flag,
+          py::arg("budget_margin") = RateControlOptions().budget_margin);
+
+    m.def("quantize_and_encode_pipelined",
+          []( Encoder& encoder, py::list block_info_list, int num_threads, int max_queued_blocks )
+          {
+            PipelineOptions options;
+            options.num_threads       = num_threads;
+            options.max_queued_blocks = max_queued_blocks;
+            EncodeStageFn encode_stage = [&encoder]( const BlockQuantInfo& info, int32_t* pQIndex )
+            {
+              return encoder.encodeSegments( pQIndex, info.numWeights, info.layerWidth, info.dq_flag, info.scan_order );
+            };
+            return quantize_and_encode_pipelined( block_info_list, encode_stage, options );
+          },
+          "Quantizes blocks on worker threads while the calling thread encodes them in order",
+          py::arg("encoder"),
+          py::arg("block_info_list"),
+          py::arg("num_threads") = 0,
+          py::arg("max_queued_blocks") = PipelineOptions().max_queued_blocks);
+
+    py::class_<RateDistortionAllocator>(m, "RateDistortionAllocator")
+        .def( py::init<py::list, int>(), py::arg("block_info_list"), py::arg("num_threads") = 0 )
+        .def( "compute",       &RateDistortionAllocator::compute, py::arg("qps") )
+        .def( "allocate",      &RateDistortionAllocator::allocate, py::arg("target_bytes") = 0, py::arg("target_distortion") = 0.0 )
+        .def( "points",        &RateDistortionAllocator::points );
 }
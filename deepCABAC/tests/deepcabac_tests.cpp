@@ -0,0 +1,299 @@
+// deepcabac_tests: testes da biblioteca deepcabac_core (registrados no ctest).
+//
+// Cada teste é uma função void que conta as falhas com EXPECT; o programa imprime
+// as falhas e sai com código != 0 se houver alguma.
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include <Lib/CommonLib/TypeDef.h>
+#include <Lib/EncLib/CABACEncoder.h>
+#include <Lib/DecLib/CABACDecoder.h>
+
+#include "BitCounter.h"
+#include "LayerCoder.h"
+#include "LayerSegments.h"
+#include "QuantEngine.h"
+#include "ScanReorder.h"
+
+static int g_Failures = 0;
+
+#define EXPECT( cond, ... )                                   \
+  do                                                          \
+  {                                                           \
+    if( !( cond ) )                                           \
+    {                                                         \
+      std::fprintf( stderr, "%s:%d: falhou: %s: ", __FILE__, __LINE__, #cond ); \
+      std::fprintf( stderr, __VA_ARGS__ );                    \
+      std::fprintf( stderr, "\n" );                           \
+      g_Failures++;                                           \
+    }                                                         \
+  } while( 0 )
+
+typedef std::chrono::steady_clock Clock;
+
+static double secondsSince( Clock::time_point start )
+{
+  return std::chrono::duration<double>( Clock::now() - start ).count();
+}
+
+// Pesos sintéticos com a forma de uma camada densa: gaussianos ou laplacianos
+static std::vector<float32_t> makeWeights( uint64_t numWeights, bool laplacian, float32_t scale, uint32_t seed )
+{
+  std::mt19937 rng( seed );
+  std::normal_distribution<float32_t>      gauss( 0.0f, scale );
+  std::exponential_distribution<float32_t> expo( 1.0f / scale );
+  std::vector<float32_t> weights( numWeights );
+  for( uint64_t i = 0; i < numWeights; i++ )
+  {
+    weights[i] = laplacian ? ( ( rng() & 1 ) ? expo( rng ) : -expo( rng ) ) : gauss( rng );
+  }
+  return weights;
+}
+
+// ---------------------------------------------------------------------------
+// ScanReorder: mesma ordem de um percurso direto dos blocos, e volta sem perdas
+
+// Percurso de referência: blocos linha a linha, linhas em ordem dentro do bloco,
+// linhas incompletas no fim em raster
+template <typename T>
+static std::vector<T> naiveBlockScan( const std::vector<T>& raster, uint32_t layerWidth, int32_t scan_order )
+{
+  uint32_t blockSize = scanBlockSize( scan_order );
+  uint64_t rows      = raster.size() / layerWidth;
+  std::vector<T> scan;
+  for( uint64_t row0 = 0; row0 < rows; row0 += blockSize )
+  {
+    for( uint32_t col0 = 0; col0 < layerWidth; col0 += blockSize )
+    {
+      for( uint64_t r = row0; r < std::min<uint64_t>( row0 + blockSize, rows ); r++ )
+      {
+        for( uint32_t c = col0; c < std::min( col0 + blockSize, layerWidth ); c++ ) { scan.push_back( raster[r * layerWidth + c] ); }
+      }
+    }
+  }
+  scan.insert( scan.end(), raster.begin() + rows * layerWidth, raster.end() );
+  return scan;
+}
+
+template <typename T>
+static void checkScanReorder( uint32_t rows, uint32_t cols, uint32_t tail, int32_t scan_order )
+{
+  uint32_t numWeights = rows * cols + tail;
+  std::vector<T> raster( numWeights ), scan( numWeights ), back( numWeights );
+  for( uint32_t i = 0; i < numWeights; i++ ) { raster[i] = (T) ( i * 7 + 3 ); }
+
+  reorderToScan( raster.data(), scan.data(), numWeights, cols, scan_order );
+  reorderFromScan( scan.data(), back.data(), numWeights, cols, scan_order );
+  EXPECT( scan == naiveBlockScan( raster, cols, scan_order ), "%ux%u+%u scan_order %d: ordem diferente do percurso direto",
+          rows, cols, tail, scan_order );
+  EXPECT( back == raster, "%ux%u+%u scan_order %d: volta diferente do original", rows, cols, tail, scan_order );
+}
+
+static void testScanReorder()
+{
+  // Blocos inteiros, bordas cortadas, grupos de blocos incompletos e sobra no fim
+  const uint32_t shapes[][3] = { { 64, 64, 0 }, { 2, 3, 0 }, { 9, 17, 0 }, { 100, 257, 5 }, { 128, 1000, 0 }, { 300, 70, 69 }, { 65, 4100, 1 } };
+  for( size_t s = 0; s < sizeof( shapes ) / sizeof( shapes[0] ); s++ )
+  {
+    for( int32_t scan_order = 1; scan_order <= 4; scan_order++ )
+    {
+      checkScanReorder<int32_t>  ( shapes[s][0], shapes[s][1], shapes[s][2], scan_order );
+      checkScanReorder<float32_t>( shapes[s][0], shapes[s][1], shapes[s][2], scan_order );
+      checkScanReorder<int8_t>   ( shapes[s][0], shapes[s][1], shapes[s][2], scan_order );
+    }
+  }
+
+  // Raster, vetor e linha única: cópia direta
+  std::vector<int32_t> raster( 1000 ), scan( 1000 );
+  for( uint32_t i = 0; i < 1000; i++ ) { raster[i] = (int32_t) i; }
+  const uint32_t widths[] = { 10, 1, 1000 };
+  const int32_t  orders[] = { 0, 2, 2 };
+  for( size_t k = 0; k < 3; k++ )
+  {
+    reorderToScan( raster.data(), scan.data(), 1000, widths[k], orders[k] );
+    EXPECT( scan == raster, "layerWidth %u scan_order %d: esperada a ordem raster", widths[k], orders[k] );
+  }
+}
+
+// ---------------------------------------------------------------------------
+// BitCounter: estimativa perto do tamanho real e mais barata que o encode
+
+static void testEstimateLayerBits()
+{
+  struct Case { bool laplacian; uint8_t dq_flag; int32_t scan_order; int32_t qp; };
+  const Case cases[] = { { false, 0, 0, -32 }, { false, 1, 0, -32 }, { true, 1, 0, -28 }, { true, 1, 2, -36 }, { false, 0, 3, -24 } };
+  const uint64_t rows = 512, cols = 1024, numWeights = rows * cols;
+  const uint32_t maxNumNoRem = 10;
+  const double   tolerance   = 0.15;
+  const int      repeats     = 3;
+
+  double encodeSeconds = 0, estimateSeconds = 0;
+  for( size_t c = 0; c < sizeof( cases ) / sizeof( cases[0] ); c++ )
+  {
+    const Case& tc = cases[c];
+    std::vector<float32_t> weights = makeWeights( numWeights, tc.laplacian, 0.02f, 1234 + (uint32_t) c );
+    std::vector<int32_t>   levels( numWeights );
+    quantizeLayer( weights.data(), levels.data(), numWeights, cols, 2, tc.qp, 0.0f, tc.dq_flag, maxNumNoRem, tc.scan_order );
+
+    double   bestEncode = 1e30, bestEstimate = 1e30;
+    uint64_t realBits = 0, estimate = 0;
+    for( int r = 0; r < repeats; r++ )
+    {
+      Clock::time_point start = Clock::now();
+      std::vector<uint8_t> stream;
+      CABACEncoder encoder;
+      encoder.startCabacEncoding( &stream );
+      encoder.initCtxMdls( maxNumNoRem + 1, 0 );
+      encodeLayerLevels( encoder, levels.data(), numWeights, cols, tc.dq_flag, tc.scan_order );
+      encoder.terminateCabacEncoding();
+      bestEncode = std::min( bestEncode, secondsSince( start ) );
+      realBits   = 8 * (uint64_t) stream.size();
+
+      start = Clock::now();
+      BitCounter counter( maxNumNoRem, 0 );
+      for( const LayerSegment& seg : splitLayerIntoSegments( numWeights, cols ) )
+      {
+        counter.addWeights( levels.data() + seg.offset, seg.layerWidth, seg.numWeights, tc.dq_flag, segmentScanOrder( tc.scan_order, seg ) );
+      }
+      estimate     = counter.finish();
+      bestEstimate = std::min( bestEstimate, secondsSince( start ) );
+    }
+    encodeSeconds   += bestEncode;
+    estimateSeconds += bestEstimate;
+
+    double error = std::fabs( (double) estimate - (double) realBits ) / (double) realBits;
+    EXPECT( error <= tolerance, "caso %zu: estimativa %llu bits, real %llu bits (erro %.3f)", c,
+            (unsigned long long) estimate, (unsigned long long) realBits, error );
+  }
+  std::printf( "estimateLayerBits: encode %.3f s, estimativa %.3f s\n", encodeSeconds, estimateSeconds );
+  EXPECT( estimateSeconds < encodeSeconds, "estimativa %.3f s, encode %.3f s", estimateSeconds, encodeSeconds );
+}
+
+// ---------------------------------------------------------------------------
+// LayerSegments: linhas maiores que o segmento (com maxSegmentWeights pequeno)
+
+// Codifica e decodifica os níveis com a segmentação de maxSegmentWeights
+static std::vector<int32_t> roundTripLevels( std::vector<int32_t>& levels, uint64_t layerWidth, uint8_t dq_flag, int32_t scan_order,
+                                             uint32_t maxNumNoRem, uint64_t maxSegmentWeights )
+{
+  std::vector<uint8_t> stream;
+  CABACEncoder encoder;
+  encoder.startCabacEncoding( &stream );
+  encoder.initCtxMdls( maxNumNoRem + 1, 0 );
+  encodeLayerLevels( encoder, levels.data(), levels.size(), layerWidth, dq_flag, scan_order, maxSegmentWeights );
+  encoder.terminateCabacEncoding();
+
+  std::vector<int32_t> decoded( levels.size() );
+  CABACDecoder decoder;
+  decoder.startCabacDecoding( stream.data() );
+  decoder.initCtxMdls( maxNumNoRem + 1 );
+  decodeLayerLevels( decoder, decoded.data(), decoded.size(), layerWidth, dq_flag, scan_order, maxSegmentWeights );
+  decoder.terminateCabacDecoding();
+  return decoded;
+}
+
+static void testOversizedRows()
+{
+  const uint32_t maxNumNoRem = 10;
+  const uint64_t maxSegment  = 256;
+
+  // Linhas de 1000 pesos com segmentos de 256: fatias 1D marcadas, cobrindo a camada inteira
+  const uint64_t rows = 6, cols = 1000;
+  std::vector<LayerSegment> segments = splitLayerIntoSegments( rows * cols, cols, maxSegment );
+  uint64_t covered = 0;
+  for( const LayerSegment& seg : segments )
+  {
+    EXPECT( seg.offset == covered && seg.numWeights <= maxSegment && seg.rowsSplit, "fatia em %llu", (unsigned long long) seg.offset );
+    covered += seg.numWeights;
+  }
+  EXPECT( covered == rows * cols, "fatias cobrem %llu de %llu pesos", (unsigned long long) covered, (unsigned long long) ( rows * cols ) );
+
+  std::vector<float32_t> weights = makeWeights( rows * cols, true, 0.02f, 99 );
+  std::vector<int32_t>   levels( rows * cols );
+  for( uint8_t dq_flag = 0; dq_flag <= 1; dq_flag++ )
+  {
+    quantizeLayer( weights.data(), levels.data(), levels.size(), cols, 2, -32, 0.0f, dq_flag, maxNumNoRem, 0 );
+    EXPECT( roundTripLevels( levels, cols, dq_flag, 0, maxNumNoRem, maxSegment ) == levels, "linhas longas, dq_flag %d: decodificado != codificado", dq_flag );
+  }
+
+  // Varredura em blocos não cabe numa fatia 1D: erro claro em vez de raster silencioso
+  bool rejected = false;
+  try
+  {
+    roundTripLevels( levels, cols, 1, 2, maxNumNoRem, maxSegment );
+  }
+  catch( const std::invalid_argument& ) { rejected = true; }
+  EXPECT( rejected, "scan_order 2 com linhas maiores que o segmento foi aceito" );
+
+  // Menos de kSegmentRowAlign linhas por segmento: linhas inteiras, scan_order mantido
+  const uint64_t shortRows = 40, shortCols = 100;
+  for( const LayerSegment& seg : splitLayerIntoSegments( shortRows * shortCols, shortCols, 1000 ) )
+  {
+    EXPECT( seg.layerWidth == shortCols && seg.numWeights % shortCols == 0 && !seg.rowsSplit && segmentScanOrder( 2, seg ) == 2,
+            "segmento em %llu não tem linhas inteiras", (unsigned long long) seg.offset );
+  }
+  weights = makeWeights( shortRows * shortCols, false, 0.02f, 7 );
+  levels.resize( weights.size() );
+  quantizeLayer( weights.data(), levels.data(), levels.size(), shortCols, 2, -32, 0.0f, 1, maxNumNoRem, 2 );
+  EXPECT( roundTripLevels( levels, shortCols, 1, 2, maxNumNoRem, 1000 ) == levels, "linhas inteiras com scan_order 2: decodificado != codificado" );
+}
+
+// ---------------------------------------------------------------------------
+// Saída estreitada de um bloco com vários segmentos: partes juntadas no maior tipo
+
+static void testNarrowMultiSegment()
+{
+  // kMaxSegmentWeights / cols linhas no primeiro segmento, 64 no segundo
+  const uint64_t cols = 1024;
+  const uint64_t rows = kMaxSegmentWeights / cols + kSegmentRowAlign;
+  std::vector<float32_t> weights = makeWeights( rows * cols, false, 20.0f, 5 );
+  for( uint64_t i = kMaxSegmentWeights; i < weights.size(); i++ ) { weights[i] *= 50.0f; } // Níveis além de int8
+
+  QuantBlock block;
+  block.param_name  = "multi_segment";
+  block.shape       = { (int64_t) rows, (int64_t) cols };
+  block.pWeights    = weights.data();
+  block.numWeights  = weights.size();
+  block.layerWidth  = cols;
+  block.maxNumNoRem = 10;
+  EXPECT( splitLayerIntoSegments( block.numWeights, block.layerWidth ).size() == 2, "o bloco deveria ter dois segmentos" );
+
+  std::vector<int32_t> expected( weights.size() );
+  quantize_block_levels( block, expected.data() );
+
+  QuantEngineOptions options;
+  options.num_threads = 2;
+  options.verbose     = false;
+  QuantEngineResult result;
+  quantize_blocks_parallel( std::vector<QuantBlock>( 1, block ), options, result );
+
+  NarrowQIndex& narrow = result.narrow_qindex[0];
+  EXPECT( narrow.ptr != nullptr && narrow.itemsize == 2, "saída estreitada com itemsize %d (esperado 2)", narrow.itemsize );
+  if( narrow.ptr != nullptr && narrow.itemsize == 2 )
+  {
+    const int16_t* levels = static_cast<const int16_t*>( narrow.ptr );
+    EXPECT( std::equal( expected.begin(), expected.end(), levels ), "níveis juntados diferentes dos quantizados em int32" );
+  }
+  std::free( narrow.ptr );
+}
+
+int main()
+{
+  testScanReorder();
+  testOversizedRows();
+  testNarrowMultiSegment();
+  testEstimateLayerBits();
+  if( g_Failures )
+  {
+    std::fprintf( stderr, "%d falha(s)\n", g_Failures );
+    return 1;
+  }
+  std::printf( "ok\n" );
+  return 0;
+}
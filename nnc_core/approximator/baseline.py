@@ -8,6 +8,22 @@ from .. import common
 import pandas as pd
 import os # Para criar a pasta de log
 
+# Pool de buffers de saída compartilhado entre execuções: os qindex de approx() e os
+# pesos reconstruídos de rec() reaproveitam memória já mapeada (com huge pages)
+_output_arena = deepCABAC.OutputArena(huge_pages=True)
+
+# Opções de quantize_all_blocks_parallel que a QuantizeSession (parallel_streaming) não tem
+_BATCH_ONLY_OPTIONS = ("parallel_numa", "parallel_narrow_qindex", "parallel_dedup", "parallel_cache_dir",
+                       "parallel_max_memory_bytes", "parallel_tuning_profile", "parallel_calibrate")
+
+
+def _qp_to_step_size(qp, qpDensity):
+    # Mesma lógica do bindings.cpp
+    k = 1 << qpDensity
+    mul = k + (qp & (k-1))
+    shift = qp >> qpDensity
+    return mul * pow(2.0, shift - qpDensity)
+
 
 def approx(approx_info, model_info, approx_data_in):
     
@@ -18,7 +34,25 @@ def approx(approx_info, model_info, approx_data_in):
 
     # --- FASE 1: Coletar informações para todos os blocos ---
     block_info_list_for_cpp = []
-    output_qindex_arrays = {} # Dicionário para guardar referências aos arrays de saída
+
+    # Modo streaming: cada bloco vai para os workers assim que é coletado, sobrepondo
+    # a travessia do modelo com a quantização. Os QPs do orçamento (FASE 1b)
+    # dependem de todos os blocos, então o modo só vale sem 'target_model_bytes'.
+    session = None
+
+    # Modo delta: para os parâmetros com referência (reconstrução do modelo base que o
+    # receptor já tem), quantiza e codifica w - w_ref em vez de w
+    delta_reference = approx_info.get("delta_reference", {})
+    if delta_reference:
+        approx_data_out.setdefault("delta_reference", {})
+    if approx_info.get("parallel_streaming", False) and approx_info.get("target_model_bytes", 0) <= 0:
+        # A sessão quantiza bloco a bloco, sem as opções do lote: com alguma delas
+        # ligada, o modo streaming é desligado para que elas valham
+        batch_only = [opt for opt in _BATCH_ONLY_OPTIONS if approx_info.get(opt)]
+        if batch_only:
+            print("INFO: parallel_streaming ignorado; {} só vale(m) na quantização em lote".format(", ".join(batch_only)))
+        else:
+            session = deepCABAC.QuantizeSession(num_threads=approx_info.get("parallel_num_threads", 0), arena=_output_arena)
 
     print("Coletando informações dos blocos para C++...")
     
@@ -28,24 +62,17 @@ def approx(approx_info, model_info, approx_data_in):
                 
                 original_weights = approx_data_in["parameters"][param]
                 
-                # --- IMPORTANTE: Pré-alocar o array de saída NumPy ---
-                # O C++ escreverá diretamente aqui. DEVE ser C-contíguo.
-                quantizedValues = np.zeros_like(original_weights, dtype=np.int32, order='C')
-                output_qindex_arrays[param] = quantizedValues # Guarda a referência
+                # O array de saída 'qindex' é alocado pelo C++ e tocado pela primeira vez
+                # pela thread que quantiza o bloco (importante no modo NUMA)
                 
                 # Calcular qStepSize (lógica do bindings.cpp)
                 qp = approx_info['qp'][param]
-                qpDensity = approx_data_in['qp_density']
-                k = 1 << qpDensity
-                mul = k + (qp & (k-1))
-                shift = qp >> qpDensity
-                qStepSize = mul * pow(2.0, shift - qpDensity)
+                qStepSize = _qp_to_step_size(qp, approx_data_in['qp_density'])
 
                 # Monta o dicionário para este bloco
                 block_info = {
                     'param_name': param,
                     'weights': original_weights, # Array NumPy original
-                    'qindex': quantizedValues,   # Array NumPy de saída (pré-alocado)
                     'qStepSize': qStepSize,
                     'lambdaScale': approx_info["lambda_scale"],
                     'dq_flag': approx_info['dq_flag'][param],
@@ -54,16 +81,70 @@ def approx(approx_info, model_info, approx_data_in):
                     'qp': qp, # QP original
                     'qpDensity': approx_data_in['qp_density']
                 }
+                if param in delta_reference:
+                    block_info['reference'] = delta_reference[param]
+                    approx_data_out["delta_reference"][param] = delta_reference[param]
                 block_info_list_for_cpp.append(block_info)
+                if session is not None:
+                    session.submit(block_info)
     
     print(f"Total de {len(block_info_list_for_cpp)} blocos preparados. Chamando C++ Pthreads...")
+
+    # --- FASE 1b (opcional): QP por bloco a partir de um orçamento de bytes ---
+    # Substitui o QP fixo de approx_info['qp'] pelo menor QP que cabe no orçamento
+    # Com 'rd_qp_grid', a escolha é global (Lagrangiana) sobre a grade de QPs
+    target_model_bytes = approx_info.get("target_model_bytes", 0)
+    if target_model_bytes > 0 and approx_info.get("rd_qp_grid"):
+        allocator = deepCABAC.RateDistortionAllocator(block_info_list_for_cpp, num_threads=approx_info.get("parallel_num_threads", 0))
+        allocator.compute(list(approx_info["rd_qp_grid"]))
+        allocation = allocator.allocate(target_bytes=target_model_bytes)
+        if not allocation['target_met']:
+            print("INFO: o modelo não coube em {} bytes; usando a menor taxa da grade ({} bytes)".format(target_model_bytes, allocation['bytes']))
+        for block_info in block_info_list_for_cpp:
+            block_info['qp'] = allocation['qps'][block_info['param_name']]
+            block_info['qStepSize'] = _qp_to_step_size(block_info['qp'], block_info['qpDensity'])
+    elif target_model_bytes > 0:
+        rc_results = deepCABAC.search_qps_for_budget(
+            block_info_list_for_cpp,
+            model_byte_budget=target_model_bytes,
+            num_threads=approx_info.get("parallel_num_threads", 0)
+        )
+        rc_qps = {r['param_name']: r for r in rc_results}
+        for block_info in block_info_list_for_cpp:
+            rc = rc_qps[block_info['param_name']]
+            if not rc['budget_met']:
+                print("INFO: {} não coube no orçamento de {} bytes (QP {})".format(block_info['param_name'], rc['byte_budget'], rc['qp']))
+            block_info['qp'] = rc['qp']
+            block_info['qStepSize'] = _qp_to_step_size(rc['qp'], block_info['qpDensity'])
+    requested_qps = {b['param_name']: b['qp'] for b in block_info_list_for_cpp}
     
     # --- FASE 2: Chamada ÚNICA para a função C++ paralela ---
     # Certifique-se que a pasta de log existe
     os.makedirs("C:\\Henrique", exist_ok=True) 
 
+    # Cache em disco de blocos já quantizados (camadas idênticas entre checkpoints)
+    cache_dir = approx_info.get("parallel_cache_dir", "")
+    if cache_dir:
+        os.makedirs(cache_dir, exist_ok=True)
+
     # Chama a nova função C++ que faz o trabalho pesado em paralelo
-    cpp_results = deepCABAC.quantize_all_blocks_parallel(block_info_list_for_cpp)
+    if session is not None:
+        cpp_results = session.wait_all()
+        session.close()
+    else:
+        cpp_results = deepCABAC.quantize_all_blocks_parallel(
+            block_info_list_for_cpp,
+            num_threads=approx_info.get("parallel_num_threads", 0),
+            numa=approx_info.get("parallel_numa", False),
+            arena=_output_arena,
+            narrow_qindex=approx_info.get("parallel_narrow_qindex", False), # int8/int16 por bloco quando couber
+            coalesce_target_weights=approx_info.get("parallel_coalesce_target_weights"), # None = do perfil de ajuste, ou 1 << 16
+            cache_dir=cache_dir,
+            dedup=approx_info.get("parallel_dedup", False), # Tensores idênticos/amarrados quantizados uma vez
+            tuning_profile=approx_info.get("parallel_tuning_profile", ""), # Vazio = perfil padrão do usuário
+            calibrate=approx_info.get("parallel_calibrate", False), # Mede threads/coalesce nestes blocos e grava o perfil
+            max_memory_bytes=approx_info.get("parallel_max_memory_bytes", 0) # Teto da memória de trabalho (0 = sem limite)
+        )
 
     print("C++ Pthreads concluído. Processando resultados...")
 
@@ -74,28 +155,39 @@ def approx(approx_info, model_info, approx_data_in):
 
         final_dq_flag = result_dict['dq_flag'] # Pega o dq_flag retornado pelo C++
         
-        original_qp = approx_info['qp'][param]
+        original_qp = requested_qps[param]
         if final_qp != original_qp:
              print("INFO: QP for {} has been clipped from {} to {} to avoid int32_t overflow!".format(param, original_qp, final_qp))
         
         # Atualiza o dicionário de saída
         approx_data_out['qp'][param] = final_qp
-        approx_data_out['parameters'][param] = output_qindex_arrays[param] # Usa o array que foi modificado
+        approx_data_out['parameters'][param] = result_dict['qindex'] # Array alocado e preenchido pelo C++
         approx_data_out['approx_method'][param] = 'uniform'
         
         approx_data_out['dq_flag'][param] = final_dq_flag # Atualiza o dicionário dq_flag
 
+        # Duplicado: o qindex é uma vista somente leitura (ou cópia) dos níveis do original;
+        # o codificador pode referenciar o stream do original em vez de codificá-lo de
+        # novo (o contêiner do nncbatch já faz isso)
+        if result_dict.get('duplicate_of') is not None:
+            approx_data_out.setdefault('duplicate_of', {})[param] = result_dict['duplicate_of']
+
     print("Todos os resultados foram coletados.")
     return approx_data_out
 
 def rec(param, approx_data):
-    assert approx_data['parameters'][param].dtype == np.int32
+    assert approx_data['parameters'][param].dtype in (np.int8, np.int16, np.int32)
 
     decoder = deepCABAC.Decoder()
     values = approx_data['parameters'][param]
 
-    approx_data["parameters"][param] = np.zeros(values.shape, dtype=np.float32)
-    decoder.dequantLayer(approx_data["parameters"][param], values, approx_data["qp_density"], approx_data["qp"][param], approx_data['scan_order'].get(param, 0))
+    approx_data["parameters"][param] = _output_arena.empty(values.shape, np.float32) # dequantLayer escreve todos os elementos
+    reference = approx_data.get("delta_reference", {}).pop(param, None)
+    num_threads = approx_data.get("dequant_num_threads", 0) # Camadas grandes em faixas de linhas paralelas (0 = todas as threads)
+    if reference is not None:
+        decoder.dequantLayerDelta(approx_data["parameters"][param], values, approx_data["qp_density"], approx_data["qp"][param], approx_data['scan_order'].get(param, 0), reference, num_threads=num_threads)
+    else:
+        decoder.dequantLayer(approx_data["parameters"][param], values, approx_data["qp_density"], approx_data["qp"][param], approx_data['scan_order'].get(param, 0), num_threads=num_threads)
 
 
     del approx_data["approx_method"][param]
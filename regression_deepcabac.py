@@ -0,0 +1,480 @@
+# Regressão do deepCABAC com bitstreams de referência (golden).
+# Passa um corpus fixo pelo caminho serial (Encoder.quantLayer + encodeLayer) e
+# pelo paralelo (quantize_all_blocks_parallel + encodeLayer), exige que os dois
+# gerem exatamente o mesmo bitstream gravado em --golden-dir e, na mesma rodada,
+# mede os tempos. O corpus cobre varreduras em blocos (scan_order 1..4), e os
+# caminhos de níveis estreitos (int8/int16), dedup e modo delta também são
+# conferidos contra o serial. Confere também rec() do approximator numa camada e
+# que os QPs de search_qps_for_budget codificam dentro do orçamento do modelo.
+#
+# Os tempos são comparados como razões, não em segundos: cada etapa é dividida
+# por uma cópia de memória do corpus medida na mesma rodada, então a referência
+# vale em outra máquina. Uma razão acima da referência além de --max-slowdown faz
+# o script sair com erro. O speedup paralelo/serial só é conferido quando a
+# máquina tem o mesmo número de CPUs da referência.
+#
+# Uso:
+#   python regression_deepcabac.py --update-golden     # grava/atualiza a referência
+#   python regression_deepcabac.py                     # confere bits e tempos
+#   python regression_deepcabac.py --max-slowdown 0.1 --json rodada.json
+# O CMake registra o script como teste (ctest) quando gera o módulo Python.
+import argparse
+import hashlib
+import json
+import os
+import platform
+import sys
+import time
+
+import numpy as np
+import deepCABAC
+
+GOLDEN_VERSION = 2
+
+# Corpus fixo (o mesmo do deepcabac_bench): shapes típicos (conv 3x3, pontual, linear
+# grande, embedding, bias) e distribuição de cada um. --scale encolhe a primeira dimensão.
+CORPUS = [
+    ("conv3x3",   (256, 256, 3, 3), "gaussian"),
+    ("conv1x1",   (512, 256, 1, 1), "laplacian"),
+    ("linear",    (4096, 4096),     "gaussian"),
+    ("attn_proj", (1024, 1024),     "student_t"),
+    ("embedding", (32000, 512),     "gaussian"),
+    ("bias",      (4096,),          "laplacian"),
+]
+
+QP_DENSITY = 2
+LAMBDA_SCALE = 0.0
+CABAC_UNARY_LENGTH_MINUS1 = 10
+PARAM_OPT_FLAG = 0
+SCAN_ORDER = 0 # Varredura em linhas: vale para qualquer shape
+
+
+def make_tensor(shape, distribution, rng):
+    fan_in = int(np.prod(shape[1:])) if len(shape) > 1 else shape[0]
+    std = np.sqrt(2.0 / max(fan_in, 1)) # Inicialização He
+    if distribution == "laplacian":
+        values = rng.laplace(0.0, std / np.sqrt(2.0), size=shape)
+    elif distribution == "student_t":
+        values = rng.standard_t(3.0, size=shape) * std / np.sqrt(3.0) # Cauda pesada, mesma variância
+    else:
+        values = rng.normal(0.0, std, size=shape)
+    return np.ascontiguousarray(values, dtype=np.float32)
+
+
+def make_corpus(scale, seed):
+    rng = np.random.default_rng(seed)
+    corpus = []
+    for name, shape, distribution in CORPUS:
+        shape = (max(1, int(shape[0] * scale)),) + tuple(shape[1:])
+        weights = make_tensor(shape, distribution, rng)
+        corpus.append((name, weights, qp_for(weights)))
+    return corpus
+
+
+def qp_for(weights):
+    # QP tal que o passo fique perto de std/8 (mesma ordem de grandeza do uso real)
+    step = max(float(weights.std()) / 8.0, 1e-8)
+    return int(round(np.log2(step) * (1 << QP_DENSITY)))
+
+
+def parallel_blocks(corpus, dq_flag):
+    # Dicionários de quantize_all_blocks_parallel com os mesmos parâmetros de quantLayer
+    blocks = []
+    for name, w, qp in corpus:
+        k = 1 << QP_DENSITY
+        blocks.append({
+            "param_name": name,
+            "weights": w,
+            "qStepSize": (k + (qp & (k - 1))) * 2.0 ** ((qp >> QP_DENSITY) - QP_DENSITY),
+            "lambdaScale": LAMBDA_SCALE,
+            "dq_flag": dq_flag,
+            "maxNumNoRem": CABAC_UNARY_LENGTH_MINUS1,
+            "scan_order": SCAN_ORDER,
+            "qp": qp,
+            "qpDensity": QP_DENSITY,
+        })
+    return blocks
+
+
+# Tensores com varredura em blocos (lado 8/16/32/64): linhas e colunas que não são
+# múltiplas do bloco, para exercitar os blocos cortados da borda
+BLOCKED_CORPUS = [
+    ("blocked_s1",   (75, 61),         1),
+    ("blocked_s2",   (64, 40, 3, 3),   2),
+    ("blocked_s3",   (131, 100),       3),
+    ("blocked_s4",   (259, 197),       4),
+]
+
+
+def make_regression_corpus(scale, seed):
+    # (nome, pesos, qp, scan_order): o corpus do benchmark em varredura raster mais os tensores em blocos
+    corpus = [(name, w, qp, 0) for name, w, qp in make_corpus(scale, seed)]
+    rng = np.random.default_rng(seed + 1)
+    for name, shape, scan_order in BLOCKED_CORPUS:
+        w = make_tensor(shape, "gaussian", rng)
+        corpus.append((name, w, qp_for(w), scan_order))
+    return corpus
+
+
+def regression_blocks(corpus, dq_flag):
+    blocks = parallel_blocks([(name, w, qp) for name, w, qp, _ in corpus], dq_flag)
+    for block, (_, _, _, scan_order) in zip(blocks, corpus):
+        block["scan_order"] = scan_order
+    return blocks
+
+
+def sha256(data):
+    return hashlib.sha256(np.ascontiguousarray(data).tobytes()).hexdigest()
+
+
+def corpus_hash(corpus):
+    # Detecta mudança do corpus (ex.: outro gerador do NumPy) antes de culpar o codec
+    h = hashlib.sha256()
+    for name, w, qp, scan_order in corpus:
+        h.update(name.encode())
+        h.update(str(w.shape).encode())
+        h.update(str((qp, scan_order)).encode())
+        h.update(w.tobytes())
+    return h.hexdigest()
+
+
+def stable_time(fn, repeat, min_seconds):
+    # Melhor tempo por chamada entre 'repeat' amostras; cada amostra repete fn até
+    # durar pelo menos min_seconds, para o corpus pequeno não medir só ruído
+    fn() # Aquecimento: arenas, pools e páginas já mapeados
+    calls, best = 1, float("inf")
+    for _ in range(repeat):
+        while True:
+            start = time.perf_counter()
+            for _ in range(calls):
+                fn()
+            elapsed = time.perf_counter() - start
+            if elapsed >= min_seconds:
+                break
+            calls *= 2
+        best = min(best, elapsed / calls)
+    return best
+
+
+def encode_levels(corpus, levels, dq_flag):
+    encoder = deepCABAC.Encoder()
+    encoder.initCtxModels(CABAC_UNARY_LENGTH_MINUS1, PARAM_OPT_FLAG)
+    for name, _, _, scan_order in corpus:
+        encoder.encodeLayer(levels[name], dq_flag, scan_order)
+    return encoder.finish()
+
+
+def quantize_serial(corpus, dq_flag, references=None):
+    levels, qps = {}, {}
+    encoder = deepCABAC.Encoder()
+    for name, w, qp, scan_order in corpus:
+        if references is not None:
+            w = np.ascontiguousarray(w - references[name], dtype=np.float32)
+        levels[name] = np.empty(w.shape, dtype=np.int32)
+        qps[name] = encoder.quantLayer(w, levels[name], dq_flag, QP_DENSITY, qp, LAMBDA_SCALE, CABAC_UNARY_LENGTH_MINUS1, scan_order)
+    return levels, qps
+
+
+def quantize_parallel(corpus, dq_flag, num_threads, **options):
+    blocks = options.pop("blocks", None) or regression_blocks(corpus, dq_flag)
+    results = deepCABAC.quantize_all_blocks_parallel(blocks, num_threads=num_threads, **options)
+    levels = {r["param_name"]: np.asarray(r["qindex"]) for r in results}
+    qps = {r["param_name"]: r["final_qp"] for r in results}
+    duplicate_of = {r["param_name"]: r.get("duplicate_of") for r in results}
+    return levels, qps, duplicate_of
+
+
+def decode_levels(corpus, stream, dq_flag, dtypes=None):
+    decoder = deepCABAC.Decoder()
+    decoder.setStream(stream)
+    decoder.initCtxModels(CABAC_UNARY_LENGTH_MINUS1)
+    decoded = {}
+    for name, w, _, scan_order in corpus:
+        decoded[name] = np.empty(w.shape, dtype=dtypes[name] if dtypes else np.int32)
+        decoder.decodeLayer(decoded[name], dq_flag, scan_order)
+    decoder.finish()
+    return decoded
+
+
+def dequantize_levels(corpus, levels, qps, num_threads=1):
+    decoder = deepCABAC.Decoder()
+    weights = {}
+    for name, w, _, scan_order in corpus:
+        weights[name] = np.empty(w.shape, dtype=np.float32)
+        decoder.dequantLayer(weights[name], levels[name], QP_DENSITY, qps[name], scan_order, num_threads=num_threads)
+    return weights
+
+
+def compare_levels(label, corpus, expected_levels, expected_qps, levels, qps):
+    errors = []
+    for name, _, _, _ in corpus:
+        if expected_qps[name] != qps[name]:
+            errors.append("{}: {} QP {} != serial {}".format(name, label, qps[name], expected_qps[name]))
+        elif not np.array_equal(expected_levels[name], levels[name]):
+            errors.append("{}: níveis do caminho {} diferem do serial".format(name, label))
+    return errors
+
+
+def check_narrow(corpus, dq_flag, num_threads, serial_levels, serial_qps, serial_stream):
+    # Níveis int8/int16: mesmos níveis, mesmo bitstream codificado direto dos arrays
+    # estreitos, decode e dequant nos tipos estreitos iguais aos do int32
+    levels, qps, _ = quantize_parallel(corpus, dq_flag, num_threads, narrow_qindex=True)
+    errors = compare_levels("narrow", corpus, serial_levels, serial_qps, levels, qps)
+    if errors:
+        return errors
+    if not np.array_equal(encode_levels(corpus, levels, dq_flag), serial_stream):
+        errors.append("bitstream dos níveis estreitos difere do serial")
+    decoded = decode_levels(corpus, serial_stream, dq_flag, {name: levels[name].dtype for name in levels})
+    expected_weights = dequantize_levels(corpus, serial_levels, serial_qps)
+    narrow_weights = dequantize_levels(corpus, decoded, serial_qps, num_threads=num_threads)
+    for name, _, _, _ in corpus:
+        if not np.array_equal(decoded[name], levels[name]):
+            errors.append("{}: decode estreito ({}) não reproduz os níveis".format(name, levels[name].dtype))
+        elif not np.array_equal(narrow_weights[name], expected_weights[name]):
+            errors.append("{}: dequant estreito ({}) difere do int32".format(name, levels[name].dtype))
+    return errors
+
+
+def check_dedup(corpus, dq_flag, num_threads, serial_levels, serial_qps):
+    # Cada tensor entra de novo como cópia (mesmo conteúdo, outro buffer): as cópias
+    # viram duplicados do original, com os mesmos níveis e QP. Metade das cópias traz
+    # o próprio "qindex", que precisa receber os níveis do original; as outras recebem
+    # uma vista somente leitura (e o original também é congelado)
+    blocks = regression_blocks(corpus, dq_flag)
+    copies = []
+    caller_qindex = {}
+    for i, block in enumerate(regression_blocks(corpus, dq_flag)):
+        block["param_name"] += ".copy"
+        block["weights"] = block["weights"].copy()
+        if i % 2 == 0:
+            block["qindex"] = caller_qindex[block["param_name"]] = np.zeros(block["weights"].shape, dtype=np.int32)
+        copies.append(block)
+    levels, qps, duplicate_of = quantize_parallel(corpus, dq_flag, num_threads, blocks=blocks + copies, dedup=True)
+    errors = compare_levels("dedup", corpus, serial_levels, serial_qps, levels, qps)
+    for name, _, _, _ in corpus:
+        copy_name = name + ".copy"
+        if duplicate_of[copy_name] != name:
+            errors.append("{}: dedup não marcou a cópia como duplicada ({})".format(name, duplicate_of[copy_name]))
+        elif qps[copy_name] != serial_qps[name] or not np.array_equal(levels[copy_name], serial_levels[name]):
+            errors.append("{}: níveis/QP da cópia duplicada diferem do original".format(name))
+        elif copy_name in caller_qindex and not np.array_equal(caller_qindex[copy_name], serial_levels[name]):
+            errors.append("{}: o qindex fornecido para a cópia duplicada não foi escrito".format(name))
+        elif copy_name not in caller_qindex and (levels[copy_name].flags.writeable or levels[name].flags.writeable):
+            errors.append("{}: níveis compartilhados entre original e duplicado não são somente leitura".format(name))
+        elif levels[copy_name] is levels[name]:
+            errors.append("{}: original e duplicado receberam o mesmo objeto de qindex".format(name))
+    return errors
+
+
+def run_delta(corpus, dq_flag, num_threads, seed):
+    # Modo delta contra uma referência próxima (modelo base + perturbação): o paralelo
+    # quantiza w - w_ref igual ao serial, e dequantLayerDelta reconstrói w_ref + delta
+    rng = np.random.default_rng(seed + 2)
+    references = {name: np.ascontiguousarray(w + rng.normal(0.0, float(w.std()) / 4.0, size=w.shape), dtype=np.float32)
+                  for name, w, _, _ in corpus}
+    serial_levels, serial_qps = quantize_serial(corpus, dq_flag, references)
+    blocks = regression_blocks(corpus, dq_flag)
+    for block in blocks:
+        block["reference"] = references[block["param_name"]]
+    levels, qps, _ = quantize_parallel(corpus, dq_flag, num_threads, blocks=blocks)
+    errors = compare_levels("delta", corpus, serial_levels, serial_qps, levels, qps)
+    stream = encode_levels(corpus, serial_levels, dq_flag)
+
+    decoder = deepCABAC.Decoder()
+    expected = dequantize_levels(corpus, serial_levels, serial_qps)
+    for name, w, _, scan_order in corpus:
+        rec_weights = np.empty(w.shape, dtype=np.float32)
+        decoder.dequantLayerDelta(rec_weights, serial_levels[name], QP_DENSITY, serial_qps[name], scan_order, references[name])
+        if not np.array_equal(rec_weights, expected[name] + references[name]):
+            errors.append("{}: dequantLayerDelta difere de dequant + referência".format(name))
+    return stream, errors
+
+
+def check_budget(corpus, dq_flag, num_threads, serial_stream):
+    # Orçamento de 60% do stream com os QPs fixos: o modelo inteiro codificado com os QPs
+    # escolhidos (um stream, contextos contínuos) cabe nele, e a sobra dos blocos fáceis
+    # é reaproveitada (o total fica perto do orçamento)
+    budget = int(serial_stream.size * 0.6)
+    blocks = regression_blocks(corpus, dq_flag)
+    results = deepCABAC.search_qps_for_budget(blocks, model_byte_budget=budget, num_threads=num_threads,
+                                              param_opt_flag=PARAM_OPT_FLAG)
+    chosen = {r["param_name"]: r for r in results}
+    errors = ["orçamento: {} não coube ({} bytes, QP {})".format(name, r["bytes"], r["qp"])
+              for name, r in sorted(chosen.items()) if not r["budget_met"]]
+    budget_corpus = [(name, w, chosen[name]["qp"], scan_order) for name, w, _, scan_order in corpus]
+    levels, _ = quantize_serial(budget_corpus, dq_flag)
+    stream = encode_levels(budget_corpus, levels, dq_flag)
+    if stream.size > budget:
+        errors.append("orçamento: {} bytes codificados para {} de orçamento".format(stream.size, budget))
+    elif stream.size < 0.8 * budget:
+        errors.append("orçamento: só {} de {} bytes usados".format(stream.size, budget))
+    return errors
+
+
+def check_rec(corpus):
+    # rec() do approximator numa camada: os pesos saem do OutputArena (float32) e
+    # iguais aos de Decoder.dequantLayer num array NumPy comum
+    from nnc_core.approximator import baseline as approx_baseline
+    name, w, _, scan_order = corpus[0]
+    levels, qps = quantize_serial(corpus[:1], 0)
+    expected = dequantize_levels(corpus[:1], levels, qps)[name]
+
+    approx_data = {"parameters": {name: levels[name]}, "qp_density": QP_DENSITY, "qp": {name: qps[name]},
+                   "scan_order": {name: scan_order}, "approx_method": {name: "uniform"}}
+    try:
+        approx_baseline.rec(name, approx_data)
+    except Exception as e:
+        return ["rec({}): {}: {}".format(name, type(e).__name__, e)]
+    rec_weights = approx_data["parameters"][name]
+    if rec_weights.dtype != np.float32 or rec_weights.shape != w.shape:
+        return ["rec({}): saída {} {} em vez de float32 {}".format(name, rec_weights.dtype, rec_weights.shape, w.shape)]
+    if not np.array_equal(rec_weights, expected):
+        return ["rec({}): pesos reconstruídos diferem de dequantLayer".format(name)]
+    return []
+
+
+def run_flag(corpus, dq_flag, num_threads, repeat, min_seconds, seed):
+    # Uma rodada completa para um dq_flag: bitstreams, QPs, caminhos alternativos e tempos por etapa
+    serial_levels, serial_qps = quantize_serial(corpus, dq_flag)
+    parallel_levels, parallel_qps, _ = quantize_parallel(corpus, dq_flag, num_threads)
+    serial_stream = encode_levels(corpus, serial_levels, dq_flag)
+    parallel_stream = encode_levels(corpus, parallel_levels, dq_flag)
+
+    errors = compare_levels("paralelo", corpus, serial_levels, serial_qps, parallel_levels, parallel_qps)
+    if not np.array_equal(serial_stream, parallel_stream):
+        errors.append("bitstream paralelo difere do serial ({} vs {} bytes)".format(parallel_stream.size, serial_stream.size))
+    decoded = decode_levels(corpus, serial_stream, dq_flag)
+    for name, _, _, _ in corpus:
+        if not np.array_equal(decoded[name], serial_levels[name]):
+            errors.append("{}: decode não reproduz os níveis codificados".format(name))
+    errors += check_narrow(corpus, dq_flag, num_threads, serial_levels, serial_qps, serial_stream)
+    errors += check_dedup(corpus, dq_flag, num_threads, serial_levels, serial_qps)
+    errors += check_budget(corpus, dq_flag, num_threads, serial_stream)
+    delta_stream, delta_errors = run_delta(corpus, dq_flag, num_threads, seed)
+    errors += delta_errors
+
+    timings = {
+        "quantize_serial": stable_time(lambda: quantize_serial(corpus, dq_flag), repeat, min_seconds),
+        "quantize_parallel": stable_time(lambda: quantize_parallel(corpus, dq_flag, num_threads), repeat, min_seconds),
+        "encode": stable_time(lambda: encode_levels(corpus, serial_levels, dq_flag), repeat, min_seconds),
+        "decode": stable_time(lambda: decode_levels(corpus, serial_stream, dq_flag), repeat, min_seconds),
+        "dequant": stable_time(lambda: dequantize_levels(corpus, serial_levels, serial_qps), repeat, min_seconds),
+    }
+    streams = {"dq{}.bin".format(dq_flag): serial_stream, "delta_dq{}.bin".format(dq_flag): delta_stream}
+    return streams, serial_qps, timings, errors
+
+
+def memcpy_time(corpus, repeat, min_seconds):
+    # Unidade dos tempos: uma cópia de todos os pesos do corpus nesta máquina
+    targets = [np.empty_like(w) for _, w, _, _ in corpus]
+
+    def copy_all():
+        for target, (_, w, _, _) in zip(targets, corpus):
+            np.copyto(target, w)
+    return stable_time(copy_all, repeat, min_seconds)
+
+
+def timing_ratios(timings, copy_seconds):
+    ratios = {stage: seconds / copy_seconds for stage, seconds in timings.items()}
+    ratios["parallel_over_serial"] = timings["quantize_parallel"] / timings["quantize_serial"]
+    return ratios
+
+
+def main():
+    here = os.path.dirname(os.path.abspath(__file__))
+    parser = argparse.ArgumentParser(description="Regressão bit-exata e de desempenho do deepCABAC")
+    parser.add_argument("--golden-dir", default=os.path.join(here, "regression_golden"), help="Diretório dos bitstreams e do manifest.json de referência")
+    parser.add_argument("--update-golden", action="store_true", help="Grava os bitstreams e tempos desta rodada como nova referência")
+    parser.add_argument("--scale", type=float, default=0.125, help="Fator aplicado à primeira dimensão dos tensores do benchmark")
+    parser.add_argument("--seed", type=int, default=0)
+    parser.add_argument("--threads", type=int, default=0, help="Threads do caminho paralelo (0 = todas)")
+    parser.add_argument("--repeat", type=int, default=5, help="Amostras por medida (vale a melhor)")
+    parser.add_argument("--min-sample-seconds", type=float, default=0.2, help="Duração mínima de cada amostra de tempo")
+    parser.add_argument("--max-slowdown", type=float, default=0.20, help="Fração tolerada de aumento das razões de tempo sobre a referência")
+    parser.add_argument("--no-timing-check", action="store_true", help="Só confere os bits")
+    parser.add_argument("--json", default=None, help="Arquivo de saída com os resultados desta rodada")
+    args = parser.parse_args()
+
+    corpus = make_regression_corpus(args.scale, args.seed)
+    manifest_path = os.path.join(args.golden_dir, "manifest.json")
+    golden = None
+    if not args.update_golden:
+        if not os.path.exists(manifest_path):
+            print("Sem referência em '{}': rode com --update-golden primeiro".format(args.golden_dir))
+            return 2
+        with open(manifest_path) as f:
+            golden = json.load(f)
+        if golden.get("version") != GOLDEN_VERSION or golden["config"]["scale"] != args.scale or golden["config"]["seed"] != args.seed:
+            print("Referência gerada com outra versão/configuração; rode com --update-golden")
+            return 2
+        if golden["corpus_sha256"] != corpus_hash(corpus):
+            print("O corpus gerado difere do da referência (gerador do NumPy mudou?); rode com --update-golden")
+            return 2
+
+    failures = check_rec(corpus)
+    streams = {}
+    copy_seconds = memcpy_time(corpus, args.repeat, args.min_sample_seconds)
+    report = {"machine": {"platform": platform.platform(), "processor": platform.processor(), "cpu_count": os.cpu_count()},
+              "memcpy_seconds": copy_seconds, "flags": {}}
+    same_cpu_count = golden is not None and golden["machine"]["cpu_count"] == os.cpu_count()
+    for dq_flag in (0, 1): # URQ, TCQ
+        flag_streams, qps, timings, errors = run_flag(corpus, dq_flag, args.threads, args.repeat, args.min_sample_seconds, args.seed)
+        failures += ["dq_flag={}: {}".format(dq_flag, e) for e in errors]
+        ratios = timing_ratios(timings, copy_seconds)
+        entry = {"streams": {name: {"bytes": int(s.size), "sha256": sha256(s)} for name, s in flag_streams.items()},
+                 "qps": qps, "timings": timings, "ratios": ratios}
+        report["flags"][str(dq_flag)] = entry
+
+        if golden is not None:
+            ref = golden["flags"][str(dq_flag)]
+            for file_name, stream in sorted(flag_streams.items()):
+                ref_stream = np.fromfile(os.path.join(args.golden_dir, file_name), dtype=np.uint8)
+                if not np.array_equal(stream, ref_stream):
+                    failures.append("{}: bitstream difere da referência ({} vs {} bytes)".format(file_name, stream.size, ref_stream.size))
+            for stage, ratio in sorted(ratios.items()):
+                ref_ratio = ref["ratios"].get(stage)
+                change = ratio / ref_ratio if ref_ratio else None
+                print("dq={} {:<22} x{:9.3f}  ref x{:9.3f}  {}".format(dq_flag, stage, ratio, ref_ratio or 0.0,
+                                                                       "{:+.0%}".format(change - 1.0) if change else "-"))
+                if stage in ("quantize_parallel", "parallel_over_serial") and not same_cpu_count:
+                    continue # Depende do número de núcleos
+                if change and not args.no_timing_check and change > 1.0 + args.max_slowdown:
+                    failures.append("dq_flag={}: {} ficou {:.0%} mais lento que a referência (relativo à cópia de memória)".format(dq_flag, stage, change - 1.0))
+        else:
+            for stage, ratio in sorted(ratios.items()):
+                print("dq={} {:<22} x{:9.3f}".format(dq_flag, stage, ratio))
+
+        streams.update(flag_streams)
+
+    if args.update_golden:
+        if failures:
+            print("Caminhos divergem; referência NÃO atualizada:")
+            for failure in failures:
+                print("  " + failure)
+            return 1
+        if not os.path.isdir(args.golden_dir):
+            os.makedirs(args.golden_dir)
+        for file_name, stream in streams.items():
+            stream.tofile(os.path.join(args.golden_dir, file_name))
+        manifest = {"version": GOLDEN_VERSION, "config": {"scale": args.scale, "seed": args.seed, "threads": args.threads},
+                    "corpus_sha256": corpus_hash(corpus)}
+        manifest.update(report)
+        with open(manifest_path, "w") as f:
+            json.dump(manifest, f, indent=2)
+        print("Referência gravada em '{}'".format(args.golden_dir))
+
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump(dict(report, failures=failures), f, indent=2)
+
+    if failures:
+        print("FALHOU:")
+        for failure in failures:
+            print("  " + failure)
+        return 1
+    print("OK: bitstreams idênticos à referência" + ("" if golden is None or args.no_timing_check else " e tempos dentro do limite"))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())